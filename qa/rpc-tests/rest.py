@@ -10,6 +10,7 @@
 from test_framework import BitcoinTestFramework
 from util import *
 import json
+import time
 
 try:
     import http.client as httplib
@@ -33,6 +34,9 @@ def http_get_call(host, port, path, response_object = 0):
 class RESTTest (BitcoinTestFramework):
     FORMAT_SEPARATOR = "."
     
+    def setup_nodes(self):
+        return start_nodes(4, self.options.tmpdir, [ ["-addressindex"], [], [], [] ])
+
     def run_test(self):
         url = urlparse.urlparse(self.nodes[0].url)
         bb_hash = self.nodes[0].getbestblockhash()
@@ -82,6 +86,48 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(json_string)
         for tx in txs:
             assert_equal(tx in json_obj['tx'], True)
+
+        # page through the transactions of an address, three of them in one block
+        address = self.nodes[2].getnewaddress()
+        txs = []
+        for i in range(3):
+            txs.append(self.nodes[0].sendtoaddress(address, 1))
+        self.sync_all()
+        self.nodes[1].setgenerate(True, 1)
+        self.sync_all()
+        height = self.nodes[0].getblockcount()
+
+        # the address index catches up with the new block in the background
+        for i in range(100):
+            response = http_get_call(url.hostname, url.port, '/rest/address/balance/'+address+self.FORMAT_SEPARATOR+'json', True)
+            if response.status == 200:
+                json_obj = json.loads(response.read())
+                if json_obj['balance'] == 3:
+                    break
+            time.sleep(0.1)
+        assert_equal(json_obj['balance'], 3)
+
+        json_string = http_get_call(url.hostname, url.port, '/rest/address/txids/'+address+'/0/0/2'+self.FORMAT_SEPARATOR+'json')
+        page = json.loads(json_string)
+        assert_equal(len(page), 2)
+        assert_equal(page[1]['height'], height)
+        json_string = http_get_call(url.hostname, url.port, '/rest/address/txids/'+address+'/'+str(height)+'/2/2'+self.FORMAT_SEPARATOR+'json')
+        page += json.loads(json_string)
+        assert_equal(sorted([entry['txid'] for entry in page]), sorted(txs))
+
+        json_string = http_get_call(url.hostname, url.port, '/rest/address/utxos/'+address+self.FORMAT_SEPARATOR+'json')
+        utxos = json.loads(json_string)
+        assert_equal(len(utxos), 3)
+        json_string = http_get_call(url.hostname, url.port, '/rest/address/utxos/'+address+'/1/1'+self.FORMAT_SEPARATOR+'json')
+        assert_equal(json.loads(json_string), utxos[1:2])
+
+        # out of bounds paging arguments
+        response = http_get_call(url.hostname, url.port, '/rest/address/utxos/'+address+'/0/0'+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 400)
+        response = http_get_call(url.hostname, url.port, '/rest/address/txids/'+address+'/-1'+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 400)
+        response = http_get_call(url.hostname, url.port, '/rest/address/txids/'+address+'/0/0/10001'+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 400)
                 
         
 
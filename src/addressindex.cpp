@@ -0,0 +1,143 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+
+#include "base58.h"
+#include "clientversion.h"
+#include "hash.h"
+#include "main.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "util.h"
+
+CAddressIndex *paddressindex = NULL;
+
+uint160 GetScriptHash(const CScript &script)
+{
+    return Hash160(script.begin(), script.end());
+}
+
+bool GetAddressScriptHash(const std::string &strAddress, uint160 &hashScript)
+{
+    CBitcoinAddress address(strAddress);
+    if (!address.IsValid())
+        return false;
+    hashScript = GetScriptHash(GetScriptForDestination(address.Get()));
+    return true;
+}
+
+bool GetBlockAddressDeltas(const CBlock &block, const CBlockUndo &blockundo, int nHeight, std::vector<CAddressDelta> &vDelta)
+{
+    if (blockundo.vtxundo.size() + 1 != block.vtx.size())
+        return error("%s : block and undo data inconsistent", __func__);
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction &tx = block.vtx[i];
+        uint256 txid = tx.GetHash();
+        if (i > 0) {
+            const CTxUndo &txundo = blockundo.vtxundo[i - 1];
+            if (txundo.vprevout.size() != tx.vin.size())
+                return error("%s : transaction and undo data inconsistent", __func__);
+            for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                const CTxOut &txout = txundo.vprevout[j].txout;
+                CAddressDelta delta(GetScriptHash(txout.scriptPubKey), nHeight, i, txid, j, true, -txout.nValue);
+                delta.prevout = tx.vin[j].prevout;
+                vDelta.push_back(delta);
+            }
+        }
+        for (unsigned int j = 0; j < tx.vout.size(); j++) {
+            const CTxOut &txout = tx.vout[j];
+            if (txout.scriptPubKey.IsUnspendable())
+                continue;
+            vDelta.push_back(CAddressDelta(GetScriptHash(txout.scriptPubKey), nHeight, i, txid, j, false, txout.nValue));
+        }
+    }
+    return true;
+}
+
+CAddressIndex::CAddressIndex(size_t nCacheSize, bool fMemory, bool fWipe) : CChainIndex("addressindex"), db(nCacheSize, fMemory, fWipe)
+{
+}
+
+bool CAddressIndex::ReadBlockDeltas(const CBlockIndex *pindex, const char* pbegin, const char* pend, std::vector<CAddressDelta> &vDelta) const
+{
+    CBlock block;
+    try {
+        CMemoryReader(pbegin, pend, SER_DISK, CLIENT_VERSION) >> block;
+    } catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    CBlockUndo blockundo;
+    {
+        LOCK(cs_main);
+        if (!blockundo.ReadFromDisk(pindex->GetUndoPos(), pindex->pprev->GetBlockHash()))
+            return error("%s : reading the undo data of block %s failed", __func__, pindex->GetBlockHash().ToString());
+    }
+    return GetBlockAddressDeltas(block, blockundo, pindex->nHeight, vDelta);
+}
+
+bool CAddressIndex::AppendBlock(const CBlockIndex *pindex, const CDiskBlockPos &pos, const char* pbegin, const char* pend)
+{
+    // As in the UTXO set, the outputs of the genesis block do not exist.
+    if (pindex->pprev == NULL)
+        return true;
+    std::vector<CAddressDelta> vDelta;
+    return ReadBlockDeltas(pindex, pbegin, pend, vDelta) && ConnectDeltas(vDelta);
+}
+
+bool CAddressIndex::RemoveBlock(const CBlockIndex *pindex, const char* pbegin, const char* pend)
+{
+    if (pindex->pprev == NULL)
+        return true;
+    std::vector<CAddressDelta> vDelta;
+    return ReadBlockDeltas(pindex, pbegin, pend, vDelta) && DisconnectDeltas(vDelta);
+}
+
+bool CAddressIndex::ConnectDeltas(std::vector<CAddressDelta> &vDelta)
+{
+    for (std::vector<CAddressDelta>::iterator it = vDelta.begin(); it != vDelta.end(); it++) {
+        if (it->fSpending) {
+            // Remember the height of the output spent, to restore it on a rewind.
+            CAddressUnspentKey key(it->hashScript, it->prevout);
+            std::map<CAddressUnspentKey, CAddressUnspentValue>::iterator mi = mapUnspent.find(key);
+            CAddressUnspentValue value;
+            if (mi != mapUnspent.end())
+                value = mi->second;
+            else if (!db.ReadUnspent(key, value))
+                value.SetNull();
+            it->nPrevHeight = value.nHeight;
+            mapUnspent[key].SetNull();
+        } else {
+            mapUnspent[CAddressUnspentKey(it->hashScript, COutPoint(it->txid, it->nIndex))] = CAddressUnspentValue(it->nValue, it->nHeight);
+        }
+        vWrite.push_back(*it);
+    }
+    return true;
+}
+
+bool CAddressIndex::DisconnectDeltas(std::vector<CAddressDelta> &vDelta)
+{
+    for (std::vector<CAddressDelta>::reverse_iterator it = vDelta.rbegin(); it != vDelta.rend(); it++) {
+        if (it->fSpending) {
+            if (!db.ReadDelta(*it))
+                return error("%s : spending of %s:%u by %s not found", __func__, it->prevout.hash.ToString(), it->prevout.n, it->txid.ToString());
+            if (it->nPrevHeight >= 0)
+                mapUnspent[CAddressUnspentKey(it->hashScript, it->prevout)] = CAddressUnspentValue(-it->nValue, it->nPrevHeight);
+        } else {
+            mapUnspent[CAddressUnspentKey(it->hashScript, COutPoint(it->txid, it->nIndex))].SetNull();
+        }
+        vErase.push_back(*it);
+    }
+    return true;
+}
+
+bool CAddressIndex::WriteBatch(const CBlockLocator &locator)
+{
+    if (!db.WriteDeltas(vErase, vWrite, mapUnspent, locator))
+        return false;
+    vErase.clear();
+    vWrite.clear();
+    mapUnspent.clear();
+    return true;
+}
@@ -0,0 +1,87 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "chainindex.h"
+#include "txdb.h"
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+class CScript;
+
+/** Default number of transactions or outputs returned by an address query */
+static const unsigned int DEFAULT_ADDRESS_RESULTS = 100;
+/** Maximum number of transactions or outputs returned by an address query */
+static const unsigned int MAX_ADDRESS_RESULTS = 10000;
+
+/**
+ * The address index (-addressindex): for each scriptPubKey of the active
+ * chain, the outputs paying to it and the inputs spending them, in chain
+ * order, and its unspent outputs. The amounts and scripts of the outputs
+ * spent come from the undo data of the blocks.
+ */
+class CAddressIndex : public CChainIndex
+{
+private:
+    CAddressIndexDB db;
+    std::vector<CAddressDelta> vErase;
+    std::vector<CAddressDelta> vWrite;
+    //! unspent outputs created (or, when null, spent) by the collected blocks
+    std::map<CAddressUnspentKey, CAddressUnspentValue> mapUnspent;
+
+    //! Read a block and its undo data, and get its deltas
+    bool ReadBlockDeltas(const CBlockIndex *pindex, const char* pbegin, const char* pend, std::vector<CAddressDelta> &vDelta) const;
+
+protected:
+    bool AppendBlock(const CBlockIndex *pindex, const CDiskBlockPos &pos, const char* pbegin, const char* pend);
+    bool RemoveBlock(const CBlockIndex *pindex, const char* pbegin, const char* pend);
+    size_t GetBatchSize() const { return vErase.size() + vWrite.size() + mapUnspent.size(); }
+    bool WriteBatch(const CBlockLocator &locator);
+    bool ReadBestBlock(CBlockLocator &locator) const { return db.ReadBestBlock(locator); }
+
+    //! Collect the deltas of a connected block, in block order
+    bool ConnectDeltas(std::vector<CAddressDelta> &vDelta);
+    //! Collect the removal of the deltas of a disconnected block, in block order
+    bool DisconnectDeltas(std::vector<CAddressDelta> &vDelta);
+
+public:
+    CAddressIndex(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    bool FindDeltas(const uint160 &hashScript, int nStartHeight, int nEndHeight, unsigned int nSkipTxs, unsigned int nMaxTxs, std::vector<CAddressDelta> &vDelta) const {
+        return db.FindDeltas(hashScript, nStartHeight, nEndHeight, nSkipTxs, nMaxTxs, vDelta);
+    }
+    bool FindUnspent(const uint160 &hashScript, unsigned int nSkip, unsigned int nMaxResults, std::vector<std::pair<COutPoint, CAddressUnspentValue> > &vUnspent) const {
+        return db.FindUnspent(hashScript, nSkip, nMaxResults, vUnspent);
+    }
+    //! The balance of a script, and everything it ever received
+    bool GetBalance(const uint160 &hashScript, CAmount &nBalance, CAmount &nReceived) const {
+        return db.ReadBalance(hashScript, nBalance, nReceived);
+    }
+};
+
+/** The key of a scriptPubKey in the address index */
+uint160 GetScriptHash(const CScript &script);
+
+/** The key in the address index of the scriptPubKey of an address; false if the address is invalid */
+bool GetAddressScriptHash(const std::string &strAddress, uint160 &hashScript);
+
+/**
+ * Append the deltas of a block at height nHeight to vDelta, in block order,
+ * taking the outputs spent from its undo data. Provably unspendable outputs
+ * are left out.
+ */
+bool GetBlockAddressDeltas(const CBlock &block, const CBlockUndo &blockundo, int nHeight, std::vector<CAddressDelta> &vDelta);
+
+/** The address index, or NULL without -addressindex */
+extern CAddressIndex *paddressindex;
+
+#endif // BITCOIN_ADDRESSINDEX_H
@@ -0,0 +1,89 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockimport.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "streams.h"
+#include "util.h"
+
+#include <string.h>
+
+#include <boost/bind.hpp>
+
+CBlockImporter::CBlockImporter(FILE* fileIn, CDiskBlockPos* dbp, int nWorkers, CheckFunc checkIn) :
+    check(checkIn), queue(nWorkers, boost::bind(&CBlockImporter::Check, this, _1), "florincoin-loadchk"),
+    threadRead(boost::bind(&CBlockImporter::ReadThread, this, fileIn, dbp))
+{
+}
+
+CBlockImporter::~CBlockImporter()
+{
+    queue.Stop();
+    threadRead.join();
+}
+
+void CBlockImporter::ReadThread(FILE* fileIn, CDiskBlockPos* dbp)
+{
+    RenameThread("florincoin-loadblk");
+    try {
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+        uint64_t nRewind = blkdat.GetPos();
+        while (!blkdat.eof()) {
+            blkdat.SetPos(nRewind);
+            nRewind++; // start one byte further next time, in case of failure
+            blkdat.SetLimit(); // remove former limit
+            unsigned int nSize = 0;
+            try {
+                // locate a header
+                unsigned char buf[MESSAGE_START_SIZE];
+                blkdat.FindByte(Params().MessageStart()[0]);
+                nRewind = blkdat.GetPos()+1;
+                blkdat >> FLATDATA(buf);
+                if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
+                    continue;
+                // read size
+                blkdat >> nSize;
+                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                    continue;
+            } catch (const std::exception &) {
+                // no valid block header found; don't complain
+                break;
+            }
+            CImportedBlock* pimport = new CImportedBlock();
+            try {
+                // read block
+                uint64_t nBlockPos = blkdat.GetPos();
+                if (dbp) {
+                    pimport->pos = *dbp;
+                    pimport->pos.nPos = nBlockPos;
+                }
+                blkdat.SetLimit(nBlockPos + nSize);
+                blkdat.SetPos(nBlockPos);
+                blkdat >> pimport->block;
+                nRewind = blkdat.GetPos();
+            } catch (const std::exception &e) {
+                LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
+                delete pimport;
+                continue;
+            }
+
+            if (!queue.Push(pimport, MAX_QUEUED))
+                return;
+        }
+    } catch (const std::runtime_error &e) {
+        strReadError = e.what();
+    }
+    queue.Close();
+}
+
+CImportedBlock* CBlockImporter::Next()
+{
+    CImportedBlock* pimport = queue.Pop();
+    if (!pimport && !strReadError.empty())
+        throw std::runtime_error(strReadError);
+    return pimport;
+}
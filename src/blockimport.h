@@ -0,0 +1,80 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKIMPORT_H
+#define BITCOIN_BLOCKIMPORT_H
+
+#include "chain.h"
+#include "orderedqueue.h"
+#include "primitives/block.h"
+#include "uint256.h"
+
+#include <stdio.h>
+
+#include <string>
+
+#include <boost/thread/thread.hpp>
+
+/** A block read by CBlockImporter, with the results of its context-free checks. */
+struct CImportedBlock
+{
+    CBlock block;
+    CDiskBlockPos pos;
+    uint256 hashPoW;
+    //! whether the block passed the checks (with hashPoW)
+    bool fChecked;
+    //! whether the checks have been run
+    bool fDone;
+
+    CImportedBlock() : fChecked(false), fDone(false) {}
+};
+
+/**
+ * Pipeline behind LoadExternalBlockFile. A reader thread scans the file for
+ * blocks and deserializes them; worker threads compute their scrypt PoW hash
+ * and run CheckBlock; the caller takes them in file order and connects them.
+ * The stages hand off through one bounded COrderedWorkQueue, so that a slow
+ * validation stage stalls the reader instead of piling up blocks in memory.
+ */
+class CBlockImporter
+{
+public:
+    /** The checks run on every block: fill in hashPoW, and return whether the block passed */
+    typedef bool (*CheckFunc)(const CBlock& block, uint256& hashPoW);
+
+    //! Maximum number of blocks between the reader and the validation stage
+    static const unsigned int MAX_QUEUED = 64;
+
+private:
+    CheckFunc check;
+    //! all blocks read and not yet taken, in file order
+    COrderedWorkQueue<CImportedBlock> queue;
+    //! set by the reader before it closes the queue
+    std::string strReadError;
+    boost::thread threadRead;
+
+    void Check(CImportedBlock& import) {
+        import.fChecked = check(import.block, import.hashPoW);
+    }
+
+    void ReadThread(FILE* fileIn, CDiskBlockPos* dbp);
+
+public:
+    /**
+     * Start reading fileIn (which is closed when done), with nWorkers threads
+     * running checkIn. Blocks get positions in the file dbp names, if given.
+     */
+    CBlockImporter(FILE* fileIn, CDiskBlockPos* dbp, int nWorkers, CheckFunc checkIn);
+    //! Stop reading and checking, and drop the blocks not taken
+    ~CBlockImporter();
+
+    /**
+     * Return the next block in file order once it has been checked (checking
+     * blocks while waiting for that), or NULL at the end of the file. The
+     * caller takes ownership. Throws if the file could not be read.
+     */
+    CImportedBlock* Next();
+};
+
+#endif // BITCOIN_BLOCKIMPORT_H
@@ -0,0 +1,180 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockreader.h"
+
+#include "clientversion.h"
+#include "compat.h"
+#include "main.h"
+#include "streams.h"
+#include "util.h"
+
+#include <limits>
+
+#include <boost/filesystem.hpp>
+
+#ifndef WIN32
+#include <sys/stat.h>
+#endif
+
+/** A block or undo file, mapped into memory (or kept open where mmap is not available) */
+class CBlockFile
+{
+private:
+    // Disallow copies
+    CBlockFile(const CBlockFile&);
+    CBlockFile& operator=(const CBlockFile&);
+
+public:
+    //! size of the file when it was opened; it may have grown since
+    uint64_t nSize;
+#ifndef WIN32
+    const char* pdata;
+#else
+    boost::mutex mutex;
+    FILE* file;
+#endif
+
+    CBlockFile() : nSize(0) {
+#ifndef WIN32
+        pdata = NULL;
+#else
+        file = NULL;
+#endif
+    }
+
+    ~CBlockFile() {
+#ifndef WIN32
+        if (pdata)
+            munmap((void*)pdata, nSize);
+#else
+        if (file)
+            fclose(file);
+#endif
+    }
+
+    bool Open(const boost::filesystem::path& path) {
+#ifndef WIN32
+        int fd = open(path.string().c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+            return false;
+        pdata = (const char*)p;
+        nSize = st.st_size;
+#else
+        file = fopen(path.string().c_str(), "rb");
+        if (!file)
+            return false;
+        // Reads from the open file see it grow, so there is no need to reopen it.
+        nSize = std::numeric_limits<uint64_t>::max();
+#endif
+        return true;
+    }
+};
+
+CBlockFileReader::CBlockFileReader(unsigned int nMaxFilesIn) : nMaxFiles(nMaxFilesIn)
+{
+}
+
+boost::shared_ptr<CBlockFile> CBlockFileReader::GetFile(const CDiskBlockPos& pos, const char* prefix, uint64_t nMinSize)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    FileKey key(prefix, pos.nFile);
+    FileMap::iterator it = mapFiles.find(key);
+    if (it != mapFiles.end()) {
+        listUsed.splice(listUsed.begin(), listUsed, it->second.second);
+        if (it->second.first->nSize >= nMinSize)
+            return it->second.first;
+    }
+
+    // Not open yet, or the file has grown since it was mapped: (re)open it.
+    // Records still referencing the old mapping keep it alive.
+    boost::filesystem::path path = GetBlockPosFilename(pos, prefix);
+    boost::shared_ptr<CBlockFile> file(new CBlockFile());
+    if (!file->Open(path)) {
+        LogPrintf("Unable to open file %s\n", path.string());
+        return boost::shared_ptr<CBlockFile>();
+    }
+    if (it != mapFiles.end()) {
+        it->second.first = file;
+    } else {
+        listUsed.push_front(key);
+        mapFiles.insert(std::make_pair(key, std::make_pair(file, listUsed.begin())));
+        if (listUsed.size() > nMaxFiles) {
+            mapFiles.erase(listUsed.back());
+            listUsed.pop_back();
+        }
+    }
+    if (file->nSize < nMinSize)
+        return boost::shared_ptr<CBlockFile>();
+    return file;
+}
+
+bool CBlockFileReader::Read(const CDiskBlockPos& pos, const char* prefix, CBlockFileRecord& record, unsigned int nExtra)
+{
+    if (pos.IsNull() || pos.nPos < sizeof(unsigned int))
+        return error("%s : invalid position %d:%u in %s file", __func__, pos.nFile, pos.nPos, prefix);
+
+    // The record is preceded by its size.
+    boost::shared_ptr<CBlockFile> file = GetFile(pos, prefix, pos.nPos);
+    if (!file)
+        return error("%s : position %d:%u is past the end of the %s file", __func__, pos.nFile, pos.nPos, prefix);
+    unsigned int nSize = 0;
+#ifndef WIN32
+    CMemoryReader(file->pdata + pos.nPos - sizeof(nSize), file->pdata + pos.nPos, SER_DISK, CLIENT_VERSION) >> nSize;
+    uint64_t nEnd = (uint64_t)pos.nPos + nSize + nExtra;
+    if (nEnd > file->nSize) {
+        file = GetFile(pos, prefix, nEnd);
+        if (!file)
+            return error("%s : record at %d:%u runs past the end of the %s file", __func__, pos.nFile, pos.nPos, prefix);
+    }
+    record.file = file;
+    record.vch.clear();
+    record.pbegin = file->pdata + pos.nPos;
+    record.pend = record.pbegin + nSize + nExtra;
+#else
+    boost::unique_lock<boost::mutex> lock(file->mutex);
+    char buf[sizeof(nSize)];
+    if (fseek(file->file, pos.nPos - sizeof(nSize), SEEK_SET) != 0 || fread(buf, 1, sizeof(buf), file->file) != sizeof(buf))
+        return error("%s : unable to read record at %d:%u in %s file", __func__, pos.nFile, pos.nPos, prefix);
+    CMemoryReader(buf, buf + sizeof(buf), SER_DISK, CLIENT_VERSION) >> nSize;
+    if (nSize > MAX_BLOCKFILE_SIZE)
+        return error("%s : invalid record at %d:%u in %s file", __func__, pos.nFile, pos.nPos, prefix);
+    record.vch.resize(nSize + nExtra);
+    if (!record.vch.empty() && fread(&record.vch[0], 1, record.vch.size(), file->file) != record.vch.size())
+        return error("%s : record at %d:%u runs past the end of the %s file", __func__, pos.nFile, pos.nPos, prefix);
+    record.file.reset();
+    record.pbegin = record.vch.empty() ? NULL : &record.vch[0];
+    record.pend = record.pbegin + record.vch.size();
+#endif
+    return true;
+}
+
+void CBlockFileReader::Forget(int nFile)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    const char* prefixes[] = {"blk", "rev"};
+    for (unsigned int i = 0; i < 2; i++) {
+        FileMap::iterator it = mapFiles.find(FileKey(prefixes[i], nFile));
+        if (it != mapFiles.end()) {
+            listUsed.erase(it->second.second);
+            mapFiles.erase(it);
+        }
+    }
+}
+
+void CBlockFileReader::Clear()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    listUsed.clear();
+    mapFiles.clear();
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKREADER_H
+#define BITCOIN_BLOCKREADER_H
+
+#include "chain.h"
+
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CBlockFile;
+
+/** Maximum number of block and undo files kept mapped (or open) for reading */
+static const unsigned int MAX_READ_BLOCK_FILES = sizeof(void*) > 4 ? 64 : 8;
+
+/**
+ * A record read from a block or undo file: the serialized block or undo data
+ * that was written after a (message start, size) header. It stays valid as
+ * long as this object exists, even when the file is dropped from the cache.
+ */
+class CBlockFileRecord
+{
+private:
+    friend class CBlockFileReader;
+
+    //! keeps the mapping that begin() and end() point into alive
+    boost::shared_ptr<CBlockFile> file;
+    //! the data, where it could not be mapped
+    std::vector<char> vch;
+    const char* pbegin;
+    const char* pend;
+
+public:
+    CBlockFileRecord() : pbegin(NULL), pend(NULL) {}
+
+    const char* begin() const { return pbegin; }
+    const char* end() const { return pend; }
+};
+
+/**
+ * Reads records from the blk?????.dat and rev?????.dat files. The most
+ * recently used files are kept memory-mapped, so that a record is read
+ * without any system call and can be deserialized straight from the page
+ * cache (see CMemoryReader). Where mmap is not available, the files are kept
+ * open instead and records are copied out. Thread-safe.
+ */
+class CBlockFileReader
+{
+private:
+    typedef std::pair<std::string, int> FileKey;
+    typedef std::list<FileKey> FileList;
+    typedef std::map<FileKey, std::pair<boost::shared_ptr<CBlockFile>, FileList::iterator> > FileMap;
+
+    boost::mutex mutex;
+    unsigned int nMaxFiles;
+    //! most recently used first
+    FileList listUsed;
+    FileMap mapFiles;
+
+    boost::shared_ptr<CBlockFile> GetFile(const CDiskBlockPos& pos, const char* prefix, uint64_t nMinSize);
+
+public:
+    CBlockFileReader(unsigned int nMaxFilesIn = MAX_READ_BLOCK_FILES);
+
+    /**
+     * Read the record at pos in the given kind of file ("blk" or "rev"),
+     * followed by nExtra more bytes (such as the checksum of undo data).
+     */
+    bool Read(const CDiskBlockPos& pos, const char* prefix, CBlockFileRecord& record, unsigned int nExtra = 0);
+
+    //! Drop file nFile of either kind, to be called when it is truncated or removed
+    void Forget(int nFile);
+    //! Drop all files
+    void Clear();
+};
+
+#endif // BITCOIN_BLOCKREADER_H
@@ -5,8 +5,36 @@
 
 #include "chain.h"
 
+#include "memusage.h"
+
 using namespace std;
 
+/**
+ * CBlockIndexArena implementation
+ */
+CBlockIndex* CBlockIndexArena::Allocate() {
+    if (nUsed == SLAB_ENTRIES) {
+        vSlabs.push_back(static_cast<CBlockIndex*>(::operator new(SLAB_ENTRIES * sizeof(CBlockIndex))));
+        nUsed = 0;
+    }
+    return vSlabs.back() + nUsed++;
+}
+
+void CBlockIndexArena::Clear() {
+    for (size_t i = 0; i < vSlabs.size(); i++) {
+        size_t nEntries = i + 1 < vSlabs.size() ? SLAB_ENTRIES : nUsed;
+        for (size_t j = 0; j < nEntries; j++)
+            vSlabs[i][j].~CBlockIndex();
+        ::operator delete(vSlabs[i]);
+    }
+    vSlabs.clear();
+    nUsed = SLAB_ENTRIES;
+}
+
+size_t CBlockIndexArena::DynamicMemoryUsage() const {
+    return vSlabs.size() * memusage::MallocUsage(SLAB_ENTRIES * sizeof(CBlockIndex)) + memusage::DynamicUsage(vSlabs);
+}
+
 /**
  * CChain implementation
  */
@@ -11,6 +11,7 @@
 #include "tinyformat.h"
 #include "uint256.h"
 
+#include <new>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -85,8 +86,13 @@ enum BlockStatus {
     BLOCK_FAILED_VALID       =   32, //! stage after last reached validness failed
     BLOCK_FAILED_CHILD       =   64, //! descends from failed block
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
+
+    BLOCK_HAVE_POWHASH       =  128, //! scrypt PoW hash stored in the block index
 };
 
+/** Client version from which block index entries with BLOCK_HAVE_POWHASH carry the hash */
+static const int POWHASH_INDEX_VERSION = 100406;
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block. A blockindex may have multiple pprev pointing
@@ -138,6 +144,10 @@ public:
     unsigned int nBits;
     unsigned int nNonce;
 
+    //! scrypt hash of the block header (only set if nStatus & BLOCK_HAVE_POWHASH).
+    //! Costs 32 bytes per entry, to spare rehashing every header on startup.
+    uint256 hashPoW;
+
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
 
@@ -161,6 +171,7 @@ public:
         nTime          = 0;
         nBits          = 0;
         nNonce         = 0;
+        hashPoW        = 0;
     }
 
     CBlockIndex()
@@ -217,6 +228,8 @@ public:
 
     uint256 GetBlockPoWHash() const
     {
+        if (nStatus & BLOCK_HAVE_POWHASH)
+            return hashPoW;
         return GetBlockHeader().GetPoWHash();
     }
 
@@ -326,9 +339,22 @@ public:
         READWRITE(nTime);
         READWRITE(nBits);
         READWRITE(nNonce);
+
+        // Appended after the header so that older clients simply ignore it.
+        // They keep the status bit when they rewrite the entry without the
+        // hash though, so the bit only counts in entries written by a client
+        // that knows about it.
+        if (!(nType & SER_GETHASH)) {
+            if (nVersion < POWHASH_INDEX_VERSION) {
+                if (ser_action.ForRead())
+                    nStatus &= ~BLOCK_HAVE_POWHASH;
+            } else if (nStatus & BLOCK_HAVE_POWHASH) {
+                READWRITE(hashPoW);
+            }
+        }
     }
 
-    uint256 GetBlockHash() const
+    CBlockHeader GetBlockHeader() const
     {
         CBlockHeader block;
         block.nVersion        = nVersion;
@@ -337,7 +363,12 @@ public:
         block.nTime           = nTime;
         block.nBits           = nBits;
         block.nNonce          = nNonce;
-        return block.GetHash();
+        return block;
+    }
+
+    uint256 GetBlockHash() const
+    {
+        return GetBlockHeader().GetHash();
     }
 
 
@@ -352,6 +383,43 @@ public:
     }
 };
 
+/**
+ * Allocator for the entries of the block index. They are created in slabs of
+ * many entries at a time instead of by one heap allocation each, which saves
+ * the allocator overhead and keeps entries created together (like when the
+ * index is loaded) close in memory. The block index only grows, so entries
+ * are never freed by themselves: they all go when the arena is cleared.
+ * Not thread-safe.
+ */
+class CBlockIndexArena
+{
+private:
+    static const size_t SLAB_ENTRIES = 4096;
+
+    std::vector<CBlockIndex*> vSlabs;
+    //! number of entries used in the last slab
+    size_t nUsed;
+
+    CBlockIndex* Allocate();
+
+    // Disallow copies
+    CBlockIndexArena(const CBlockIndexArena&);
+    CBlockIndexArena& operator=(const CBlockIndexArena&);
+
+public:
+    CBlockIndexArena() : nUsed(SLAB_ENTRIES) {}
+    ~CBlockIndexArena() { Clear(); }
+
+    CBlockIndex* New() { return new (Allocate()) CBlockIndex(); }
+    CBlockIndex* New(const CBlockHeader& block) { return new (Allocate()) CBlockIndex(block); }
+
+    //! Destroy all entries
+    void Clear();
+
+    size_t size() const { return vSlabs.empty() ? 0 : (vSlabs.size() - 1) * SLAB_ENTRIES + nUsed; }
+    size_t DynamicMemoryUsage() const;
+};
+
 /** An in-memory indexed chain of blocks. */
 class CChain {
 private:
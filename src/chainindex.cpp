@@ -0,0 +1,197 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainindex.h"
+
+#include "blockreader.h"
+#include "main.h"
+#include "util.h"
+
+#include <boost/thread.hpp>
+
+CChainIndex::CChainIndex(const std::string &strNameIn) : strName(strNameIn), pindexIndexed(NULL), fSynced(false), fNotified(false)
+{
+}
+
+bool CChainIndex::IsSynced() const
+{
+    // The tip may have been reorganized away from the index before it was
+    // announced, so look at the active chain too.
+    LOCK(cs_main);
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return fSynced && (pindexIndexed == NULL || chainActive.Contains(pindexIndexed));
+}
+
+int CChainIndex::GetBestHeight() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return pindexIndexed ? pindexIndexed->nHeight : -1;
+}
+
+void CChainIndex::NotifyBlockTip(const uint256 &hash)
+{
+    {
+        LOCK(cs_main);
+        boost::unique_lock<boost::mutex> lock(mutex);
+        // Until the thread has rewound the index, it holds entries of disconnected blocks.
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (pindexIndexed && mi != mapBlockIndex.end() && mi->second->GetAncestor(pindexIndexed->nHeight) != pindexIndexed)
+            fSynced = false;
+        fNotified = true;
+    }
+    cond.notify_all();
+}
+
+void CChainIndex::WaitForBlocks()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    // New tips are not announced during the initial block download, so look
+    // again after a while regardless.
+    if (!fNotified)
+        cond.timed_wait(lock, boost::posix_time::seconds(1));
+    fNotified = false;
+}
+
+bool CChainIndex::Commit(const CBlockIndex *pindex)
+{
+    CBlockLocator locator;
+    if (pindex) {
+        LOCK(cs_main);
+        locator = chainActive.GetLocator(pindex);
+    }
+    try {
+        if (!WriteBatch(locator))
+            return error("%s : writing the %s failed", __func__, strName);
+    } catch (std::exception &e) {
+        return error("%s : writing the %s failed - %s", __func__, strName, e.what());
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        pindexIndexed = pindex;
+    }
+    return true;
+}
+
+bool CChainIndex::Rewind(const CBlockIndex *pindex, const CBlockIndex *pindexFork)
+{
+    LogPrintf("%s: rewinding from height %d to %d\n", strName, pindex->nHeight, pindexFork ? pindexFork->nHeight : -1);
+    for (; pindex != pindexFork; pindex = pindex->pprev) {
+        boost::this_thread::interruption_point();
+        CBlockFileRecord record;
+        {
+            LOCK(cs_main);
+            if ((pindex->nStatus & BLOCK_HAVE_DATA) && !ReadRawBlockFromDisk(record, pindex))
+                return error("%s : reading block %s failed", __func__, pindex->GetBlockHash().ToString());
+        }
+        if (record.begin() != NULL && !RemoveBlock(pindex, record.begin(), record.end()))
+            return error("%s : removing block %s from the %s failed", __func__, pindex->GetBlockHash().ToString(), strName);
+    }
+    return Commit(pindexFork);
+}
+
+void CChainIndex::Thread()
+{
+    const CBlockIndex *pindexBest = NULL;
+    {
+        LOCK(cs_main);
+        CBlockLocator locator;
+        if (ReadBestBlock(locator) && !locator.IsNull()) {
+            // Start from the last block indexed, even if it is no longer in
+            // the active chain, so that its entries get removed.
+            BlockMap::iterator mi = mapBlockIndex.find(locator.vHave[0]);
+            if (mi != mapBlockIndex.end())
+                pindexBest = mi->second;
+            else
+                pindexBest = FindForkInGlobalIndex(chainActive, locator);
+        }
+    }
+    if (pindexBest)
+        LogPrintf("%s: resuming from height %d\n", strName, pindexBest->nHeight);
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        pindexIndexed = pindexBest;
+    }
+
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        // After a reorganization, remove the entries of the disconnected blocks.
+        const CBlockIndex *pindexFork = pindexBest;
+        {
+            LOCK(cs_main);
+            if (pindexBest && !chainActive.Contains(pindexBest))
+                pindexFork = chainActive.FindFork(pindexBest);
+        }
+        if (pindexFork != pindexBest) {
+            if (!Rewind(pindexBest, pindexFork)) {
+                LogPrintf("%s: stopping\n", strName);
+                return;
+            }
+            pindexBest = pindexFork;
+        }
+
+        // Collect the entries of the next blocks of the active chain.
+        const CBlockIndex *pindex = pindexBest;
+        bool fCaughtUp = false;
+        for (unsigned int nBlocks = 0; nBlocks < CHAIN_INDEX_BATCH_BLOCKS && GetBatchSize() < CHAIN_INDEX_BATCH_SIZE; nBlocks++) {
+            boost::this_thread::interruption_point();
+            CBlockFileRecord record;
+            CDiskBlockPos pos;
+            {
+                LOCK(cs_main);
+                // Reorganized meanwhile: write what we have, and rewind next.
+                if (pindex && !chainActive.Contains(pindex))
+                    break;
+                const CBlockIndex *pindexNext = pindex ? chainActive.Next(pindex) : chainActive.Genesis();
+                if (pindexNext == NULL) {
+                    fCaughtUp = true;
+                    break;
+                }
+                // Blocks below a UTXO snapshot are not stored.
+                if (pindexNext->nStatus & BLOCK_HAVE_DATA) {
+                    if (!ReadRawBlockFromDisk(record, pindexNext)) {
+                        LogPrintf("%s: reading block %s failed, stopping\n", strName, pindexNext->GetBlockHash().ToString());
+                        return;
+                    }
+                    pos = pindexNext->GetBlockPos();
+                }
+                pindex = pindexNext;
+            }
+            if (record.begin() != NULL && !AppendBlock(pindex, pos, record.begin(), record.end())) {
+                LogPrintf("%s: indexing block %s failed, stopping\n", strName, pindex->GetBlockHash().ToString());
+                return;
+            }
+        }
+
+        if (pindex != pindexBest) {
+            size_t nEntries = GetBatchSize();
+            if (!Commit(pindex)) {
+                LogPrintf("%s: stopping\n", strName);
+                return;
+            }
+            LogPrint(strName.c_str(), "%s: wrote %u entries up to height %d\n", strName, nEntries, pindex->nHeight);
+            pindexBest = pindex;
+        }
+
+        bool fWasSynced;
+        {
+            LOCK(cs_main);
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fWasSynced = fSynced;
+            // Not if reorganized meanwhile, as NotifyBlockTip may have cleared it already.
+            fSynced = fCaughtUp && (pindexBest == NULL || chainActive.Contains(pindexBest));
+        }
+        if (fCaughtUp) {
+            if (!fWasSynced)
+                LogPrintf("%s: synced to height %d\n", strName, pindexBest ? pindexBest->nHeight : -1);
+            WaitForBlocks();
+        }
+    }
+}
+
+void ThreadChainIndex(CChainIndex *pchainindex)
+{
+    RenameThread(("florincoin-" + pchainindex->GetName()).c_str());
+    pchainindex->Thread();
+}
@@ -0,0 +1,79 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CHAININDEX_H
+#define BITCOIN_CHAININDEX_H
+
+#include <string>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CBlockIndex;
+class CBlockLocator;
+class uint256;
+struct CDiskBlockPos;
+
+/** Number of entries an index collects before writing them out */
+static const unsigned int CHAIN_INDEX_BATCH_SIZE = 50000;
+/** Number of blocks an index processes at most before writing out its entries */
+static const unsigned int CHAIN_INDEX_BATCH_BLOCKS = 2000;
+
+/**
+ * An optional index of the active chain, built by a background thread so that
+ * connecting a block never waits for it. The thread reads the blocks of the
+ * active chain from disk, lets the derived class collect their entries, and
+ * writes them in batches together with the locator of the last block. After
+ * a restart it resumes from there; after a reorganization it first removes
+ * the entries of the disconnected blocks. Lookups can be made at any time,
+ * but only find everything once the index has caught up.
+ */
+class CChainIndex
+{
+private:
+    std::string strName;
+    mutable boost::mutex mutex;
+    boost::condition_variable cond;
+    //! the last block whose entries are written, or NULL
+    const CBlockIndex *pindexIndexed;
+    bool fSynced;
+    bool fNotified;
+
+    //! Wait until the active chain may have changed
+    void WaitForBlocks();
+    //! Write the collected entries, as of pindex (which may be NULL)
+    bool Commit(const CBlockIndex *pindex);
+    //! Remove the entries of the blocks after pindexFork up to pindex
+    bool Rewind(const CBlockIndex *pindex, const CBlockIndex *pindexFork);
+
+protected:
+    //! Collect the entries of a block of the active chain, serialized in [pbegin, pend) and stored at pos
+    virtual bool AppendBlock(const CBlockIndex *pindex, const CDiskBlockPos &pos, const char* pbegin, const char* pend) = 0;
+    //! Collect the removal of the entries of a disconnected block; by default they are kept
+    virtual bool RemoveBlock(const CBlockIndex *pindex, const char* pbegin, const char* pend) { return true; }
+    //! Number of entries collected and not written yet
+    virtual size_t GetBatchSize() const = 0;
+    //! Write the collected entries along with the locator of the last block they cover, and clear them
+    virtual bool WriteBatch(const CBlockLocator &locator) = 0;
+    virtual bool ReadBestBlock(CBlockLocator &locator) const = 0;
+
+public:
+    CChainIndex(const std::string &strNameIn);
+    virtual ~CChainIndex() {}
+
+    const std::string &GetName() const { return strName; }
+    //! Whether all blocks of the active chain have been indexed, and none of another branch
+    bool IsSynced() const;
+    //! Height of the last block indexed, or -1
+    int GetBestHeight() const;
+
+    //! Wake up the index thread, as the active chain changed (no longer synced, if it was reorganized)
+    void NotifyBlockTip(const uint256 &hash);
+    //! Index thread loop; returns when interrupted or on error
+    void Thread();
+};
+
+void ThreadChainIndex(CChainIndex *pchainindex);
+
+#endif // BITCOIN_CHAININDEX_H
@@ -6,14 +6,16 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <deque>
 #include <vector>
 
 #include <boost/foreach.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
-template <typename T>
+template <typename T, typename Q>
 class CCheckQueueControl;
 
 /** 
@@ -169,19 +171,238 @@ public:
 
 };
 
+/**
+ * Work-stealing variant of CCheckQueue, with the same interface.
+ *
+ * Every worker (and the master) owns a deque of verifications, protected by
+ * its own mutex. The master spreads added batches over all deques; a worker
+ * takes work from the back of its own deque and, when that runs dry, steals
+ * half of another deque from the front. The counts of queued and unfinished
+ * verifications are updated atomically, so the only lock shared by all
+ * threads is the one used to sleep when there is no work at all.
+ */
+template <typename T>
+class CWorkStealingCheckQueue
+{
+private:
+    struct CWorkerQueue
+    {
+        boost::mutex mutex;
+        std::deque<T> checks;
+        //! Copy of checks.size(), so empty deques can be skipped without locking
+        volatile int nSize;
+
+        CWorkerQueue() : nSize(0) {}
+    };
+
+    //! One deque per worker; slot 0 belongs to the master
+    std::vector<CWorkerQueue*> vQueues;
+
+    //! Number of slots handed out to worker threads so far
+    volatile int nWorkers;
+
+    //! Verifications added but not yet taken out of a deque
+    volatile int nQueued;
+
+    //! Verifications added but not yet completed
+    volatile int nPending;
+
+    //! Cleared when any verification fails
+    volatile int fAllOk;
+
+    //! Mutex for sleeping while there is no work
+    boost::mutex mutexSleep;
+
+    //! The number of workers sleeping on condWorker, protected by mutexSleep
+    int nIdle;
+
+    //! Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+
+    //! Master thread blocks on this until all work is done
+    boost::condition_variable condMaster;
+
+    //! The maximum number of elements to be processed in one batch
+    unsigned int nBatchSize;
+
+    int ActiveQueues() const
+    {
+        return std::min((int)vQueues.size(), nWorkers + 1);
+    }
+
+    /** Move up to nBatchSize checks from slot nQueue into vChecks. */
+    bool Take(int nQueue, std::vector<T>& vChecks, bool fSteal)
+    {
+        CWorkerQueue& queue = *vQueues[nQueue];
+        if (queue.nSize == 0)
+            return false;
+        boost::unique_lock<boost::mutex> lock(queue.mutex);
+        if (queue.checks.empty())
+            return false;
+        unsigned int nNow = std::max<unsigned int>(1, std::min<unsigned int>(nBatchSize, fSteal ? queue.checks.size() / 2 : queue.checks.size()));
+        vChecks.resize(nNow);
+        for (unsigned int i = 0; i < nNow; i++) {
+            if (fSteal) {
+                vChecks[i].swap(queue.checks.front());
+                queue.checks.pop_front();
+            } else {
+                vChecks[i].swap(queue.checks.back());
+                queue.checks.pop_back();
+            }
+        }
+        queue.nSize = queue.checks.size();
+        __sync_sub_and_fetch(&nQueued, nNow);
+        return true;
+    }
+
+    /** Take work from our own deque, or steal it from another one. */
+    bool Find(int nOwn, std::vector<T>& vChecks)
+    {
+        int nActive = ActiveQueues();
+        if (nOwn < nActive && Take(nOwn, vChecks, false))
+            return true;
+        for (int i = 1; i <= nActive; i++) {
+            int nVictim = (nOwn + i) % nActive;
+            if (nVictim != nOwn && Take(nVictim, vChecks, true))
+                return true;
+        }
+        return false;
+    }
+
+    /** Run a batch, then account for it. Returns whether this finished all pending work. */
+    bool Run(std::vector<T>& vChecks)
+    {
+        bool fOk = fAllOk;
+        BOOST_FOREACH (T& check, vChecks)
+            if (fOk)
+                fOk = check();
+        if (!fOk)
+            __sync_fetch_and_and(&fAllOk, 0);
+        int nDone = vChecks.size();
+        vChecks.clear();
+        return __sync_sub_and_fetch(&nPending, nDone) == 0;
+    }
+
+public:
+    //! Create a new check queue with room for nMaxWorkers worker deques
+    CWorkStealingCheckQueue(unsigned int nBatchSizeIn, int nMaxWorkers = 64) : nWorkers(0), nQueued(0), nPending(0), fAllOk(1), nIdle(0), nBatchSize(nBatchSizeIn)
+    {
+        vQueues.reserve(nMaxWorkers + 1);
+        for (int i = 0; i <= nMaxWorkers; i++)
+            vQueues.push_back(new CWorkerQueue());
+    }
+
+    //! Worker thread
+    void Thread()
+    {
+        int nOwn = __sync_add_and_fetch(&nWorkers, 1);
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        while (true) {
+            if (Find(nOwn, vChecks)) {
+                if (Run(vChecks)) {
+                    // We processed the last element; inform the master he can exit and return the result
+                    boost::unique_lock<boost::mutex> lock(mutexSleep);
+                    condMaster.notify_one();
+                }
+                continue;
+            }
+            boost::unique_lock<boost::mutex> lock(mutexSleep);
+            if (nQueued == 0) {
+                nIdle++;
+                do {
+                    condWorker.wait(lock);
+                } while (nQueued == 0);
+                nIdle--;
+            } else {
+                // Work is being added or taken right now; let that finish
+                lock.unlock();
+                boost::this_thread::yield();
+            }
+        }
+    }
+
+    //! Wait until execution finishes, and return whether all evaluations where successful.
+    bool Wait()
+    {
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        while (true) {
+            if (Find(0, vChecks)) {
+                Run(vChecks);
+                continue;
+            }
+            boost::unique_lock<boost::mutex> lock(mutexSleep);
+            if (nPending == 0)
+                break;
+            if (nQueued == 0) {
+                do {
+                    condMaster.wait(lock);
+                } while (nPending != 0 && nQueued == 0);
+            } else {
+                lock.unlock();
+                boost::this_thread::yield();
+            }
+        }
+        bool fRet = fAllOk;
+        // reset the status for new work later
+        fAllOk = 1;
+        return fRet;
+    }
+
+    //! Add a batch of checks to the queue
+    void Add(std::vector<T>& vChecks)
+    {
+        if (vChecks.empty())
+            return;
+        __sync_add_and_fetch(&nPending, vChecks.size());
+        __sync_add_and_fetch(&nQueued, vChecks.size());
+        int nActive = ActiveQueues();
+        unsigned int nPerQueue = (vChecks.size() + nActive - 1) / nActive;
+        unsigned int nCheck = 0;
+        for (int i = 0; i < nActive && nCheck < vChecks.size(); i++) {
+            CWorkerQueue& queue = *vQueues[i];
+            boost::unique_lock<boost::mutex> lock(queue.mutex);
+            for (unsigned int j = 0; j < nPerQueue && nCheck < vChecks.size(); j++, nCheck++) {
+                queue.checks.push_back(T());
+                vChecks[nCheck].swap(queue.checks.back());
+            }
+            queue.nSize = queue.checks.size();
+        }
+        // Wake no more sleeping workers than there are new checks
+        boost::unique_lock<boost::mutex> lock(mutexSleep);
+        if (vChecks.size() >= (unsigned int)nIdle)
+            condWorker.notify_all();
+        else
+            for (unsigned int i = 0; i < vChecks.size(); i++)
+                condWorker.notify_one();
+    }
+
+    ~CWorkStealingCheckQueue()
+    {
+        BOOST_FOREACH (CWorkerQueue* pqueue, vQueues)
+            delete pqueue;
+    }
+
+    bool IsIdle()
+    {
+        return (nPending == 0 && nQueued == 0 && fAllOk);
+    }
+};
+
 /** 
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
-template <typename T>
+template <typename T, typename Q = CCheckQueue<T> >
 class CCheckQueueControl
 {
 private:
-    CCheckQueue<T>* pqueue;
+    Q* pqueue;
     bool fDone;
 
 public:
-    CCheckQueueControl(CCheckQueue<T>* pqueueIn) : pqueue(pqueueIn), fDone(false)
+    CCheckQueueControl(Q* pqueueIn) : pqueue(pqueueIn), fDone(false)
     {
         // passed queue is supposed to be unused, or NULL
         if (pqueue != NULL) {
@@ -4,10 +4,13 @@
 
 #include "coins.h"
 
+#include "hash.h"
 #include "random.h"
 
 #include <assert.h>
 
+#include <new>
+
 /**
  * calculate number of bytes for the bitmask, and its number of non-zero bytes
  * each bit in the bitmask represents the availability of one output, but the
@@ -58,6 +61,60 @@ bool CCoinsView::GetCoins(const uint256 &txid, CCoins &coins) const { return fal
 bool CCoinsView::HaveCoins(const uint256 &txid) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(0); }
 bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+namespace {
+
+uint256 UtxoStatsElement(const COutPoint &outpoint, const CTxOut &out, int nHeight, bool fCoinBase)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << outpoint << (uint32_t)(nHeight * 2 + (fCoinBase ? 1 : 0)) << out;
+    return ss.GetHash();
+}
+
+}
+
+void CUtxoStats::AddOutput(const COutPoint &outpoint, const CTxOut &out, int nHeight, bool fCoinBase)
+{
+    muhash.Insert(UtxoStatsElement(outpoint, out, nHeight, fCoinBase));
+    nTransactionOutputs++;
+    nTotalAmount += out.nValue;
+}
+
+void CUtxoStats::RemoveOutput(const COutPoint &outpoint, const CTxOut &out, int nHeight, bool fCoinBase)
+{
+    muhash.Remove(UtxoStatsElement(outpoint, out, nHeight, fCoinBase));
+    nTransactionOutputs--;
+    nTotalAmount -= out.nValue;
+}
+
+void CUtxoStats::AddCoins(const uint256 &txid, const CCoins &coins)
+{
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        if (!coins.vout[i].IsNull())
+            AddOutput(COutPoint(txid, i), coins.vout[i], coins.nHeight, coins.fCoinBase);
+    }
+    if (!coins.IsPruned())
+        nTransactions++;
+}
+
+void CUtxoStats::RemoveCoins(const uint256 &txid, const CCoins &coins)
+{
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        if (!coins.vout[i].IsNull())
+            RemoveOutput(COutPoint(txid, i), coins.vout[i], coins.nHeight, coins.fCoinBase);
+    }
+    if (!coins.IsPruned())
+        nTransactions--;
+}
+
+void CUtxoStats::swap(CUtxoStats &stats)
+{
+    std::swap(hashBlock, stats.hashBlock);
+    std::swap(nTransactions, stats.nTransactions);
+    std::swap(nTransactionOutputs, stats.nTransactionOutputs);
+    std::swap(nTotalAmount, stats.nTotalAmount);
+    muhash.swap(stats.muhash);
+}
+
 bool CCoinsView::GetStats(CCoinsStats &stats) const { return false; }
 
 
@@ -71,7 +128,192 @@ bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStat
 
 CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), hashBlock(0) { }
+const size_t CCoinsMap::SLOT_EMPTY;
+const size_t CCoinsMap::SLOT_ERASED;
+const size_t CCoinsMap::MIN_SLOTS;
+const size_t CCoinsMap::MIN_CHUNK_ENTRIES;
+const size_t CCoinsMap::MAX_CHUNK_ENTRIES;
+
+CCoinsMap::CCoinsMap() : nSize(0), nErased(0), nChunkEntries(0), nChunkUsed(0), nPoolUsage(0), pFree(NULL) {}
+
+CCoinsMap::~CCoinsMap()
+{
+    clear();
+}
+
+size_t CCoinsMap::Find(const uint256& key, size_t nHash) const
+{
+    if (vSlots.empty())
+        return 0;
+    const size_t nMask = vSlots.size() - 1;
+    for (size_t i = nHash & nMask; ; i = (i + 1) & nMask) {
+        const Slot& slot = vSlots[i];
+        if (slot.pEntry) {
+            if (slot.nHash == nHash && slot.pEntry->first == key)
+                return i;
+        } else if (slot.nHash == SLOT_EMPTY) {
+            return vSlots.size();
+        }
+    }
+}
+
+size_t CCoinsMap::SlotOf(size_t nSlot, const value_type* pEntry) const
+{
+    // The slot an iterator remembers is stale if the table was rebuilt since.
+    if (nSlot < vSlots.size() && vSlots[nSlot].pEntry == pEntry)
+        return nSlot;
+    return Find(pEntry->first, hasher(pEntry->first));
+}
+
+CCoinsMap::iterator CCoinsMap::Next(size_t nSlot) const
+{
+    while (nSlot < vSlots.size() && !vSlots[nSlot].pEntry)
+        nSlot++;
+    return iterator(this, nSlot, nSlot < vSlots.size() ? vSlots[nSlot].pEntry : NULL);
+}
+
+void CCoinsMap::Rehash(size_t nCapacity)
+{
+    std::vector<Slot> vNew(nCapacity);
+    const size_t nMask = nCapacity - 1;
+    for (size_t n = 0; n < vSlots.size(); n++) {
+        if (!vSlots[n].pEntry)
+            continue;
+        size_t i = vSlots[n].nHash & nMask;
+        while (vNew[i].pEntry)
+            i = (i + 1) & nMask;
+        vNew[i] = vSlots[n];
+    }
+    vSlots.swap(vNew);
+    nErased = 0;
+}
+
+CCoinsMap::value_type* CCoinsMap::AllocEntry()
+{
+    if (pFree) {
+        void* p = pFree;
+        pFree = *static_cast<void**>(p);
+        return static_cast<value_type*>(p);
+    }
+    if (nChunkUsed == nChunkEntries) {
+        // Grow chunks geometrically, so that short-lived caches stay small.
+        nChunkEntries = nChunkEntries ? nChunkEntries * 2 : MIN_CHUNK_ENTRIES;
+        if (nChunkEntries > MAX_CHUNK_ENTRIES)
+            nChunkEntries = MAX_CHUNK_ENTRIES;
+        vChunks.push_back(static_cast<char*>(::operator new(nChunkEntries * sizeof(value_type))));
+        nPoolUsage += memusage::MallocUsage(nChunkEntries * sizeof(value_type));
+        nChunkUsed = 0;
+    }
+    return reinterpret_cast<value_type*>(vChunks.back() + sizeof(value_type) * nChunkUsed++);
+}
+
+void CCoinsMap::FreeEntry(value_type* pEntry)
+{
+    pEntry->~value_type();
+    *reinterpret_cast<void**>(pEntry) = pFree;
+    pFree = pEntry;
+}
+
+CCoinsMap::iterator CCoinsMap::find(const uint256& key)
+{
+    size_t n = Find(key, hasher(key));
+    return iterator(this, n, n < vSlots.size() ? vSlots[n].pEntry : NULL);
+}
+
+CCoinsMap::const_iterator CCoinsMap::find(const uint256& key) const
+{
+    size_t n = Find(key, hasher(key));
+    return const_iterator(this, n, n < vSlots.size() ? vSlots[n].pEntry : NULL);
+}
+
+std::pair<CCoinsMap::iterator, bool> CCoinsMap::insert(const value_type& value)
+{
+    const size_t nHash = hasher(value.first);
+    size_t n = Find(value.first, nHash);
+    if (n < vSlots.size())
+        return std::make_pair(iterator(this, n, vSlots[n].pEntry), false);
+
+    // Keep at least a quarter of the slots empty, so probe sequences stay short.
+    if ((nSize + nErased + 1) * 4 > vSlots.size() * 3) {
+        size_t nCapacity = MIN_SLOTS;
+        while ((nSize + 1) * 8 > nCapacity * 3)
+            nCapacity *= 2;
+        Rehash(nCapacity);
+    }
+
+    const size_t nMask = vSlots.size() - 1;
+    n = nHash & nMask;
+    while (vSlots[n].pEntry)
+        n = (n + 1) & nMask;
+    if (vSlots[n].nHash == SLOT_ERASED)
+        nErased--;
+    value_type* pEntry = AllocEntry();
+    new (pEntry) value_type(value);
+    vSlots[n].nHash = nHash;
+    vSlots[n].pEntry = pEntry;
+    nSize++;
+    return std::make_pair(iterator(this, n, pEntry), true);
+}
+
+void CCoinsMap::erase(iterator it)
+{
+    size_t n = SlotOf(it.nSlot, it.pEntry);
+    assert(n < vSlots.size());
+    FreeEntry(vSlots[n].pEntry);
+    vSlots[n].pEntry = NULL;
+    vSlots[n].nHash = SLOT_ERASED;
+    nSize--;
+    nErased++;
+
+    // No probe sequence can run through an erased slot that is followed by
+    // an empty one, so such slots can be reclaimed immediately.
+    const size_t nMask = vSlots.size() - 1;
+    if (vSlots[(n + 1) & nMask].pEntry || vSlots[(n + 1) & nMask].nHash != SLOT_EMPTY)
+        return;
+    while (!vSlots[n].pEntry && vSlots[n].nHash == SLOT_ERASED) {
+        vSlots[n].nHash = SLOT_EMPTY;
+        nErased--;
+        n = (n - 1) & nMask;
+    }
+}
+
+void CCoinsMap::clear()
+{
+    for (size_t n = 0; n < vSlots.size(); n++) {
+        if (vSlots[n].pEntry)
+            vSlots[n].pEntry->~value_type();
+    }
+    std::vector<Slot>().swap(vSlots);
+    for (size_t n = 0; n < vChunks.size(); n++)
+        ::operator delete(vChunks[n]);
+    std::vector<char*>().swap(vChunks);
+    nSize = 0;
+    nErased = 0;
+    nChunkEntries = 0;
+    nChunkUsed = 0;
+    nPoolUsage = 0;
+    pFree = NULL;
+}
+
+void CCoinsMap::swap(CCoinsMap& map)
+{
+    std::swap(hasher, map.hasher);
+    vSlots.swap(map.vSlots);
+    std::swap(nSize, map.nSize);
+    std::swap(nErased, map.nErased);
+    vChunks.swap(map.vChunks);
+    std::swap(nChunkEntries, map.nChunkEntries);
+    std::swap(nChunkUsed, map.nChunkUsed);
+    std::swap(nPoolUsage, map.nPoolUsage);
+    std::swap(pFree, map.pFree);
+}
+
+size_t CCoinsMap::DynamicMemoryUsage() const
+{
+    return memusage::MallocUsage(vSlots.size() * sizeof(Slot)) + memusage::DynamicUsage(vChunks) + nPoolUsage;
+}
+
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), hashBlock(0), cachedCoinsUsage(0) { }
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -92,6 +334,7 @@ CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const
         // version as fresh.
         ret->second.flags = CCoinsCacheEntry::FRESH;
     }
+    cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
     return ret;
 }
 
@@ -107,6 +350,7 @@ bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) const {
 CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
     assert(!hasModifier);
     std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+    size_t cachedCoinUsage = 0;
     if (ret.second) {
         if (!base->GetCoins(txid, ret.first->second.coins)) {
             // The parent view does not have this entry; mark it as fresh.
@@ -116,10 +360,12 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
             // The parent view only has a pruned entry for this; mark it as fresh.
             ret.first->second.flags = CCoinsCacheEntry::FRESH;
         }
+    } else {
+        cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
     }
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first);
+    return CCoinsModifier(*this, ret.first, cachedCoinUsage);
 }
 
 const CCoins* CCoinsViewCache::AccessCoins(const uint256 &txid) const {
@@ -164,6 +410,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     assert(it->second.flags & CCoinsCacheEntry::FRESH);
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
                     entry.coins.swap(it->second.coins);
+                    cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
                     entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
                 }
             } else {
@@ -171,10 +418,13 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     // The grandparent does not have an entry, and the child is
                     // modified and being pruned. This means we can just delete
                     // it from the parent.
+                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
+                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.coins.swap(it->second.coins);
+                    cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
                 }
             }
@@ -189,13 +439,22 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
 bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
+    cachedCoinsUsage = 0;
     return fOk;
 }
 
+bool CCoinsViewCache::HaveCoinsInCache(const uint256 &txid) const {
+    return cacheCoins.find(txid) != cacheCoins.end();
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
 
+size_t CCoinsViewCache::DynamicMemoryUsage() const {
+    return cacheCoins.DynamicMemoryUsage() + cachedCoinsUsage;
+}
+
 const CTxOut &CCoinsViewCache::GetOutputFor(const CTxIn& input) const
 {
     const CCoins* coins = AccessCoins(input.prevout.hash);
@@ -246,7 +505,7 @@ double CCoinsViewCache::GetPriority(const CTransaction &tx, int nHeight) const
     return tx.ComputePriority(dResult);
 }
 
-CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_) : cache(cache_), it(it_) {
+CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), it(it_), cachedCoinUsage(usage) {
     assert(!cache.hasModifier);
     cache.hasModifier = true;
 }
@@ -256,7 +515,11 @@ CCoinsModifier::~CCoinsModifier()
     assert(cache.hasModifier);
     cache.hasModifier = false;
     it->second.coins.Cleanup();
+    cache.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
     if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
         cache.cacheCoins.erase(it);
+    } else {
+        // If the coin still exists after the modification, add the new usage
+        cache.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
     }
 }
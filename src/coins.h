@@ -7,6 +7,8 @@
 #define BITCOIN_COINS_H
 
 #include "compressor.h"
+#include "memusage.h"
+#include "muhash.h"
 #include "serialize.h"
 #include "uint256.h"
 #include "undo.h"
@@ -14,8 +16,10 @@
 #include <assert.h>
 #include <stdint.h>
 
+#include <utility>
+#include <vector>
+
 #include <boost/foreach.hpp>
-#include <boost/unordered_map.hpp>
 
 /** 
  * Pruned version of CTransaction: only retains metadata and unspent transaction outputs
@@ -256,6 +260,14 @@ public:
                 return false;
         return true;
     }
+
+    //! heap memory owned by this object (outputs and their scripts)
+    size_t DynamicMemoryUsage() const {
+        size_t ret = memusage::DynamicUsage(vout);
+        BOOST_FOREACH(const CTxOut &out, vout)
+            ret += memusage::DynamicUsage(out.scriptPubKey);
+        return ret;
+    }
 };
 
 class CCoinsKeyHasher
@@ -289,7 +301,113 @@ struct CCoinsCacheEntry
     CCoinsCacheEntry() : coins(), flags(0) {}
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+/**
+ * Hash table from txid to cache entry, with the subset of the
+ * std::unordered_map interface that the coin views use.
+ *
+ * Lookups probe linearly through a flat array of slots, each holding the
+ * full hash and a pointer to its entry, so a miss rarely touches more than
+ * one cache line. Entries live in a pool of chunks that only grows until
+ * clear(): they are never moved, so references and iterators to an entry
+ * stay valid until that entry is erased, as with a node-based map. Erasing
+ * leaves a tombstone behind (so iteration may continue past it), which is
+ * dropped again when the table is rebuilt.
+ */
+class CCoinsMap
+{
+public:
+    typedef uint256 key_type;
+    typedef CCoinsCacheEntry mapped_type;
+    typedef std::pair<const uint256, CCoinsCacheEntry> value_type;
+
+    template <typename T>
+    class basic_iterator
+    {
+    private:
+        const CCoinsMap* pmap;
+        size_t nSlot;
+        value_type* pEntry;
+
+        basic_iterator(const CCoinsMap* pmapIn, size_t nSlotIn, value_type* pEntryIn) : pmap(pmapIn), nSlot(nSlotIn), pEntry(pEntryIn) {}
+
+        template <typename U> friend class basic_iterator;
+        friend class CCoinsMap;
+
+    public:
+        basic_iterator() : pmap(NULL), nSlot(0), pEntry(NULL) {}
+        //! copy or assign, or convert a mutable iterator into a const one
+        basic_iterator(const basic_iterator<value_type>& it) : pmap(it.pmap), nSlot(it.nSlot), pEntry(it.pEntry) {}
+        basic_iterator& operator=(const basic_iterator<value_type>& it) { pmap = it.pmap; nSlot = it.nSlot; pEntry = it.pEntry; return *this; }
+
+        T& operator*() const { return *pEntry; }
+        T* operator->() const { return pEntry; }
+        basic_iterator& operator++() { *this = pmap->Next(pmap->SlotOf(nSlot, pEntry) + 1); return *this; }
+        basic_iterator operator++(int) { basic_iterator ret = *this; ++*this; return ret; }
+        bool operator==(const basic_iterator& it) const { return pEntry == it.pEntry; }
+        bool operator!=(const basic_iterator& it) const { return pEntry != it.pEntry; }
+    };
+
+    typedef basic_iterator<value_type> iterator;
+    typedef basic_iterator<const value_type> const_iterator;
+
+private:
+    //! pEntry == NULL marks a free slot; nHash then tells empty and erased apart
+    struct Slot {
+        size_t nHash;
+        value_type* pEntry;
+    };
+    static const size_t SLOT_EMPTY = 0;
+    static const size_t SLOT_ERASED = 1;
+
+    static const size_t MIN_SLOTS = 32;
+    static const size_t MIN_CHUNK_ENTRIES = 16;
+    static const size_t MAX_CHUNK_ENTRIES = 4096;
+
+    CCoinsKeyHasher hasher;
+    std::vector<Slot> vSlots;
+    size_t nSize;
+    size_t nErased;
+
+    //! entry pool: chunks of raw storage, plus a free list threaded through erased entries
+    std::vector<char*> vChunks;
+    size_t nChunkEntries;
+    size_t nChunkUsed;
+    size_t nPoolUsage;
+    void* pFree;
+
+    size_t Find(const uint256& key, size_t nHash) const;
+    size_t SlotOf(size_t nSlot, const value_type* pEntry) const;
+    iterator Next(size_t nSlot) const;
+    void Rehash(size_t nCapacity);
+    value_type* AllocEntry();
+    void FreeEntry(value_type* pEntry);
+
+    CCoinsMap(const CCoinsMap&);
+    CCoinsMap& operator=(const CCoinsMap&);
+
+public:
+    CCoinsMap();
+    ~CCoinsMap();
+
+    iterator begin() { return Next(0); }
+    const_iterator begin() const { return Next(0); }
+    iterator end() { return iterator(this, vSlots.size(), NULL); }
+    const_iterator end() const { return const_iterator(this, vSlots.size(), NULL); }
+
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator find(const uint256& key);
+    const_iterator find(const uint256& key) const;
+    std::pair<iterator, bool> insert(const value_type& value);
+    CCoinsCacheEntry& operator[](const uint256& key) { return insert(value_type(key, CCoinsCacheEntry())).first->second; }
+    void erase(iterator it);
+    void clear();
+    void swap(CCoinsMap& map);
+
+    //! heap memory used by the table and the entry pool, not counting what the entries own
+    size_t DynamicMemoryUsage() const;
+};
 
 struct CCoinsStats
 {
@@ -304,6 +422,42 @@ struct CCoinsStats
     CCoinsStats() : nHeight(0), hashBlock(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), hashSerialized(0), nTotalAmount(0) {}
 };
 
+/**
+ * Statistics about the UTXO set at some block that are kept up to date as
+ * coins are added and spent, rather than computed by scanning the set:
+ * running totals, and a multiset hash of all unspent outputs (each one
+ * hashed together with its outpoint, height and coinbase flag).
+ */
+struct CUtxoStats
+{
+    uint256 hashBlock;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    CAmount nTotalAmount;
+    CMuHash3072 muhash;
+
+    CUtxoStats() : hashBlock(0), nTransactions(0), nTransactionOutputs(0), nTotalAmount(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hashBlock);
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nTotalAmount);
+        READWRITE(muhash);
+    }
+
+    void AddOutput(const COutPoint &outpoint, const CTxOut &out, int nHeight, bool fCoinBase);
+    void RemoveOutput(const COutPoint &outpoint, const CTxOut &out, int nHeight, bool fCoinBase);
+    //! Add or remove all unspent outputs of a transaction, and the transaction itself if it has any
+    void AddCoins(const uint256 &txid, const CCoins &coins);
+    void RemoveCoins(const uint256 &txid, const CCoins &coins);
+
+    void swap(CUtxoStats &stats);
+};
+
 
 /** Abstract view on the open txout dataset. */
 class CCoinsView
@@ -360,7 +514,8 @@ class CCoinsModifier
 private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
+    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
     CCoins* operator->() { return &it->second.coins; }
@@ -383,6 +538,9 @@ protected:
     mutable uint256 hashBlock;
     mutable CCoinsMap cacheCoins;
 
+    /* Cached dynamic memory usage for the inner CCoins objects. */
+    mutable size_t cachedCoinsUsage;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -415,9 +573,15 @@ public:
      */
     bool Flush();
 
+    //! Check whether a txid is in this cache already, without touching the backing view
+    bool HaveCoinsInCache(const uint256 &txid) const;
+
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the size of the cache (in bytes)
+    size_t DynamicMemoryUsage() const;
+
     /** 
      * Amount of bitcoins coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
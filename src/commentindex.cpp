@@ -0,0 +1,51 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "commentindex.h"
+
+#include "clientversion.h"
+#include "main.h"
+#include "streams.h"
+#include "util.h"
+
+CCommentIndex *pcommentindex = NULL;
+
+bool GetBlockComments(const char* pbegin, const char* pend, int nHeight, std::vector<CTxComment> &vComment)
+{
+    CBlock block;
+    try {
+        CMemoryReader(pbegin, pend, SER_DISK, CLIENT_VERSION) >> block;
+    } catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction &tx = block.vtx[i];
+        if (!tx.strTxComment.empty())
+            vComment.push_back(CTxComment(tx.GetHash(), nHeight, i, tx.strTxComment));
+    }
+    return true;
+}
+
+CCommentIndex::CCommentIndex(size_t nCacheSize, bool fMemory, bool fWipe) : CChainIndex("commentindex"), db(nCacheSize, fMemory, fWipe)
+{
+}
+
+bool CCommentIndex::AppendBlock(const CBlockIndex *pindex, const CDiskBlockPos &pos, const char* pbegin, const char* pend)
+{
+    return GetBlockComments(pbegin, pend, pindex->nHeight, vWrite);
+}
+
+bool CCommentIndex::RemoveBlock(const CBlockIndex *pindex, const char* pbegin, const char* pend)
+{
+    return GetBlockComments(pbegin, pend, pindex->nHeight, vErase);
+}
+
+bool CCommentIndex::WriteBatch(const CBlockLocator &locator)
+{
+    if (!db.WriteComments(vErase, vWrite, locator))
+        return false;
+    vErase.clear();
+    vWrite.clear();
+    return true;
+}
@@ -0,0 +1,58 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COMMENTINDEX_H
+#define BITCOIN_COMMENTINDEX_H
+
+#include "chainindex.h"
+#include "txdb.h"
+
+#include <string>
+#include <vector>
+
+/** Default number of comments returned by a search */
+static const unsigned int DEFAULT_COMMENT_RESULTS = 100;
+/** Maximum number of comments returned by a search */
+static const unsigned int MAX_COMMENT_RESULTS = 10000;
+
+/**
+ * The comment index (-commentindex): the transaction comments (strTxComment)
+ * of the active chain, searchable by txid, height range, prefix and keyword.
+ */
+class CCommentIndex : public CChainIndex
+{
+private:
+    CCommentIndexDB db;
+    std::vector<CTxComment> vErase;
+    std::vector<CTxComment> vWrite;
+
+protected:
+    bool AppendBlock(const CBlockIndex *pindex, const CDiskBlockPos &pos, const char* pbegin, const char* pend);
+    bool RemoveBlock(const CBlockIndex *pindex, const char* pbegin, const char* pend);
+    size_t GetBatchSize() const { return vErase.size() + vWrite.size(); }
+    bool WriteBatch(const CBlockLocator &locator);
+    bool ReadBestBlock(CBlockLocator &locator) const { return db.ReadBestBlock(locator); }
+
+public:
+    CCommentIndex(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    bool FindComment(const uint256 &txid, CTxComment &comment) const { return db.ReadComment(txid, comment); }
+    bool FindByHeight(int nStartHeight, int nEndHeight, unsigned int nMaxResults, std::vector<CTxComment> &vComment) const {
+        return db.FindByHeight(nStartHeight, nEndHeight, nMaxResults, vComment);
+    }
+    bool FindByPrefix(const std::string &strPrefix, int nStartHeight, unsigned int nMaxResults, std::vector<CTxComment> &vComment) const {
+        return db.FindByPrefix(strPrefix, nStartHeight, nMaxResults, vComment);
+    }
+    bool FindByKeyword(const std::string &strKeyword, int nStartHeight, unsigned int nMaxResults, std::vector<CTxComment> &vComment) const {
+        return db.FindByKeyword(strKeyword, nStartHeight, nMaxResults, vComment);
+    }
+};
+
+/** Append the comments of the transactions of the block serialized in [pbegin, pend) at height nHeight to vComment */
+bool GetBlockComments(const char* pbegin, const char* pend, int nHeight, std::vector<CTxComment> &vComment);
+
+/** The comment index, or NULL without -commentindex */
+extern CCommentIndex *pcommentindex;
+
+#endif // BITCOIN_COMMENTINDEX_H
@@ -34,6 +34,11 @@
 #include <string.h>
 #include <openssl/sha.h>
 
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+// libbitcoinconsensus is not linked against crypto/libbitcoin_crypto_avx2.a
+#define USE_AVX2_KERNEL 1
+#endif
+
 #if defined(USE_SSE2) && !defined(USE_SSE2_ALWAYS)
 #ifdef _MSC_VER
 // MSVC 64bit is unable to use inline asm
@@ -42,6 +47,8 @@
 // GCC Linux or i686-w64-mingw32
 #include <cpuid.h>
 #endif
+#elif defined(USE_AVX2_KERNEL)
+#include <cpuid.h>
 #endif
 
 static inline uint32_t be32dec(const void *pp)
@@ -185,6 +192,39 @@ PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
 	memset(&PShctx, 0, sizeof(HMAC_SHA256_CTX));
 }
 
+/**
+ * PBKDF2_SHA256 with c = 1, starting from an HMAC-SHA256 context that has
+ * already been keyed with the password.
+ */
+static void
+PBKDF2_SHA256_keyed(const HMAC_SHA256_CTX *Pctx, const uint8_t *salt,
+    size_t saltlen, uint8_t *buf, size_t dkLen)
+{
+	HMAC_SHA256_CTX PShctx, hctx;
+	size_t i;
+	uint8_t ivec[4];
+	uint8_t U[32];
+	size_t clen;
+
+	memcpy(&PShctx, Pctx, sizeof(HMAC_SHA256_CTX));
+	HMAC_SHA256_Update(&PShctx, salt, saltlen);
+
+	for (i = 0; i * 32 < dkLen; i++) {
+		be32enc(ivec, (uint32_t)(i + 1));
+
+		memcpy(&hctx, &PShctx, sizeof(HMAC_SHA256_CTX));
+		HMAC_SHA256_Update(&hctx, ivec, 4);
+		HMAC_SHA256_Final(U, &hctx);
+
+		clen = dkLen - i * 32;
+		if (clen > 32)
+			clen = 32;
+		memcpy(&buf[i * 32], U, clen);
+	}
+
+	memset(&PShctx, 0, sizeof(HMAC_SHA256_CTX));
+}
+
 #define ROTL(a, b) (((a) << (b)) | ((a) >> (32 - (b))))
 
 static inline void xor_salsa8(uint32_t B[16], const uint32_t Bx[16])
@@ -253,17 +293,15 @@ static inline void xor_salsa8(uint32_t B[16], const uint32_t Bx[16])
 	B[15] += x15;
 }
 
-void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad)
+/* The salsa20/8 mixing of scrypt(1024, 1, 1), in place on the 128-byte PBKDF2 output B. */
+static void scrypt_core_generic(uint8_t *B, char *scratchpad)
 {
-	uint8_t B[128];
 	uint32_t X[32];
 	uint32_t *V;
 	uint32_t i, j, k;
 
 	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
 
-	PBKDF2_SHA256((const uint8_t *)input, 80, (const uint8_t *)input, 80, 1, B, 128);
-
 	for (k = 0; k < 32; k++)
 		X[k] = le32dec(&B[4 * k]);
 
@@ -282,7 +320,14 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 
 	for (k = 0; k < 32; k++)
 		le32enc(&B[4 * k], X[k]);
+}
+
+void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad)
+{
+	uint8_t B[128];
 
+	PBKDF2_SHA256((const uint8_t *)input, 80, (const uint8_t *)input, 80, 1, B, 128);
+	scrypt_core_generic(B, scratchpad);
 	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
 }
 
@@ -327,3 +372,102 @@ void scrypt_1024_1_1_256(const char *input, char *output)
 	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
     scrypt_1024_1_1_256_sp(input, output, scratchpad);
 }
+
+void scrypt_1024_1_1_256_sp_multi_generic(const char *input, char *output, char *scratchpad, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		scrypt_1024_1_1_256_sp(input + 80 * i, output + 32 * i, scratchpad);
+}
+
+void (*scrypt_1024_1_1_256_sp_multi)(const char *input, char *output, char *scratchpad, int n) = &scrypt_1024_1_1_256_sp_multi_generic;
+
+static void scrypt_core_multi_generic(uint8_t *B, char *scratchpad, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		scrypt_core_generic(B + 128 * i, scratchpad);
+}
+
+static void (*scrypt_core_multi)(uint8_t *B, char *scratchpad, int n) = &scrypt_core_multi_generic;
+
+bool scrypt_detect_avx2()
+{
+#if defined(USE_AVX2_KERNEL)
+    unsigned int eax, ebx, ecx, edx;
+    bool fAVX2 = false;
+
+    // AVX2 needs CPU support (leaf 7, EBX bit 5) and the OS saving YMM state (XCR0 bits 1 and 2)
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1 << 27)) && (ecx & (1 << 28)) && __get_cpuid_max(0, NULL) >= 7) {
+        uint32_t xcr0_lo, xcr0_hi;
+        __asm__ ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        fAVX2 = (xcr0_lo & 6) == 6 && (ebx & (1 << 5));
+    }
+    scrypt_1024_1_1_256_sp_multi = fAVX2 ? &scrypt_1024_1_1_256_sp_avx2_8way : &scrypt_1024_1_1_256_sp_multi_generic;
+    scrypt_core_multi = fAVX2 ? &scrypt_core_avx2_8way : &scrypt_core_multi_generic;
+    return fAVX2;
+#else
+    return false;
+#endif
+}
+
+void scrypt_1024_1_1_256_multi(const char *input, char *output, size_t n)
+{
+	char *scratchpad;
+	size_t i;
+	int ways;
+
+	if (n == 1) {
+		scrypt_1024_1_1_256(input, output);
+		return;
+	}
+
+	/* The multi-lane scratchpad is too large for the stack of worker threads. */
+	scratchpad = (char *)malloc(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+	if (scratchpad == NULL)
+		abort();
+	for (i = 0; i < n; i += ways) {
+		ways = (n - i < (size_t)SCRYPT_MAX_WAYS) ? (int)(n - i) : SCRYPT_MAX_WAYS;
+		scrypt_1024_1_1_256_sp_multi(input + 80 * i, output + 32 * i, scratchpad, ways);
+	}
+	free(scratchpad);
+}
+
+void scrypt_1024_1_1_256_midstate(const char *input, scrypt_midstate *midstate)
+{
+	SHA256_Init(midstate);
+	SHA256_Update(midstate, input, 64);
+}
+
+void scrypt_1024_1_1_256_sp_nonces(const char *input, const scrypt_midstate *midstate, uint32_t nNonce, int n, char *output, char *scratchpad)
+{
+	HMAC_SHA256_CTX hctx[SCRYPT_MAX_WAYS];
+	SHA256_CTX kctx;
+	uint8_t header[80];
+	uint8_t khash[32];
+	uint8_t B[SCRYPT_MAX_WAYS * 128];
+	int l;
+
+	memcpy(header, input, 80);
+	for (l = 0; l < n; l++) {
+		le32enc(&header[76], nNonce + l);
+
+		/* The 80-byte password is longer than a block, so the HMAC key is its SHA-256. */
+		memcpy(&kctx, midstate, sizeof(SHA256_CTX));
+		SHA256_Update(&kctx, &header[64], 16);
+		SHA256_Final(khash, &kctx);
+		HMAC_SHA256_Init(&hctx[l], khash, 32);
+
+		PBKDF2_SHA256_keyed(&hctx[l], header, 80, &B[128 * l], 128);
+	}
+
+	scrypt_core_multi(B, scratchpad, n);
+
+	for (l = 0; l < n; l++)
+		PBKDF2_SHA256_keyed(&hctx[l], &B[128 * l], 128, (uint8_t *)output + 32 * l, 32);
+
+	memset(hctx, 0, sizeof(hctx));
+}
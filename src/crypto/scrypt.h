@@ -1,13 +1,55 @@
 #ifndef SCRYPT_H
 #define SCRYPT_H
+#if defined(HAVE_CONFIG_H)
+#include "bitcoin-config.h"
+#endif
 #include <stdlib.h>
 #include <stdint.h>
+#include <openssl/sha.h>
 
 static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
 
+/** Number of independent 80-byte inputs hashed by one multi-lane kernel call. */
+static const int SCRYPT_MAX_WAYS = 8;
+static const int SCRYPT_MULTI_SCRATCHPAD_SIZE = SCRYPT_MAX_WAYS * 131072 + 63;
+
 void scrypt_1024_1_1_256(const char *input, char *output);
 void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad);
 
+/**
+ * Multi-lane kernels: hash n (1 <= n <= SCRYPT_MAX_WAYS) consecutive 80-byte
+ * inputs into n consecutive 32-byte outputs, using a scratchpad of
+ * SCRYPT_MULTI_SCRATCHPAD_SIZE bytes.
+ */
+void scrypt_1024_1_1_256_sp_multi_generic(const char *input, char *output, char *scratchpad, int n);
+#if defined(ENABLE_AVX2)
+void scrypt_1024_1_1_256_sp_avx2_8way(const char *input, char *output, char *scratchpad, int n);
+/** The salsa20/8 mixing of n (1 <= n <= 8) 128-byte PBKDF2 outputs, in place. */
+void scrypt_core_avx2_8way(uint8_t *B, char *scratchpad, int n);
+#endif
+extern void (*scrypt_1024_1_1_256_sp_multi)(const char *input, char *output, char *scratchpad, int n);
+
+/** Select the multi-lane kernel for this CPU. Returns true if the AVX2 kernel was chosen. */
+bool scrypt_detect_avx2();
+
+/** Hash n consecutive 80-byte inputs with the selected multi-lane kernel. */
+void scrypt_1024_1_1_256_multi(const char *input, char *output, size_t n);
+
+/**
+ * Miner entry points. Only the nonce (the last 4 bytes) of a block header
+ * changes between attempts, so the SHA-256 state after its first 64 bytes is
+ * computed once per template, and the HMAC-SHA256 key state of each nonce is
+ * shared by both PBKDF2 passes.
+ */
+typedef SHA256_CTX scrypt_midstate;
+void scrypt_1024_1_1_256_midstate(const char *input, scrypt_midstate *midstate);
+/**
+ * Hash the 80-byte header input with nonces nNonce .. nNonce + n - 1
+ * (1 <= n <= SCRYPT_MAX_WAYS) into n consecutive 32-byte outputs, using a
+ * scratchpad of SCRYPT_MULTI_SCRATCHPAD_SIZE bytes.
+ */
+void scrypt_1024_1_1_256_sp_nonces(const char *input, const scrypt_midstate *midstate, uint32_t nNonce, int n, char *output, char *scratchpad);
+
 #if defined(USE_SSE2)
 #if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
 #define USE_SSE2_ALWAYS 1
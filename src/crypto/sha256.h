@@ -5,8 +5,13 @@
 #ifndef BITCOIN_CRYPTO_SHA256_H
 #define BITCOIN_CRYPTO_SHA256_H
 
+#if defined(HAVE_CONFIG_H)
+#include "bitcoin-config.h"
+#endif
+
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -25,4 +30,30 @@ public:
     CSHA256& Reset();
 };
 
+/**
+ * Select the fastest SHA-256 transform and multi-lane double-SHA256 kernels
+ * this CPU supports. Returns a description of the selection.
+ */
+std::string SHA256AutoDetect();
+
+/**
+ * Compute the double-SHA256 of blocks independent 64-byte messages at input
+ * into blocks consecutive 32-byte hashes at output.
+ */
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
+
+/** Multi-lane double-SHA256 kernels for 64-byte messages; only call them after SHA256AutoDetect() picked them. */
+#if defined(ENABLE_SSE41)
+namespace sha256d64_sse41
+{
+void Transform_4way(unsigned char* out, const unsigned char* in);
+}
+#endif
+#if defined(ENABLE_AVX2)
+namespace sha256d64_avx2
+{
+void Transform_8way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
 #endif // BITCOIN_CRYPTO_SHA256_H
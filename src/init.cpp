@@ -9,17 +9,23 @@
 
 #include "init.h"
 
+#include "addressindex.h"
 #include "addrman.h"
 #include "amount.h"
 #include "checkpoints.h"
+#include "commentindex.h"
 #include "compat/sanity.h"
+#include "crypto/scrypt.h"
+#include "crypto/sha256.h"
 #include "key.h"
 #include "main.h"
 #include "miner.h"
 #include "net.h"
 #include "rpcserver.h"
+#include "script/sigcache.h"
 #include "script/standard.h"
 #include "txdb.h"
+#include "txindex.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
@@ -132,7 +138,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 
 void Shutdown()
@@ -169,6 +174,12 @@ void Shutdown()
         fFeeEstimatesInitialized = false;
     }
 
+    CChainIndex* vChainIndex[] = { ptxindex, pcommentindex, paddressindex };
+    for (unsigned int i = 0; i < ARRAYLEN(vChainIndex); i++) {
+        if (vChainIndex[i])
+            uiInterface.NotifyBlockTip.disconnect(boost::bind(&CChainIndex::NotifyBlockTip, vChainIndex[i], _1));
+    }
+
     {
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
@@ -176,12 +187,22 @@ void Shutdown()
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
+        delete pcoinsWriteBehind;
+        pcoinsWriteBehind = NULL;
+        delete pcoinsPrefetch;
+        pcoinsPrefetch = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        delete ptxindex;
+        ptxindex = NULL;
+        delete pcommentindex;
+        pcommentindex = NULL;
+        delete paddressindex;
+        paddressindex = NULL;
     }
 #ifdef ENABLE_WALLET
     if (pwalletMain)
@@ -240,11 +261,15 @@ std::string HelpMessage(HelpMessageMode mode)
     // When adding new options to the categories, please keep and ensure alphabetical ordering.
     string strUsage = _("Options:") + "\n";
     strUsage += "  -?                     " + _("This help message") + "\n";
+    strUsage += "  -addressindex          " + strprintf(_("Maintain an index of the transactions of every address, used by the getaddressbalance, getaddresstxids and getaddressutxos rpc calls and built in the background (default: %u)"), 0) + "\n";
     strUsage += "  -alertnotify=<cmd>     " + _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)") + "\n";
-    strUsage += "  -alerts                " + strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS);
+    strUsage += "  -alerts                " + strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS) + "\n";
+    strUsage += "  -allowunvalidatedsnapshot " + strprintf(_("Allow the loadtxoutset rpc call, which makes the node trust a UTXO set for the blocks before it instead of validating them (default: %u)"), 0) + "\n";
+    strUsage += "  -assumevalid=<hex>     " + strprintf(_("If this block is in the chain, assume that it and its ancestors are valid and skip their script verification (0 to verify all, default: %s)"), "0") + "\n";
     strUsage += "  -blocknotify=<cmd>     " + _("Execute command when the best block changes (%s in cmd is replaced by block hash)") + "\n";
     strUsage += "  -checkblocks=<n>       " + strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 288) + "\n";
     strUsage += "  -checklevel=<n>        " + strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), 3) + "\n";
+    strUsage += "  -commentindex          " + strprintf(_("Maintain an index of transaction comments, used by the gettxcomment, listtxcomments and searchtxcomments rpc calls and built in the background (default: %u)"), 0) + "\n";
     strUsage += "  -conf=<file>           " + strprintf(_("Specify configuration file (default: %s)"), "florincoin.conf") + "\n";
     if (mode == HMM_BITCOIND)
     {
@@ -256,15 +281,20 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -dbcache=<n>           " + strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache) + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000??.dat file") + " " + _("on startup") + "\n";
     strUsage += "  -maxorphantx=<n>       " + strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS) + "\n";
+    strUsage += "  -prefetch=<n>          " + strprintf(_("Set the number of threads reading block inputs ahead of validation (0 to %d, default: %d)"), MAX_PREFETCH_THREADS, DEFAULT_PREFETCH_THREADS) + "\n";
     strUsage += "  -par=<n>               " + strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS) + "\n";
 #ifndef WIN32
     strUsage += "  -pid=<file>            " + strprintf(_("Specify pid file (default: %s)"), "florincoind.pid") + "\n";
 #endif
+    strUsage += "  -prune=<n>             " + strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode disables wallet support and is incompatible with -txindex. "
+            "Warning: Reverting this setting requires re-downloading the entire blockchain. "
+            "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024) + "\n";
     strUsage += "  -reindex               " + _("Rebuild block chain index from current blk000??.dat files") + " " + _("on startup") + "\n";
 #if !defined(WIN32)
     strUsage += "  -sysperms              " + _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)") + "\n";
 #endif
-    strUsage += "  -txindex               " + strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), 0) + "\n";
+    strUsage += "  -txindex               " + strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call and built in the background (default: %u)"), 0) + "\n";
+    strUsage += "  -verifypowindex        " + strprintf(_("Recompute the proof of work of the whole block index in the background after startup (default: %u)"), 0) + "\n";
 
     strUsage += "\n" + _("Connection options:") + "\n";
     strUsage += "  -addnode=<ip>          " + _("Add a node to connect to and attempt to keep the connection open") + "\n";
@@ -350,7 +380,7 @@ std::string HelpMessage(HelpMessageMode mode)
     {
         strUsage += "  -limitfreerelay=<n>    " + strprintf(_("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default:%u)"), 15) + "\n";
         strUsage += "  -relaypriority         " + strprintf(_("Require high priority for relaying free or low-fee transactions (default:%u)"), 1) + "\n";
-        strUsage += "  -maxsigcachesize=<n>   " + strprintf(_("Limit size of signature cache to <n> entries (default: %u)"), 50000) + "\n";
+        strUsage += "  -sigcachesize=<n>      " + strprintf(_("Limit size of signature cache to <n> MiB (default: %u)"), DEFAULT_SIG_CACHE_SIZE) + "\n";
     }
     strUsage += "  -minrelaytxfee=<amt>   " + strprintf(_("Fees (in FLO/Kb) smaller than this are considered zero fee for relaying (default: %s)"), FormatMoney(::minRelayTxFee.GetFeePerK())) + "\n";
     strUsage += "  -printtoconsole        " + _("Send trace/debug info to console instead of debug.log file") + "\n";
@@ -607,6 +637,22 @@ bool AppInit2(boost::thread_group& threadGroup)
             LogPrintf("AppInit2 : parameter interaction: -proxy set -> setting -discover=0\n");
     }
 
+    // if using block pruning, then disable txindex and the wallet
+    if (GetArg("-prune", 0)) {
+        if (GetBoolArg("-txindex", false))
+            return InitError(_("Prune mode is incompatible with -txindex."));
+        if (GetBoolArg("-commentindex", false))
+            return InitError(_("Prune mode is incompatible with -commentindex."));
+        if (GetBoolArg("-addressindex", false))
+            return InitError(_("Prune mode is incompatible with -addressindex."));
+#ifdef ENABLE_WALLET
+        if (SoftSetBoolArg("-disablewallet", true))
+            LogPrintf("%s : parameter interaction: -prune set -> setting -disablewallet=1\n", __func__);
+        else if (!GetBoolArg("-disablewallet", false))
+            return InitError(_("Prune mode is incompatible with the wallet, use -disablewallet."));
+#endif
+    }
+
     if (!GetBoolArg("-listen", true)) {
         // do not map ports or try to retrieve public IP when not listening (pointless)
         if (SoftSetBoolArg("-upnp", false))
@@ -664,11 +710,31 @@ bool AppInit2(boost::thread_group& threadGroup)
     if (GetBoolArg("-benchmark", false))
         InitWarning(_("Warning: Unsupported argument -benchmark ignored, use -debug=bench."));
 
+    // -maxsigcachesize counted entries; the cache is now sized in MiB.
+    if (mapArgs.count("-maxsigcachesize"))
+        InitWarning(_("Warning: Unsupported argument -maxsigcachesize ignored, use -sigcachesize=<n> (in MiB)."));
+
     // Checkmempool and checkblockindex default to true in regtest mode
     mempool.setSanityCheck(GetBoolArg("-checkmempool", Params().DefaultConsistencyChecks()));
     fCheckBlockIndex = GetBoolArg("-checkblockindex", Params().DefaultConsistencyChecks());
     Checkpoints::fEnabled = GetBoolArg("-checkpoints", true);
 
+    hashAssumeValid = uint256(GetArg("-assumevalid", "0"));
+    if (hashAssumeValid != 0)
+        LogPrintf("Assuming ancestors of block %s have valid scripts.\n", hashAssumeValid.GetHex());
+
+    // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
+    int64_t nSignedPruneTarget = GetArg("-prune", 0) * 1024 * 1024;
+    if (nSignedPruneTarget < 0)
+        return InitError(_("Prune cannot be configured with a negative value."));
+    nPruneTarget = (uint64_t) nSignedPruneTarget;
+    if (nPruneTarget) {
+        if (nPruneTarget < MIN_DISK_SPACE_FOR_BLOCK_FILES)
+            return InitError(strprintf(_("Prune configured below the minimum of %d MiB.  Please use a higher number."), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
+        LogPrintf("Prune configured to target %uMiB on disk for block and undo files.\n", nPruneTarget / 1024 / 1024);
+        fPruneMode = true;
+    }
+
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
     nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
     if (nScriptCheckThreads <= 0)
@@ -760,6 +826,9 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
 
+    // Select the SHA-256 kernels before anything is hashed
+    std::string strSHA256Impl = SHA256AutoDetect();
+
     // Sanity check
     if (!InitSanityCheck())
         return InitError(_("Initialization sanity check failed. Florincoin Core is shutting down."));
@@ -796,10 +865,13 @@ bool AppInit2(boost::thread_group& threadGroup)
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    LogPrintf("Using %u threads for block script, mempool script and header PoW verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadMempoolScriptCheck);
+            threadGroup.create_thread(&ThreadPoWHashCheck);
+        }
     }
 
     /* Start the RPC server already.  It will be started in "warmup" mode
@@ -818,6 +890,8 @@ bool AppInit2(boost::thread_group& threadGroup)
 #if defined(USE_SSE2)
     scrypt_detect_sse2();
 #endif
+    LogPrintf("scrypt: using %s multi-lane kernel\n", scrypt_detect_avx2() ? "8-way AVX2" : "generic");
+    LogPrintf("Using SHA256 implementation: %s\n", strSHA256Impl);
 
     // ********************************************************* Step 5: verify wallet database integrity
 #ifdef ENABLE_WALLET
@@ -1005,13 +1079,20 @@ bool AppInit2(boost::thread_group& threadGroup)
         nTotalCache = (nMinDbCache << 20); // total cache cannot be less than nMinDbCache
     else if (nTotalCache > (nMaxDbCache << 20))
         nTotalCache = (nMaxDbCache << 20); // total cache cannot be greater than nMaxDbCache
-    size_t nBlockTreeDBCache = nTotalCache / 8;
-    if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", false))
-        nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB
+    size_t nBlockTreeDBCache = std::min(nTotalCache / 8, (size_t)(1 << 21)); // block tree db cache shouldn't be larger than 2 MiB
     nTotalCache -= nBlockTreeDBCache;
+    size_t nTxIndexCache = GetBoolArg("-txindex", false) ? nTotalCache / 8 : 0;
+    nTotalCache -= nTxIndexCache;
+    size_t nCommentIndexCache = GetBoolArg("-commentindex", false) ? nTotalCache / 8 : 0;
+    nTotalCache -= nCommentIndexCache;
+    size_t nAddressIndexCache = GetBoolArg("-addressindex", false) ? nTotalCache / 8 : 0;
+    nTotalCache -= nAddressIndexCache;
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    int nPrefetchThreads = std::max(0, std::min((int)GetArg("-prefetch", DEFAULT_PREFETCH_THREADS), MAX_PREFETCH_THREADS));
+    size_t nCoinPrefetchCache = nPrefetchThreads ? nTotalCache / 8 : 0; // prefetched coins waiting to be connected
+    nTotalCache -= nCoinPrefetchCache;
+    nCoinCacheUsage = nTotalCache;
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1025,6 +1106,8 @@ bool AppInit2(boost::thread_group& threadGroup)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
+                delete pcoinsWriteBehind;
+                delete pcoinsPrefetch;
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
@@ -1032,7 +1115,9 @@ bool AppInit2(boost::thread_group& threadGroup)
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
-                pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                pcoinsPrefetch = nPrefetchThreads ? new CCoinsViewPrefetch(pcoinscatcher, nCoinPrefetchCache) : NULL;
+                pcoinsWriteBehind = new CCoinsViewWriteBehind(pcoinsPrefetch ? (CCoinsView*)pcoinsPrefetch : pcoinscatcher);
+                pcoinsTip = new CCoinsViewCache(pcoinsWriteBehind);
 
                 if (fReindex)
                     pblocktree->WriteReindexing(true);
@@ -1053,9 +1138,9 @@ bool AppInit2(boost::thread_group& threadGroup)
                     break;
                 }
 
-                // Check for changed -txindex state
-                if (fTxIndex != GetBoolArg("-txindex", false)) {
-                    strLoadError = _("You need to rebuild the database using -reindex to change -txindex");
+                // Check for changed -prune state: the pruned blocks are gone.
+                if (fHavePruned && !fPruneMode) {
+                    strLoadError = _("You need to rebuild the database using -reindex to go back to unpruned mode.  This will redownload the entire blockchain");
                     break;
                 }
 
@@ -1103,6 +1188,23 @@ bool AppInit2(boost::thread_group& threadGroup)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    // The optional indexes catch up with the chain in the background (see Step 9).
+    if (GetBoolArg("-txindex", false))
+        ptxindex = new CTxIndex(nTxIndexCache, false, fReindex);
+    if (GetBoolArg("-commentindex", false))
+        pcommentindex = new CCommentIndex(nCommentIndexCache, false, fReindex);
+    if (GetBoolArg("-addressindex", false))
+        paddressindex = new CAddressIndex(nAddressIndexCache, false, fReindex);
+
+    // A pruned node cannot serve the full block chain.
+    if (fPruneMode) {
+        nLocalServices &= ~NODE_NETWORK;
+        if (!fReindex) {
+            uiInterface.InitMessage(_("Pruning blockstore..."));
+            PruneAndFlush();
+        }
+    }
+
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1263,6 +1365,16 @@ bool AppInit2(boost::thread_group& threadGroup)
         BOOST_FOREACH(string strFile, mapMultiArgs["-loadblock"])
             vImportFiles.push_back(strFile);
     }
+    threadGroup.create_thread(&ThreadFlushState);
+    CChainIndex* vChainIndex[] = { ptxindex, pcommentindex, paddressindex };
+    for (unsigned int i = 0; i < ARRAYLEN(vChainIndex); i++) {
+        if (vChainIndex[i]) {
+            uiInterface.NotifyBlockTip.connect(boost::bind(&CChainIndex::NotifyBlockTip, vChainIndex[i], _1));
+            threadGroup.create_thread(boost::bind(&ThreadChainIndex, vChainIndex[i]));
+        }
+    }
+    for (int i = 0; pcoinsPrefetch && i < nPrefetchThreads; i++)
+        threadGroup.create_thread(&ThreadCoinsPrefetch);
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
     if (chainActive.Tip() == NULL) {
         LogPrintf("Waiting for genesis block to be imported...\n");
@@ -1291,6 +1403,9 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     StartNode(threadGroup);
 
+    if (GetBoolArg("-verifypowindex", false))
+        threadGroup.create_thread(&ThreadVerifyBlockIndexPoW);
+
 #ifdef ENABLE_WALLET
     // Generate coins in the background
     if (pwalletMain)
@@ -7,14 +7,19 @@
 
 #include "addrman.h"
 #include "alert.h"
+#include "blockimport.h"
+#include "blockreader.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "crypto/scrypt.h"
 #include "init.h"
+#include "memusage.h"
 #include "merkleblock.h"
 #include "net.h"
 #include "pow.h"
 #include "txdb.h"
+#include "txindex.h"
 #include "txmempool.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -49,11 +54,14 @@ CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
-bool fTxIndex = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fAlerts = DEFAULT_ALERTS;
+uint256 hashAssumeValid;
+bool fHavePruned = false;
+bool fPruneMode = false;
+uint64_t nPruneTarget = 0;
 
 /** Fees smaller than this (in satoshi) are considered zero fee (for relaying and mining) */
 CFeeRate minRelayTxFee = CFeeRate(DEFAULT_TX_FEE);
@@ -101,6 +109,16 @@ namespace {
 
     CBlockIndex *pindexBestInvalid;
 
+    /**
+     * Base block of the UTXO snapshot the chainstate was loaded from, if any.
+     * Its ancestors are in the active chain, but their data is not available.
+     */
+    CBlockIndex *pindexSnapshot = NULL;
+    /** Best block of the chainstate while a UTXO snapshot is being loaded into it. */
+    const uint256 hashSnapshotLoading(1);
+    /** Whether LoadCoinsSnapshot is filling the chainstate, which must not be connected to meanwhile. */
+    bool fSnapshotLoading = false;
+
     /**
      * The set of all CBlockIndex entries with BLOCK_VALID_TRANSACTIONS (for itself and all ancestors) and
      * as good as our current tip or better. Entries may be failed, though.
@@ -150,6 +168,23 @@ namespace {
 
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
+
+    /** Whether a new block file was started since we last looked for files to prune. */
+    bool fCheckForPruning = false;
+
+    /**
+     * Merkle trees of the most recently connected blocks, so that branches for
+     * filtered blocks and wallet transactions can be extracted without rehashing
+     * every level. Protected by cs_main.
+     */
+    map<uint256, vector<uint256> > mapRecentMerkleTrees;
+    list<uint256> listRecentMerkleTrees;
+
+    /** Storage for the entries of mapBlockIndex. Protected by cs_main. */
+    CBlockIndexArena blockIndexArena;
+
+    /** Recently used block and undo files, for reading blocks and undo data back. */
+    CBlockFileReader blockFileReader;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -466,8 +501,9 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                 // We consider the chain that this peer is on invalid.
                 return;
             }
-            if (pindex->nStatus & BLOCK_HAVE_DATA) {
-                if (pindex->nChainTx)
+            if (pindex->nStatus & BLOCK_HAVE_DATA || chainActive.Contains(pindex)) {
+                // Blocks below a UTXO snapshot are in the active chain without having data.
+                if (pindex->nChainTx || chainActive.Contains(pindex))
                     state->pindexLastCommonBlock = pindex;
             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
                 // The block is not already downloaded, and not yet in flight.
@@ -541,7 +577,11 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
     return chain.Genesis();
 }
 
+CCoinsViewDB *pcoinsdbview = NULL;
 CCoinsViewCache *pcoinsTip = NULL;
+CUtxoStats utxoStats;
+CCoinsViewWriteBehind *pcoinsWriteBehind = NULL;
+CCoinsViewPrefetch *pcoinsPrefetch = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -940,6 +980,36 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
+static CWorkStealingCheckQueue<CScriptCheck> mempoolcheckqueue(128, MAX_SCRIPTCHECK_THREADS);
+
+void ThreadMempoolScriptCheck() {
+    RenameThread("florincoin-mempoolch");
+    mempoolcheckqueue.Thread();
+}
+
+/**
+ * CheckInputs for mempool acceptance. The script checks of a transaction with
+ * several inputs are spread over the mempool check threads; if any of them
+ * fails, the inputs are checked again serially so that state gets exactly the
+ * reject reason and DoS score a serial check would have given it.
+ */
+static bool CheckMempoolInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, unsigned int flags)
+{
+    if (!nScriptCheckThreads || tx.vin.size() < 2)
+        return CheckInputs(tx, state, view, true, flags, true);
+
+    CSignatureHashContext sighashContext(tx);
+    std::vector<CScriptCheck> vChecks;
+    if (!CheckInputs(tx, state, view, true, flags, true, &vChecks, &sighashContext))
+        return false;
+
+    CCheckQueueControl<CScriptCheck, CWorkStealingCheckQueue<CScriptCheck> > control(&mempoolcheckqueue);
+    control.Add(vChecks);
+    if (control.Wait())
+        return true;
+    return CheckInputs(tx, state, view, true, flags, true, NULL, &sighashContext);
+}
+
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fRejectInsaneFee)
 {
@@ -1087,7 +1157,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true))
+        if (!CheckMempoolInputs(tx, state, view, STANDARD_SCRIPT_VERIFY_FLAGS))
         {
             return error("AcceptToMemoryPool: : ConnectInputs failed %s", hash.ToString());
         }
@@ -1101,7 +1171,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        if (!CheckMempoolInputs(tx, state, view, MANDATORY_SCRIPT_VERIFY_FLAGS))
         {
             return error("AcceptToMemoryPool: : BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
         }
@@ -1127,16 +1197,17 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
         return true;
     }
 
-    if (fTxIndex) {
+    if (ptxindex) {
         CDiskTxPos postx;
-        if (pblocktree->ReadTxIndex(hash, postx)) {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
+        if (ptxindex->FindTx(hash, postx)) {
+            CBlockFileRecord record;
+            if (!blockFileReader.Read(postx, "blk", record))
+                return error("%s: reading block failed", __func__);
+            CMemoryReader file(record.begin(), record.end(), SER_DISK, CLIENT_VERSION);
             CBlockHeader header;
             try {
                 file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                file.ignore(postx.nTxOffset);
                 file >> txOut;
             } catch (std::exception &e) {
                 return error("%s : Deserialize or I/O error - %s", __func__, e.what());
@@ -1207,25 +1278,23 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const uint256* phashPoW)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk : OpenBlockFile failed");
-
-    // Read block
+    // Read block, straight from the mapped history file
+    CBlockFileRecord record;
+    if (!blockFileReader.Read(pos, "blk", record))
+        return error("ReadBlockFromDisk : reading block file failed");
     try {
-        filein >> block;
+        CMemoryReader(record.begin(), record.end(), SER_DISK, CLIENT_VERSION) >> block;
     }
     catch (std::exception &e) {
         return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
 
-    // Check the header
-    if (!CheckProofOfWork(block.GetPoWHash(), block.nBits))
+    // Check the header, without computing the scrypt hash again if the caller has it
+    if (!CheckProofOfWork(phashPoW ? *phashPoW : block.GetPoWHash(), block.nBits))
         return error("ReadBlockFromDisk : Errors in block header");
 
     return true;
@@ -1240,6 +1309,46 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
+bool ReadRawBlockFromDisk(CBlockFileRecord& record, const CBlockIndex* pindex)
+{
+    if (!blockFileReader.Read(pindex->GetBlockPos(), "blk", record))
+        return error("ReadRawBlockFromDisk : reading block file failed");
+
+    CBlockHeader header;
+    try {
+        CMemoryReader(record.begin(), record.end(), SER_DISK, CLIENT_VERSION) >> header;
+    }
+    catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    if (header.GetHash() != pindex->GetBlockHash())
+        return error("ReadRawBlockFromDisk : GetHash() doesn't match index");
+    return true;
+}
+
+void CacheMerkleTree(const CBlock& block, const uint256& hash)
+{
+    AssertLockHeld(cs_main);
+    if (block.vMerkleTree.empty() || mapRecentMerkleTrees.count(hash))
+        return;
+    mapRecentMerkleTrees[hash] = block.vMerkleTree;
+    listRecentMerkleTrees.push_back(hash);
+    while (listRecentMerkleTrees.size() > MAX_RECENT_MERKLE_TREES) {
+        mapRecentMerkleTrees.erase(listRecentMerkleTrees.front());
+        listRecentMerkleTrees.pop_front();
+    }
+}
+
+bool GetCachedMerkleTree(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    map<uint256, vector<uint256> >::const_iterator it = mapRecentMerkleTrees.find(block.GetHash());
+    if (it == mapRecentMerkleTrees.end())
+        return false;
+    block.vMerkleTree = it->second;
+    return true;
+}
+
 CAmount GetBlockValue(int nHeight, const CAmount& nFees)
 {
     CAmount nSubsidy = 100 * COIN;
@@ -1403,33 +1512,41 @@ void static InvalidBlockFound(CBlockIndex *pindex, const CValidationState &state
     }
 }
 
-void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, CTxUndo &txundo, int nHeight)
+void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, CTxUndo &txundo, int nHeight, CUtxoStats *pstats)
 {
     // mark inputs spent
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
             txundo.vprevout.push_back(CTxInUndo());
-            bool ret = inputs.ModifyCoins(txin.prevout.hash)->Spend(txin.prevout, txundo.vprevout.back());
+            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
+            if (pstats && coins->IsAvailable(txin.prevout.n))
+                pstats->RemoveOutput(txin.prevout, coins->vout[txin.prevout.n], coins->nHeight, coins->fCoinBase);
+            bool ret = coins->Spend(txin.prevout, txundo.vprevout.back());
             assert(ret);
+            if (pstats && coins->IsPruned())
+                pstats->nTransactions--;
         }
     }
 
     // add outputs
-    inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
+    CCoinsModifier outs = inputs.ModifyCoins(tx.GetHash());
+    outs->FromTx(tx, nHeight);
+    if (pstats)
+        pstats->AddCoins(tx.GetHash(), *outs);
 }
 
 bool CScriptCheck::operator()() {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
     if(chainActive.Height() < Params().EnforceV2AfterHeight())
         return true; // Trust all transactions until the hard fork with a new checkpoint.
-    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, cacheStore), &error)) {
+    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, cacheStore, pctx), &error)) {
         return ::error("CScriptCheck(): %s:%d VerifySignature failed: %s", ptxTo->GetHash().ToString(), nIn, ScriptErrorString(error));
     }
     return true;
 }
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks)
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks, const CSignatureHashContext *pctx)
 {
     if (!tx.IsCoinBase())
     {
@@ -1492,13 +1609,20 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         // before the last block chain checkpoint. This is safe because block merkle hashes are
         // still computed and checked, and any change will be caught at the next checkpoint.
         if (fScriptChecks) {
+            // Inputs share the serialized parts of their signature hashes
+            CSignatureHashContext sighashContext;
+            if (!pctx && !pvChecks && tx.vin.size() > 1) {
+                sighashContext.Init(tx);
+                pctx = &sighashContext;
+            }
+
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
                 const CCoins* coins = inputs.AccessCoins(prevout.hash);
                 assert(coins);
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
+                CScriptCheck check(*coins, tx, i, flags, cacheStore, pctx);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1511,7 +1635,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
                         CScriptCheck check(*coins, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
+                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, pctx);
                         if (check())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
                     }
@@ -1533,24 +1657,10 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
 
 
 
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+bool ApplyBlockUndo(const CBlock& block, const CBlockUndo& blockUndo, int nHeight, CCoinsViewCache& view, bool& fClean, CUtxoStats* pstats)
 {
-    assert(pindex->GetBlockHash() == view.GetBestBlock());
-
-    if (pfClean)
-        *pfClean = false;
-
-    bool fClean = true;
-
-    CBlockUndo blockUndo;
-    CDiskBlockPos pos = pindex->GetUndoPos();
-    if (pos.IsNull())
-        return error("DisconnectBlock() : no undo data available");
-    if (!blockUndo.ReadFromDisk(pos, pindex->pprev->GetBlockHash()))
-        return error("DisconnectBlock() : failure reading undo data");
-
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
-        return error("DisconnectBlock() : block and undo data inconsistent");
+        return error("ApplyBlockUndo() : block and undo data inconsistent");
 
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
@@ -1566,16 +1676,18 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         CCoinsModifier outs = view.ModifyCoins(hash);
         outs->ClearUnspendable();
 
-        CCoins outsBlock(tx, pindex->nHeight);
+        CCoins outsBlock(tx, nHeight);
         // The CCoins serialization does not serialize negative numbers.
         // No network rules currently depend on the version here, so an inconsistency is harmless
         // but it must be corrected before txout nversion ever influences a network rule.
         if (outsBlock.nVersion < 0)
             outs->nVersion = outsBlock.nVersion;
         if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock() : added transaction mismatch? database corrupted");
+            fClean = fClean && error("ApplyBlockUndo() : added transaction mismatch? database corrupted");
 
         // remove outputs
+        if (pstats)
+            pstats->RemoveCoins(hash, *outs);
         outs->Clear();
         }
 
@@ -1583,7 +1695,7 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         if (i > 0) { // not coinbases
             const CTxUndo &txundo = blockUndo.vtxundo[i-1];
             if (txundo.vprevout.size() != tx.vin.size())
-                return error("DisconnectBlock() : transaction and undo data inconsistent");
+                return error("ApplyBlockUndo() : transaction and undo data inconsistent");
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
                 const CTxInUndo &undo = txundo.vprevout[j];
@@ -1591,26 +1703,55 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
                 if (undo.nHeight != 0) {
                     // undo data contains height: this is the last output of the prevout tx being spent
                     if (!coins->IsPruned())
-                        fClean = fClean && error("DisconnectBlock() : undo data overwriting existing transaction");
+                        fClean = fClean && error("ApplyBlockUndo() : undo data overwriting existing transaction");
                     coins->Clear();
                     coins->fCoinBase = undo.fCoinBase;
                     coins->nHeight = undo.nHeight;
                     coins->nVersion = undo.nVersion;
                 } else {
                     if (coins->IsPruned())
-                        fClean = fClean && error("DisconnectBlock() : undo data adding output to missing transaction");
+                        fClean = fClean && error("ApplyBlockUndo() : undo data adding output to missing transaction");
                 }
                 if (coins->IsAvailable(out.n))
-                    fClean = fClean && error("DisconnectBlock() : undo data overwriting existing output");
+                    fClean = fClean && error("ApplyBlockUndo() : undo data overwriting existing output");
                 if (coins->vout.size() < out.n+1)
                     coins->vout.resize(out.n+1);
                 coins->vout[out.n] = undo.txout;
+                if (pstats) {
+                    pstats->AddOutput(out, undo.txout, coins->nHeight, coins->fCoinBase);
+                    if (undo.nHeight != 0)
+                        pstats->nTransactions++;
+                }
             }
         }
     }
 
+    return true;
+}
+
+bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean, CUtxoStats* pstats)
+{
+    assert(pindex->GetBlockHash() == view.GetBestBlock());
+
+    if (pfClean)
+        *pfClean = false;
+
+    bool fClean = true;
+
+    CBlockUndo blockUndo;
+    CDiskBlockPos pos = pindex->GetUndoPos();
+    if (pos.IsNull())
+        return error("DisconnectBlock() : no undo data available");
+    if (!blockUndo.ReadFromDisk(pos, pindex->pprev->GetBlockHash()))
+        return error("DisconnectBlock() : failure reading undo data");
+
+    if (!ApplyBlockUndo(block, blockUndo, pindex->nHeight, view, fClean, pstats))
+        return false;
+
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
+    if (pstats)
+        pstats->hashBlock = pindex->pprev->GetBlockHash();
 
     if (pfClean) {
         *pfClean = fClean;
@@ -1626,6 +1767,10 @@ void static FlushBlockFile(bool fFinalize = false)
 
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
+    // Mappings of the files would extend past their end after truncating them.
+    if (fFinalize)
+        blockFileReader.Forget(nLastBlockFile);
+
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
         if (fFinalize)
@@ -1645,20 +1790,202 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CWorkStealingCheckQueue<CScriptCheck> scriptcheckqueue(128, MAX_SCRIPTCHECK_THREADS);
 
 void ThreadScriptCheck() {
     RenameThread("florincoin-scriptch");
     scriptcheckqueue.Thread();
 }
 
+void ThreadCoinsPrefetch() {
+    RenameThread("florincoin-prefetch");
+    pcoinsPrefetch->Thread();
+}
+
+/**
+ * Have the prefetch threads read the coins a block spends from disk, so that
+ * ConnectBlock finds them in memory instead of reading them one by one. The
+ * block is read from disk unless it is passed in.
+ */
+static void PrefetchBlockInputs(const CBlockIndex* pindex, const CBlock* pblock)
+{
+    AssertLockHeld(cs_main);
+    static const CBlockIndex* pindexLastPrefetched = NULL;
+    if (!pcoinsPrefetch || pindex == pindexLastPrefetched)
+        return;
+    pindexLastPrefetched = pindex;
+    CBlock blockRead;
+    if (!pblock) {
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) || !ReadBlockFromDisk(blockRead, pindex))
+            return;
+        pblock = &blockRead;
+    }
+    const CBlock& block = *pblock;
+    std::set<uint256> setSeen;
+    std::vector<uint256> vTxid;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                const uint256& hash = txin.prevout.hash;
+                if (setSeen.insert(hash).second && !pcoinsTip->HaveCoinsInCache(hash))
+                    vTxid.push_back(hash);
+            }
+        }
+        // Outputs created earlier in the same block are never on disk.
+        setSeen.insert(tx.GetHash());
+    }
+    pcoinsPrefetch->Prefetch(vTxid);
+}
+
+/**
+ * Closure computing the scrypt PoW hashes of a run of consecutive headers,
+ * so that a whole headers message can be hashed across all cores.
+ */
+class CPoWHashCheck
+{
+private:
+    const CBlockHeader *pheaders;
+    uint256 *phashes;
+    unsigned int nCount;
+
+public:
+    CPoWHashCheck() : pheaders(NULL), phashes(NULL), nCount(0) {}
+    CPoWHashCheck(const CBlockHeader *pheadersIn, uint256 *phashesIn, unsigned int nCountIn) :
+        pheaders(pheadersIn), phashes(phashesIn), nCount(nCountIn) {}
+
+    bool operator()() {
+        GetPoWHashes(pheaders, nCount, phashes);
+        return true;
+    }
+
+    void swap(CPoWHashCheck &check) {
+        std::swap(pheaders, check.pheaders);
+        std::swap(phashes, check.phashes);
+        std::swap(nCount, check.nCount);
+    }
+};
+
+/** Number of headers hashed per work item; a multiple of the scrypt kernel width. */
+static const unsigned int POWHASH_CHECK_HEADERS = 4 * SCRYPT_MAX_WAYS;
+
+static CCheckQueue<CPoWHashCheck> powhashcheckqueue(16);
+
+void ThreadPoWHashCheck() {
+    RenameThread("florincoin-powhash");
+    powhashcheckqueue.Thread();
+}
+
+/**
+ * Compute the PoW hashes of headers[nStart..] into vHashes (indexed like
+ * headers). They are hashed a chunk at a time, spread over the PoW hash
+ * threads when there are any, and hashing stops after the first header
+ * failing its proof of work, so that a bogus batch costs us at most a chunk.
+ * Returns the end of the headers hashed.
+ * Must not be called with cs_main held: this is what keeps it off the lock.
+ */
+static size_t GetHeaderPoWHashes(const std::vector<CBlockHeader>& headers, size_t nStart, std::vector<uint256>& vHashes)
+{
+    vHashes.resize(headers.size());
+    size_t nChunk = POWHASH_CHECK_HEADERS * std::max(nScriptCheckThreads, 1);
+    for (size_t nBegin = nStart; nBegin < headers.size(); ) {
+        size_t nEnd = std::min(headers.size(), nBegin + nChunk);
+        if (!nScriptCheckThreads) {
+            GetPoWHashes(&headers[nBegin], nEnd - nBegin, &vHashes[nBegin]);
+        } else {
+            CCheckQueueControl<CPoWHashCheck> control(&powhashcheckqueue);
+            std::vector<CPoWHashCheck> vChecks;
+            for (size_t i = nBegin; i < nEnd; i += POWHASH_CHECK_HEADERS) {
+                unsigned int nCount = std::min((size_t)POWHASH_CHECK_HEADERS, nEnd - i);
+                vChecks.push_back(CPoWHashCheck(&headers[i], &vHashes[i], nCount));
+            }
+            control.Add(vChecks);
+            control.Wait();
+        }
+        for (size_t i = nBegin; i < nEnd; i++) {
+            if (!CheckProofOfWork(vHashes[i], headers[i].nBits))
+                return i + 1;
+        }
+        nBegin = nEnd;
+    }
+    return headers.size();
+}
+
+/** Hash every nStep'th run of POWHASH_CHECK_HEADERS headers, starting at run nStart. */
+static void HashHeaderRuns(const std::vector<CBlockHeader>* pvHeaders, std::vector<uint256>* pvHashes, size_t nStart, size_t nStep)
+{
+    for (size_t i = nStart * POWHASH_CHECK_HEADERS; i < pvHeaders->size(); i += nStep * POWHASH_CHECK_HEADERS) {
+        boost::this_thread::interruption_point();
+        unsigned int nCount = std::min((size_t)POWHASH_CHECK_HEADERS, pvHeaders->size() - i);
+        GetPoWHashes(&(*pvHeaders)[i], nCount, &(*pvHashes)[i]);
+    }
+}
+
+void ThreadVerifyBlockIndexPoW()
+{
+    RenameThread("florincoin-powindex");
+
+    std::vector<CBlockIndex*> vIndex;
+    std::vector<CBlockHeader> vHeaders;
+    {
+        LOCK(cs_main);
+        vIndex.reserve(mapBlockIndex.size());
+        vHeaders.reserve(mapBlockIndex.size());
+        BOOST_FOREACH(const BlockMap::value_type& item, mapBlockIndex) {
+            vIndex.push_back(item.second);
+            vHeaders.push_back(item.second->GetBlockHeader());
+        }
+    }
+
+    int nThreads = std::max(1, (int)boost::thread::hardware_concurrency());
+    LogPrintf("Verifying proof of work of %u block index entries using %d threads\n", vIndex.size(), nThreads);
+    int64_t nStart = GetTimeMillis();
+
+    // The scrypt work runs without cs_main, so the node keeps serving meanwhile.
+    std::vector<uint256> vHashes(vHeaders.size());
+    boost::thread_group workers;
+    for (int i = 0; i < nThreads; i++)
+        workers.create_thread(boost::bind(&HashHeaderRuns, &vHeaders, &vHashes, i, nThreads));
+    try {
+        workers.join_all();
+    } catch (boost::thread_interrupted) {
+        workers.interrupt_all();
+        workers.join_all();
+        throw;
+    }
+
+    LOCK(cs_main);
+    unsigned int nFilled = 0, nFailed = 0;
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        CBlockIndex* pindex = vIndex[i];
+        bool fHaveHash = pindex->nStatus & BLOCK_HAVE_POWHASH;
+        if ((fHaveHash && pindex->hashPoW != vHashes[i]) || !CheckProofOfWork(vHashes[i], pindex->nBits)) {
+            LogPrintf("ERROR: %s : proof of work check failed: %s\n", __func__, pindex->ToString());
+            nFailed++;
+            continue;
+        }
+        if (!fHaveHash) {
+            // Written by an older version; store the hash so the next startup checks it.
+            pindex->hashPoW = vHashes[i];
+            pindex->nStatus |= BLOCK_HAVE_POWHASH;
+            setDirtyBlockIndex.insert(pindex);
+            nFilled++;
+        }
+    }
+    LogPrintf("Verified proof of work of block index: %u failed, %u hashes stored  %dms\n", nFailed, nFilled, GetTimeMillis() - nStart);
+
+    if (nFailed) {
+        strMiscWarning = _("Warning: The block index failed proof of work verification! You may need to rebuild it with -reindex.");
+        CAlert::Notify(strMiscWarning, true);
+    }
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck)
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, CUtxoStats* pstats)
 {
     AssertLockHeld(cs_main);
     // Check it again in case a previous version let a bad block in
@@ -1673,10 +2000,22 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // (its coinbase is unspendable)
     if (block.GetHash() == Params().HashGenesisBlock()) {
         view.SetBestBlock(pindex->GetBlockHash());
+        if (pstats)
+            pstats->hashBlock = pindex->GetBlockHash();
         return true;
     }
 
     bool fScriptChecks = pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate();
+    if (fScriptChecks && hashAssumeValid != 0) {
+        // Skip the scripts of ancestors of the assumed-valid block, as long as it is in
+        // the best header chain and two weeks' worth of work has been done on top of this
+        // block: rewriting that history would be as hard as faking the scripts.
+        // Everything else, amounts and double spends included, is still checked.
+        BlockMap::iterator it = mapBlockIndex.find(hashAssumeValid);
+        if (it != mapBlockIndex.end() && it->second->GetAncestor(pindex->nHeight) == pindex &&
+            pindexBestHeader->GetAncestor(pindex->nHeight) == pindex)
+            fScriptChecks = GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader) <= 60 * 60 * 24 * 7 * 2;
+    }
 
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // unless those are already completely spent.
@@ -1719,15 +2058,17 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    // Signature hash contexts of transactions with several inputs. Queued script
+    // checks point into these, so they must outlive control and never reallocate.
+    std::vector<CSignatureHashContext> vSighashContexts;
+    vSighashContexts.reserve(block.vtx.size());
+
+    CCheckQueueControl<CScriptCheck, CWorkStealingCheckQueue<CScriptCheck> > control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
     int nInputs = 0;
     unsigned int nSigOps = 0;
-    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
-    vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
@@ -1758,8 +2099,15 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             nFees += view.GetValueIn(tx)-tx.GetValueOut();
 
+            const CSignatureHashContext* pctx = NULL;
+            if (fScriptChecks && nScriptCheckThreads && tx.vin.size() > 1) {
+                vSighashContexts.push_back(CSignatureHashContext());
+                vSighashContexts.back().Init(tx);
+                pctx = &vSighashContexts.back();
+            }
+
             std::vector<CScriptCheck> vChecks;
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, nScriptCheckThreads ? &vChecks : NULL))
+            if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, nScriptCheckThreads ? &vChecks : NULL, pctx))
                 return false;
             control.Add(vChecks);
         }
@@ -1768,10 +2116,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
         }
-        UpdateCoins(tx, state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
-
-        vPos.push_back(std::make_pair(tx.GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        UpdateCoins(tx, state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight, pstats);
     }
     int64_t nTime1 = GetTimeMicros(); nTimeConnect += nTime1 - nTimeStart;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs-1), nTimeConnect * 0.000001);
@@ -1809,12 +2154,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         setDirtyBlockIndex.insert(pindex);
     }
 
-    if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
-            return state.Abort("Failed to write transaction index");
-
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
+    if (pstats)
+        pstats->hashBlock = pindex->GetBlockHash();
 
     int64_t nTime3 = GetTimeMicros(); nTimeIndex += nTime3 - nTime2;
     LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime3 - nTime2), nTimeIndex * 0.000001);
@@ -1836,18 +2179,266 @@ enum FlushStateMode {
     FLUSH_STATE_ALWAYS
 };
 
+/**
+ * A snapshot of the dirty block index state, taken together with the coins
+ * cache so that both can be written out in the background, in the same order
+ * as a synchronous flush: block index first, then the chainstate (whose best
+ * block marker is written atomically with the coins).
+ */
+struct CFlushJob
+{
+    std::vector<std::pair<int, CBlockFileInfo> > vFileInfo;
+    int nLastBlockFile;
+    std::vector<CDiskBlockIndex> vBlockIndex;
+    //! statistics of the UTXO set being written
+    CUtxoStats utxoStats;
+    //! block files to delete once nothing on disk refers to them anymore
+    std::set<int> setFilesToPrune;
+
+    void swap(CFlushJob& job) {
+        vFileInfo.swap(job.vFileInfo);
+        std::swap(nLastBlockFile, job.nLastBlockFile);
+        vBlockIndex.swap(job.vBlockIndex);
+        utxoStats.swap(job.utxoStats);
+        setFilesToPrune.swap(job.setFilesToPrune);
+    }
+};
+
+enum FlushJobState {
+    FLUSH_JOB_NONE,
+    FLUSH_JOB_QUEUED,
+    FLUSH_JOB_RUNNING
+};
+
+static boost::mutex csFlushJob;
+static boost::condition_variable condFlushJob;
+static FlushJobState flushJobState = FLUSH_JOB_NONE;
+static CFlushJob flushJob;
+static bool fFlushJobFailed = false;
+//! Block of the UTXO statistics the chainstate on disk refers to (only used by WriteFlushJob once loaded)
+static uint256 hashUtxoStatsOnDisk;
+
+/** Delete the given block and undo files */
+static void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
+{
+    for (std::set<int>::const_iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
+        CDiskBlockPos pos(*it, 0);
+        blockFileReader.Forget(*it);
+        boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
+        boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
+        LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
+    }
+}
+
+static bool WriteFlushJob(const CFlushJob& job) {
+    try {
+        for (std::vector<std::pair<int, CBlockFileInfo> >::const_iterator it = job.vFileInfo.begin(); it != job.vFileInfo.end(); it++) {
+            if (!pblocktree->WriteBlockFileInfo(it->first, it->second))
+                return AbortNode("Failed to write to block index");
+        }
+        if (!job.vFileInfo.empty() && !pblocktree->WriteLastBlockFile(job.nLastBlockFile))
+            return AbortNode("Failed to write to block index");
+        BOOST_FOREACH(const CDiskBlockIndex& blockindex, job.vBlockIndex) {
+            if (!pblocktree->WriteBlockIndex(blockindex))
+                return AbortNode("Failed to write to block index");
+        }
+        // The UTXO statistics are stored per block, so that they are never
+        // mistaken for those of the chainstate if we crash before it is written.
+        if (!pblocktree->WriteUtxoStats(job.utxoStats))
+            return AbortNode("Failed to write to block index");
+        pblocktree->Sync();
+        // Finally commit the chainstate (which may refer to block index entries).
+        if (!pcoinsWriteBehind->Commit())
+            return AbortNode("Failed to write to coin database");
+        if (hashUtxoStatsOnDisk != job.utxoStats.hashBlock) {
+            if (hashUtxoStatsOnDisk != 0 && !pblocktree->EraseUtxoStats(hashUtxoStatsOnDisk))
+                return AbortNode("Failed to write to block index");
+            hashUtxoStatsOnDisk = job.utxoStats.hashBlock;
+        }
+        // Neither the block index nor the chainstate needs the pruned files anymore.
+        UnlinkPrunedFiles(job.setFilesToPrune);
+    } catch (const std::runtime_error& e) {
+        return AbortNode(std::string("System error while flushing: ") + e.what());
+    }
+    return true;
+}
+
+/**
+ * Wait for the previous flush to be written. If no flush thread picked it up
+ * (it is not running yet, or anymore), write it here.
+ */
+static bool FinishFlushJob() {
+    CFlushJob job;
+    {
+        boost::unique_lock<boost::mutex> lock(csFlushJob);
+        while (flushJobState == FLUSH_JOB_RUNNING)
+            condFlushJob.wait(lock);
+        if (flushJobState == FLUSH_JOB_NONE)
+            return !fFlushJobFailed;
+        job.swap(flushJob);
+        flushJobState = FLUSH_JOB_RUNNING;
+    }
+    bool fOk = WriteFlushJob(job);
+    {
+        boost::unique_lock<boost::mutex> lock(csFlushJob);
+        flushJobState = FLUSH_JOB_NONE;
+        fFlushJobFailed |= !fOk;
+    }
+    condFlushJob.notify_all();
+    return fOk;
+}
+
+void ThreadFlushState() {
+    RenameThread("florincoin-flush");
+    while (true) {
+        CFlushJob job;
+        {
+            boost::unique_lock<boost::mutex> lock(csFlushJob);
+            while (flushJobState != FLUSH_JOB_QUEUED)
+                condFlushJob.wait(lock);
+            job.swap(flushJob);
+            flushJobState = FLUSH_JOB_RUNNING;
+        }
+        int64_t nStart = GetTimeMicros();
+        bool fOk = WriteFlushJob(job);
+        LogPrint("bench", "    - Background flush: %.2fms\n", 0.001 * (GetTimeMicros() - nStart));
+        {
+            boost::unique_lock<boost::mutex> lock(csFlushJob);
+            flushJobState = FLUSH_JOB_NONE;
+            fFlushJobFailed |= !fOk;
+        }
+        condFlushJob.notify_all();
+    }
+}
+
+/** Calculate the amount of disk space the block and undo files currently use */
+static uint64_t CalculateCurrentUsage()
+{
+    uint64_t retval = 0;
+    BOOST_FOREACH(const CBlockFileInfo &file, vinfoBlockFile) {
+        retval += file.nSize + file.nUndoSize;
+    }
+    return retval;
+}
+
+/** Forget the block and undo data of all blocks in file fileNumber */
+static void PruneOneBlockFile(const int fileNumber)
+{
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
+        CBlockIndex* pindex = it->second;
+        if (pindex->nFile == fileNumber) {
+            // nTx (and so nChainTx) is kept: the block was connected before.
+            pindex->nStatus &= ~BLOCK_HAVE_DATA;
+            pindex->nStatus &= ~BLOCK_HAVE_UNDO;
+            pindex->nFile = 0;
+            pindex->nDataPos = 0;
+            pindex->nUndoPos = 0;
+            setDirtyBlockIndex.insert(pindex);
+
+            // Prune from mapBlocksUnlinked -- any block we prune would have
+            // to be downloaded again in order to consider its chain, at which
+            // point it would be considered as a candidate for
+            // mapBlocksUnlinked or setBlockIndexCandidates.
+            std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex->pprev);
+            while (range.first != range.second) {
+                std::multimap<CBlockIndex*, CBlockIndex*>::iterator itUnlinked = range.first;
+                range.first++;
+                if (itUnlinked->second == pindex)
+                    mapBlocksUnlinked.erase(itUnlinked);
+            }
+        }
+    }
+
+    vinfoBlockFile[fileNumber].SetNull();
+    setDirtyFileInfo.insert(fileNumber);
+}
+
+/**
+ * Pick the oldest block files to prune to get below the -prune target, and
+ * forget their blocks. Files holding any of the last MIN_BLOCKS_TO_KEEP blocks
+ * of the active chain (the window reorganizations need undo data for) or the
+ * file being written to are never pruned.
+ */
+static void FindFilesToPrune(std::set<int>& setFilesToPrune)
+{
+    LOCK2(cs_main, cs_LastBlockFile);
+    if (chainActive.Tip() == NULL || nPruneTarget == 0)
+        return;
+    if (chainActive.Height() <= (int)MIN_BLOCKS_TO_KEEP)
+        return;
+
+    unsigned int nLastBlockWeCanPrune = chainActive.Height() - MIN_BLOCKS_TO_KEEP;
+    uint64_t nCurrentUsage = CalculateCurrentUsage();
+    // We don't check to prune until after we've allocated new space for files,
+    // so we should leave a buffer under our target to account for another allocation
+    // before the next pruning.
+    uint64_t nBuffer = BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
+    uint64_t nBytesToPrune;
+    int count = 0;
+
+    if (nCurrentUsage + nBuffer >= nPruneTarget) {
+        for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
+            nBytesToPrune = vinfoBlockFile[fileNumber].nSize + vinfoBlockFile[fileNumber].nUndoSize;
+
+            if (vinfoBlockFile[fileNumber].nSize == 0)
+                continue;
+
+            if (nCurrentUsage + nBuffer < nPruneTarget)  // are we below our target?
+                break;
+
+            // don't prune files that could have a block within MIN_BLOCKS_TO_KEEP of the main chain's tip
+            if (vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
+                continue;
+
+            PruneOneBlockFile(fileNumber);
+            // Queue up the files for removal
+            setFilesToPrune.insert(fileNumber);
+            nCurrentUsage -= nBytesToPrune;
+            count++;
+        }
+    }
+
+    LogPrint("prune", "Prune: target=%dMiB actual=%dMiB diff=%dMiB max_prune_height=%d removed %d blk/rev pairs\n",
+           nPruneTarget/1024/1024, nCurrentUsage/1024/1024,
+           ((int64_t)nPruneTarget - (int64_t)nCurrentUsage)/1024/1024,
+           nLastBlockWeCanPrune, count);
+}
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed if either they're too large, forceWrite is set, or
  * fast is not set and it's been a while since the last write.
+ * Except for FLUSH_STATE_ALWAYS, the actual writes happen in the background:
+ * the coins cache is handed over to pcoinsWriteBehind, which keeps serving it
+ * until it is committed, and pcoinsTip starts over empty.
+ * In prune mode, block files are pruned as part of a flush, and deleted once
+ * it has been written.
  */
 bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     LOCK(cs_main);
     static int64_t nLastWrite = 0;
+    std::set<int> setFilesToPrune;
+    bool fFlushForPrune = false;
     try {
-    if ((mode == FLUSH_STATE_ALWAYS) ||
-        ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+    if (fPruneMode && fCheckForPruning && !fReindex) {
+        FindFilesToPrune(setFilesToPrune);
+        fCheckForPruning = false;
+        if (!setFilesToPrune.empty()) {
+            fFlushForPrune = true;
+            if (!fHavePruned) {
+                pblocktree->WriteFlag("prunedblockfiles", true);
+                fHavePruned = true;
+            }
+        }
+    }
+    // The cache being written out and the one filling up meanwhile share the
+    // -dbcache budget, so hand over the cache once it reaches half of it.
+    if ((mode == FLUSH_STATE_ALWAYS) || fFlushForPrune ||
+        ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage / 2) ||
         (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
+        // Only one flush can be in progress at a time.
+        if (!FinishFlushJob())
+            return state.Error("writing the previous flush failed");
         // Typical CCoins structures on disk are around 100 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
@@ -1857,28 +2448,38 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
             return state.Error("out of disk space");
         // First make sure all block and undo data is flushed to disk.
         FlushBlockFile();
-        // Then update all block file information (which may refer to block and undo files).
-        bool fileschanged = false;
+        // Then snapshot all block file information (which may refer to block and undo files).
+        CFlushJob job;
         for (set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end(); ) {
-            if (!pblocktree->WriteBlockFileInfo(*it, vinfoBlockFile[*it])) {
-                return state.Abort("Failed to write to block index");
-            }
-            fileschanged = true;
+            job.vFileInfo.push_back(std::make_pair(*it, vinfoBlockFile[*it]));
             setDirtyFileInfo.erase(it++);
         }
-        if (fileschanged && !pblocktree->WriteLastBlockFile(nLastBlockFile)) {
-            return state.Abort("Failed to write to block index");
-        }
+        job.nLastBlockFile = nLastBlockFile;
+        job.utxoStats = utxoStats;
+        job.setFilesToPrune.swap(setFilesToPrune);
+        job.vBlockIndex.reserve(setDirtyBlockIndex.size());
         for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
-             if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(*it))) {
-                 return state.Abort("Failed to write to block index");
-             }
+             job.vBlockIndex.push_back(CDiskBlockIndex(*it));
              setDirtyBlockIndex.erase(it++);
         }
-        pblocktree->Sync();
-        // Finally flush the chainstate (which may refer to block index entries).
+        // Hand over the chainstate (which may refer to block index entries).
         if (!pcoinsTip->Flush())
             return state.Abort("Failed to write to coin database");
+        if (mode == FLUSH_STATE_ALWAYS) {
+            if (!WriteFlushJob(job)) {
+                // Like a failed background flush, this must stop later flushes.
+                boost::unique_lock<boost::mutex> lock(csFlushJob);
+                fFlushJobFailed = true;
+                return state.Error("flushing chain state failed");
+            }
+        } else {
+            {
+                boost::unique_lock<boost::mutex> lock(csFlushJob);
+                flushJob.swap(job);
+                flushJobState = FLUSH_JOB_QUEUED;
+            }
+            condFlushJob.notify_all();
+        }
         // Update best block in wallet (so we can detect restored wallets).
         if (mode != FLUSH_STATE_IF_NEEDED) {
             g_signals.SetBestChain(chainActive.GetLocator());
@@ -1896,6 +2497,12 @@ void FlushStateToDisk() {
     FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
+void PruneAndFlush() {
+    CValidationState state;
+    fCheckForPruning = true;
+    FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED);
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew) {
     chainActive.SetTip(pindexNew);
@@ -1904,10 +2511,10 @@ void static UpdateTip(CBlockIndex *pindexNew) {
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
       chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble())/log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
       DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-      Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+      Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1<<20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -1939,6 +2546,8 @@ void static UpdateTip(CBlockIndex *pindexNew) {
 bool static DisconnectTip(CValidationState &state) {
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
+    if (pindexDelete == pindexSnapshot)
+        return state.Abort("Cannot disconnect the base block of the UTXO snapshot");
     mempool.check(pcoinsTip);
     // Read block from disk.
     CBlock block;
@@ -1948,9 +2557,11 @@ bool static DisconnectTip(CValidationState &state) {
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        if (!DisconnectBlock(block, state, pindexDelete, view))
+        CUtxoStats stats(utxoStats);
+        if (!DisconnectBlock(block, state, pindexDelete, view, NULL, &stats))
             return error("DisconnectTip() : DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
+        utxoStats.swap(stats);
     }
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
     // Write the chain state to disk, if necessary.
@@ -2003,8 +2614,9 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
+        CUtxoStats stats(utxoStats);
         CInv inv(MSG_BLOCK, pindexNew->GetBlockHash());
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view);
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, &stats);
         g_signals.BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2012,9 +2624,11 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
             return error("ConnectTip() : ConnectBlock %s failed", pindexNew->GetBlockHash().ToString());
         }
         mapBlockSource.erase(inv.hash);
+        CacheMerkleTree(*pblock, inv.hash);
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
+        utxoStats.swap(stats);
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
@@ -2066,15 +2680,23 @@ static CBlockIndex* FindMostWorkChain() {
         CBlockIndex *pindexTest = pindexNew;
         bool fInvalidAncestor = false;
         while (pindexTest && !chainActive.Contains(pindexTest)) {
-            assert(pindexTest->nStatus & BLOCK_HAVE_DATA);
             assert(pindexTest->nChainTx || pindexTest->nHeight == 0);
-            if (pindexTest->nStatus & BLOCK_FAILED_MASK) {
-                // Candidate has an invalid ancestor, remove entire chain from the set.
-                if (pindexBestInvalid == NULL || pindexNew->nChainWork > pindexBestInvalid->nChainWork)
+
+            // Pruning may have removed the data of blocks on a side chain.
+            bool fFailedChain = pindexTest->nStatus & BLOCK_FAILED_MASK;
+            bool fMissingData = !(pindexTest->nStatus & BLOCK_HAVE_DATA);
+            if (fFailedChain || fMissingData) {
+                // Candidate chain is not usable (either invalid or missing data), remove entire chain from the set.
+                if (fFailedChain && (pindexBestInvalid == NULL || pindexNew->nChainWork > pindexBestInvalid->nChainWork))
                     pindexBestInvalid = pindexNew;
                 CBlockIndex *pindexFailed = pindexNew;
                 while (pindexTest != pindexFailed) {
-                    pindexFailed->nStatus |= BLOCK_FAILED_CHILD;
+                    if (fFailedChain) {
+                        pindexFailed->nStatus |= BLOCK_FAILED_CHILD;
+                    } else {
+                        // Should the missing block arrive again, the chain becomes a candidate again.
+                        mapBlocksUnlinked.insert(std::make_pair(pindexFailed->pprev, pindexFailed));
+                    }
                     setBlockIndexCandidates.erase(pindexFailed);
                     pindexFailed = pindexFailed->pprev;
                 }
@@ -2134,6 +2756,12 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
     }
     nHeight = nTargetHeight;
 
+    // Have the inputs of the next block read while this one connects.
+    if (vpindexToConnect.size() >= 2) {
+        CBlockIndex *pindexNext = vpindexToConnect[vpindexToConnect.size() - 2];
+        PrefetchBlockInputs(pindexNext, pindexNext == pindexMostWork ? pblock : NULL);
+    }
+
     // Connect new blocks.
     BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
         if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL)) {
@@ -2186,7 +2814,7 @@ bool ActivateBestChain(CValidationState &state, CBlock *pblock) {
             pindexMostWork = FindMostWorkChain();
 
             // Whether we have anything to do at all.
-            if (pindexMostWork == NULL || pindexMostWork == chainActive.Tip())
+            if (pindexMostWork == NULL || pindexMostWork == chainActive.Tip() || fSnapshotLoading)
                 return true;
 
             if (!ActivateBestChainStep(state, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : NULL))
@@ -2289,7 +2917,7 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex) {
     return true;
 }
 
-CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
+CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256& hashPoW)
 {
     // Check for duplicate
     uint256 hash = block.GetHash();
@@ -2298,12 +2926,14 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
+    CBlockIndex* pindexNew = blockIndexArena.New(block);
     assert(pindexNew);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
     pindexNew->nSequenceId = 0;
+    pindexNew->hashPoW = hashPoW;
+    pindexNew->nStatus |= BLOCK_HAVE_POWHASH;
     BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
     BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
@@ -2387,6 +3017,8 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
                 vinfoBlockFile.resize(nFile + 1);
             }
         }
+        if (fPruneMode && nFile != (unsigned int)nLastBlockFile)
+            fCheckForPruning = true;
         pos.nFile = nFile;
         pos.nPos = vinfoBlockFile[nFile].nSize;
     }
@@ -2448,10 +3080,10 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     return true;
 }
 
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW, const uint256* phashPoW)
 {
     // Check proof of work matches claimed amount
-    if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(), block.nBits))
+    if (fCheckPOW && !CheckProofOfWork(phashPoW ? *phashPoW : block.GetPoWHash(), block.nBits))
         return state.DoS(50, error("CheckBlockHeader() : proof of work failed"),
                          REJECT_INVALID, "high-hash");
 
@@ -2463,13 +3095,13 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot, const uint256* phashPoW)
 {
     // These are checks that are independent of context.
 
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
-    if (!CheckBlockHeader(block, state, fCheckPOW))
+    if (!CheckBlockHeader(block, state, fCheckPOW, phashPoW))
         return false;
 
     // Check the merkle root.
@@ -2635,7 +3267,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex)
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, const uint256* phashPoW)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -2652,7 +3284,9 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
         return true;
     }
 
-    if (!CheckBlockHeader(block, state))
+    // Hash once here: the result is also stored in the block index.
+    uint256 hashPoW = phashPoW ? *phashPoW : block.GetPoWHash();
+    if (!CheckBlockHeader(block, state, true, &hashPoW))
         return false;
 
     // Get prev block index
@@ -2670,7 +3304,7 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
         return false;
 
     if (pindex == NULL)
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, hashPoW);
 
     if (ppindex)
         *ppindex = pindex;
@@ -2678,13 +3312,13 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
     return true;
 }
 
-bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex, CDiskBlockPos* dbp)
+bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex, CDiskBlockPos* dbp, const uint256* phashPoW)
 {
     AssertLockHeld(cs_main);
 
     CBlockIndex *&pindex = *ppindex;
 
-    if (!AcceptBlockHeader(block, state, &pindex))
+    if (!AcceptBlockHeader(block, state, &pindex, phashPoW))
         return false;
 
     if (pindex->nStatus & BLOCK_HAVE_DATA) {
@@ -2693,7 +3327,12 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
         return true;
     }
 
-    if ((!CheckBlock(block, state)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
+    // Blocks pruned from the active chain were connected already: don't store them again.
+    if (pindex->nTx > 0 && chainActive.Contains(pindex))
+        return true;
+
+    // CheckBlock already passed, so only the checks that need the parent are left.
+    if (!ContextualCheckBlock(block, state, pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
             setDirtyBlockIndex.insert(pindex);
@@ -2785,10 +3424,18 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
-bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp)
+bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp, const uint256* phashPoW)
 {
-    // Preliminary checks
-    bool checked = CheckBlock(*pblock, state);
+    // Preliminary checks. The scrypt PoW hash is by far their most expensive
+    // part, so compute it only once for them and AcceptBlock.
+    uint256 hashPoW;
+    bool checked = true;
+    if (phashPoW) {
+        hashPoW = *phashPoW;
+    } else {
+        hashPoW = pblock->GetPoWHash();
+        checked = CheckBlock(*pblock, state, true, true, &hashPoW);
+    }
 
     {
         LOCK(cs_main);
@@ -2799,13 +3446,15 @@ bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDis
 
         // Store to disk
         CBlockIndex *pindex = NULL;
-        bool ret = AcceptBlock(*pblock, state, &pindex, dbp);
+        bool ret = AcceptBlock(*pblock, state, &pindex, dbp, &hashPoW);
         if (pindex && pfrom) {
             mapBlockSource[pindex->GetBlockHash()] = pfrom->GetId();
         }
         CheckBlockIndex();
         if (!ret)
             return error("%s : AcceptBlock FAILED", __func__);
+        if (pindex->pprev == chainActive.Tip())
+            PrefetchBlockInputs(pindex, pblock);
     }
 
     if (!ActivateBestChain(state, pblock))
@@ -2913,9 +3562,7 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.New();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
@@ -2924,11 +3571,25 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
 
 bool static LoadBlockIndexDB()
 {
+    int64_t nStart = GetTimeMillis();
     if (!pblocktree->LoadBlockIndexGuts())
         return false;
 
     boost::this_thread::interruption_point();
 
+    // A chainstate loaded from a UTXO snapshot starts at its base block, which
+    // we have no data for, so its nChainTx is stored separately.
+    uint256 hashSnapshotBase;
+    uint64_t nSnapshotChainTx = 0;
+    if (pblocktree->ReadSnapshotBase(hashSnapshotBase, nSnapshotChainTx)) {
+        BlockMap::iterator it = mapBlockIndex.find(hashSnapshotBase);
+        if (it == mapBlockIndex.end())
+            return error("LoadBlockIndexDB() : UTXO snapshot base block %s is not in the block index", hashSnapshotBase.ToString());
+        pindexSnapshot = it->second;
+        nLocalServices &= ~NODE_NETWORK;
+        LogPrintf("LoadBlockIndexDB(): chainstate was loaded from a UTXO snapshot at height %d\n", pindexSnapshot->nHeight);
+    }
+
     // Calculate nChainWork
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
@@ -2942,7 +3603,8 @@ bool static LoadBlockIndexDB()
     {
         CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
-        if (pindex->nStatus & BLOCK_HAVE_DATA) {
+        // Pruned blocks have no data anymore, but were connected before (nTx is kept).
+        if (pindex->nTx > 0) {
             if (pindex->pprev) {
                 if (pindex->pprev->nChainTx) {
                     pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
@@ -2954,6 +3616,8 @@ bool static LoadBlockIndexDB()
                 pindex->nChainTx = pindex->nTx;
             }
         }
+        if (pindex == pindexSnapshot)
+            pindex->nChainTx = nSnapshotChainTx;
         if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == NULL))
             setBlockIndexCandidates.insert(pindex);
         if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
@@ -2963,6 +3627,8 @@ bool static LoadBlockIndexDB()
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    LogPrintf("%s: loaded %u block index entries in %dms, using %.1f MiB (process RSS %.1f MiB)\n", __func__, mapBlockIndex.size(), GetTimeMillis() - nStart,
+              (blockIndexArena.DynamicMemoryUsage() + memusage::DynamicUsage(mapBlockIndex)) / 1048576.0, GetProcessRSS() / 1048576.0);
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
@@ -2981,6 +3647,18 @@ bool static LoadBlockIndexDB()
         }
     }
 
+    // Check whether we have ever pruned block & undo files
+    pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
+    if (fHavePruned)
+        LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
+
+    // The transaction index has its own database now; drop the one older versions kept here
+    uint64_t nTxIndexErased = 0;
+    if (!pblocktree->EraseLegacyTxIndex(nTxIndexErased))
+        return error("LoadBlockIndexDB() : failed to erase the old transaction index");
+    if (nTxIndexErased > 0)
+        LogPrintf("LoadBlockIndexDB(): erased %u entries of the old transaction index\n", nTxIndexErased);
+
     // Check presence of blk files
     LogPrintf("Checking all blk files are present...\n");
     set<int> setBlkDataFiles;
@@ -3004,16 +3682,24 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadReindexing(fReindexing);
     fReindex |= fReindexing;
 
-    // Check whether we have a transaction index
-    pblocktree->ReadFlag("txindex", fTxIndex);
-    LogPrintf("LoadBlockIndexDB(): transaction index %s\n", fTxIndex ? "enabled" : "disabled");
-
     // Load pointer to end of best chain
+    if (pcoinsTip->GetBestBlock() == hashSnapshotLoading)
+        return error("LoadBlockIndexDB() : loading a UTXO snapshot was interrupted, restart with -reindex");
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
 
+    // Load the statistics of the UTXO set, or rebuild them if the node was
+    // upgraded or did not shut down cleanly.
+    hashUtxoStatsOnDisk = chainActive.Tip()->GetBlockHash();
+    if (!pblocktree->ReadUtxoStats(hashUtxoStatsOnDisk, utxoStats)) {
+        LogPrintf("LoadBlockIndexDB(): rebuilding UTXO set statistics...\n");
+        utxoStats = CUtxoStats();
+        if (!pcoinsdbview->GetUtxoStats(utxoStats))
+            return false;
+    }
+
     PruneBlockIndexCandidates();
 
     LogPrintf("LoadBlockIndexDB(): hashBestChain=%s height=%d date=%s progress=%f\n",
@@ -3056,8 +3742,13 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
     {
         boost::this_thread::interruption_point();
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
-        if (pindex->nHeight < chainActive.Height()-nCheckDepth)
+        if (pindex->nHeight < chainActive.Height()-nCheckDepth || pindex == pindexSnapshot)
+            break;
+        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning, only go back as far as we have data.
+            LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
             break;
+        }
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
@@ -3075,7 +3766,7 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -3118,6 +3809,9 @@ void UnloadBlockIndex()
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
     pindexBestInvalid = NULL;
+    pindexSnapshot = NULL;
+    utxoStats = CUtxoStats();
+    hashUtxoStatsOnDisk = 0;
 }
 
 bool LoadBlockIndex()
@@ -3135,9 +3829,6 @@ bool InitBlockIndex() {
     if (chainActive.Genesis() != NULL)
         return true;
 
-    // Use the provided setting for -txindex in the new database
-    fTxIndex = GetBoolArg("-txindex", false);
-    pblocktree->WriteFlag("txindex", fTxIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -3152,7 +3843,7 @@ bool InitBlockIndex() {
                 return error("LoadBlockIndex() : FindBlockPos failed");
             if (!WriteBlockToDisk(block, blockPos))
                 return error("LoadBlockIndex() : writing genesis block to disk failed");
-            CBlockIndex *pindex = AddToBlockIndex(block);
+            CBlockIndex *pindex = AddToBlockIndex(block, block.GetPoWHash());
             if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
                 return error("LoadBlockIndex() : genesis block not accepted");
             if (!ActivateBestChain(state, &block))
@@ -3167,67 +3858,172 @@ bool InitBlockIndex() {
     return true;
 }
 
+/** Check that the chainstate can still take a UTXO snapshot based on pindexBase. */
+static bool CheckCoinsSnapshotBase(CValidationState &state, const CCoinsSnapshotHeader &header, CBlockIndex *&pindexBase)
+{
+    AssertLockHeld(cs_main);
+    if (pindexSnapshot != NULL || fSnapshotLoading)
+        return state.Error("a UTXO snapshot has already been loaded");
+    if (chainActive.Height() != 0)
+        return state.Error("a UTXO snapshot can only be loaded into an empty chainstate");
+    BlockMap::iterator mi = mapBlockIndex.find(header.hashBlock);
+    if (mi == mapBlockIndex.end())
+        return state.Error(strprintf("UTXO snapshot base block %s is not known yet, wait for the headers to sync", header.hashBlock.ToString()));
+    pindexBase = mi->second;
+    if (pindexBase->nHeight != header.nHeight || header.nChainTx <= (uint64_t)header.nHeight)
+        return state.Error("UTXO snapshot header is inconsistent");
+    if (pindexBestHeader == NULL || pindexBestHeader->GetAncestor(pindexBase->nHeight) != pindexBase)
+        return state.Error("UTXO snapshot base block is not in the best header chain");
+    return true;
+}
+
+/**
+ * Read the coins of a checked UTXO snapshot into the chainstate, in chunks,
+ * flushing as needed. cs_main is only held to hand over each chunk; until the
+ * last one is in, the chainstate's best block is the hashSnapshotLoading
+ * marker, so an interruption is detected on startup.
+ */
+static bool ReadCoinsSnapshot(CValidationState &state, const boost::filesystem::path &path, CBlockIndex *pindexBase)
+{
+    try {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return state.Abort(strprintf("cannot reopen %s", path.string()));
+        CCoinsSnapshotHeader header;
+        filein >> header;
+        CCoinsMap mapCoins;
+        CUtxoStats utxoStatsLoaded;
+        while (true) {
+            uint256 txid;
+            filein >> txid;
+            if (txid == 0)
+                break;
+            CCoinsCacheEntry &entry = mapCoins[txid];
+            filein >> entry.coins;
+            entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+            utxoStatsLoaded.AddCoins(txid, entry.coins);
+            if (mapCoins.size() >= 10000) {
+                LOCK(cs_main);
+                pcoinsTip->BatchWrite(mapCoins, hashSnapshotLoading);
+                if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
+                    return false;
+            }
+        }
+
+        LOCK(cs_main);
+        // The base block's nChainTx cannot be computed without its ancestors'
+        // data, so store it for LoadBlockIndexDB before the chainstate refers to it.
+        if (!pblocktree->WriteSnapshotBase(pindexBase->GetBlockHash(), header.nChainTx))
+            return state.Abort("Failed to write to block index");
+        pindexBase->nChainTx = header.nChainTx;
+        pindexBase->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        setDirtyBlockIndex.insert(pindexBase);
+        pcoinsTip->BatchWrite(mapCoins, pindexBase->GetBlockHash());
+        utxoStatsLoaded.hashBlock = pindexBase->GetBlockHash();
+        utxoStats.swap(utxoStatsLoaded);
+    } catch (const std::exception &e) {
+        return state.Abort(std::string("System error while loading UTXO snapshot: ") + e.what());
+    }
+    return true;
+}
+
+bool LoadCoinsSnapshot(CValidationState &state, const boost::filesystem::path &path, const uint256 &hashExpected, CCoinsStats &stats)
+{
+    // First read the whole file, to check it before touching the chainstate.
+    // This takes a while, so cs_main is only held to look up the base block.
+    CCoinsSnapshotHeader header;
+    CBlockIndex *pindexBase = NULL;
+    {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return state.Error(strprintf("cannot open %s", path.string()));
+        try {
+            filein >> header;
+            if (memcmp(header.pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0)
+                return state.Error("UTXO snapshot is for a different network");
+            if (header.nVersion != CCoinsSnapshotHeader::CURRENT_VERSION)
+                return state.Error(strprintf("unsupported UTXO snapshot version %d", header.nVersion));
+            {
+                LOCK(cs_main);
+                if (!CheckCoinsSnapshotBase(state, header, pindexBase))
+                    return false;
+            }
+            if (!ReadCoinsSnapshotStats(filein, header, stats))
+                return state.Error("UTXO snapshot is corrupt");
+        } catch (const std::exception &e) {
+            return state.Error(strprintf("error reading UTXO snapshot: %s", e.what()));
+        }
+    }
+    if (stats.hashSerialized != hashExpected)
+        return state.Error(strprintf("UTXO snapshot hash %s does not match the expected %s", stats.hashSerialized.ToString(), hashExpected.ToString()));
+
+    {
+        // The chainstate may have moved on while the file was checked.
+        LOCK(cs_main);
+        if (!CheckCoinsSnapshotBase(state, header, pindexBase))
+            return false;
+        // Keep ActivateBestChain off the chainstate until it is complete.
+        fSnapshotLoading = true;
+    }
 
+    LogPrintf("Loading UTXO snapshot at height %d (%u transactions)\n", header.nHeight, (unsigned int)stats.nTransactions);
+    bool fLoaded = ReadCoinsSnapshot(state, path, pindexBase);
+
+    LOCK(cs_main);
+    fSnapshotLoading = false;
+    if (!fLoaded)
+        return false;
+    pindexSnapshot = pindexBase;
+    mempool.clear();
+    UpdateTip(pindexBase);
+    setBlockIndexCandidates.insert(pindexBase);
+    PruneBlockIndexCandidates();
+    // We cannot serve the blocks before the snapshot.
+    nLocalServices &= ~NODE_NETWORK;
+    return FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
+}
+
+/** The context-free checks CBlockImporter runs ahead of connecting a block */
+static bool CheckImportedBlock(const CBlock& block, uint256& hashPoW)
+{
+    CValidationState state;
+    hashPoW = block.GetPoWHash();
+    return CheckBlock(block, state, true, true, &hashPoW);
+}
 
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+    // Map of disk positions for blocks with unknown parent (only used for reindex),
+    // with their PoW hash if they passed the checks, so it need not be computed again
+    static std::multimap<uint256, std::pair<CDiskBlockPos, uint256> > mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
     int nLoaded = 0;
     try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        CBlockImporter importer(fileIn, dbp, nScriptCheckThreads, CheckImportedBlock);
+        while (true) {
             boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(Params().MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
-                    continue;
-            } catch (const std::exception &) {
-                // no valid block header found; don't complain
+            boost::scoped_ptr<CImportedBlock> pimport(importer.Next());
+            if (!pimport)
                 break;
-            }
+            CBlock& block = pimport->block;
+            CDiskBlockPos* pos = dbp ? &pimport->pos : NULL;
             try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
                 // detect out of order blocks, and store them for later
                 uint256 hash = block.GetHash();
                 if (hash != Params().HashGenesisBlock() && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
                     LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
                             block.hashPrevBlock.ToString());
                     if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, std::make_pair(*pos, pimport->fChecked ? pimport->hashPoW : uint256(0))));
                     continue;
                 }
 
                 // process in case the block isn't known yet
                 if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
                     CValidationState state;
-                    if (ProcessNewBlock(state, NULL, &block, dbp))
+                    if (ProcessNewBlock(state, NULL, &block, pos, pimport->fChecked ? &pimport->hashPoW : NULL))
                         nLoaded++;
                     if (state.IsError())
                         break;
@@ -3241,15 +4037,16 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
                 while (!queue.empty()) {
                     uint256 head = queue.front();
                     queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+                    std::pair<std::multimap<uint256, std::pair<CDiskBlockPos, uint256> >::iterator, std::multimap<uint256, std::pair<CDiskBlockPos, uint256> >::iterator> range = mapBlocksUnknownParent.equal_range(head);
                     while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second))
+                        std::multimap<uint256, std::pair<CDiskBlockPos, uint256> >::iterator it = range.first;
+                        const uint256& hashPoW = it->second.second;
+                        if (ReadBlockFromDisk(block, it->second.first, hashPoW != 0 ? &hashPoW : NULL))
                         {
                             LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
                                     head.ToString());
                             CValidationState dummy;
-                            if (ProcessNewBlock(dummy, NULL, &block, &it->second))
+                            if (ProcessNewBlock(dummy, NULL, &block, &it->second.first, hashPoW != 0 ? &hashPoW : NULL))
                             {
                                 nLoaded++;
                                 queue.push_back(block.GetHash());
@@ -3287,6 +4084,11 @@ void static CheckBlockIndex()
         return;
     }
 
+    // The invariants below assume that all blocks in the active chain have data.
+    if (pindexSnapshot != NULL || fHavePruned) {
+        return;
+    }
+
     // Build forward-pointing map of the entire block tree.
     std::multimap<CBlockIndex*,CBlockIndex*> forward;
     for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); it++) {
@@ -3534,12 +4336,13 @@ void static ProcessGetData(CNode* pfrom)
                 if (mi != mapBlockIndex.end())
                 {
                     if (chainActive.Contains(mi->second)) {
-                        send = true;
+                        // Blocks below a UTXO snapshot, or pruned ones, are in the active chain without having data.
+                        send = (mi->second->nStatus & BLOCK_HAVE_DATA);
                     } else {
                         // To prevent fingerprinting attacks, only send blocks outside of the active
                         // chain if they are valid, and no more than a month older than the best header
                         // chain we know about.
-                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
+                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (mi->second->nStatus & BLOCK_HAVE_DATA) && (pindexBestHeader != NULL) &&
                             (mi->second->GetBlockTime() > pindexBestHeader->GetBlockTime() - 30 * 24 * 60 * 60);
                         if (!send) {
                             LogPrintf("ProcessGetData(): ignoring request from peer=%i for old block that isn't in the main chain\n", pfrom->GetId());
@@ -3548,14 +4351,20 @@ void static ProcessGetData(CNode* pfrom)
                 }
                 if (send)
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
                     if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                    {
+                        // Send block from disk, copying it as stored
+                        CBlockFileRecord record;
+                        if (!ReadRawBlockFromDisk(record, (*mi).second))
+                            assert(!"cannot load block from disk");
+                        pfrom->PushMessage("block", CFlatData((void*)record.begin(), (void*)record.end()));
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            assert(!"cannot load block from disk");
+                        GetCachedMerkleTree(block);
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter)
                         {
@@ -4155,6 +4964,37 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Do the cheap checks first: the headers must form a chain...
+        for (unsigned int n = 1; n < nCount; n++) {
+            if (headers[n].hashPrevBlock != headers[n - 1].GetHash()) {
+                Misbehaving(pfrom->GetId(), 20);
+                return error("non-continuous headers sequence");
+            }
+        }
+
+        // ...and the first header we do not know yet must connect to a valid
+        // one. Only then scrypt-hash the rest of the batch, in parallel and
+        // before taking cs_main for the actual acceptance.
+        size_t nFirstNew = 0;
+        {
+            LOCK(cs_main);
+            while (nFirstNew < headers.size() && mapBlockIndex.count(headers[nFirstNew].GetHash()))
+                nFirstNew++;
+            if (nFirstNew < headers.size()) {
+                BlockMap::iterator mi = mapBlockIndex.find(headers[nFirstNew].hashPrevBlock);
+                if (mi == mapBlockIndex.end()) {
+                    Misbehaving(pfrom->GetId(), 10);
+                    return error("headers do not connect to a known block");
+                }
+                if (mi->second->nStatus & BLOCK_FAILED_MASK) {
+                    Misbehaving(pfrom->GetId(), 100);
+                    return error("headers connect to an invalid block");
+                }
+            }
+        }
+        std::vector<uint256> vPoWHashes;
+        size_t nHashed = GetHeaderPoWHashes(headers, nFirstNew, vPoWHashes);
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -4163,13 +5003,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
 
         CBlockIndex *pindexLast = NULL;
-        BOOST_FOREACH(const CBlockHeader& header, headers) {
+        for (unsigned int n = 0; n < nCount; n++) {
+            const CBlockHeader& header = headers[n];
             CValidationState state;
             if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, &pindexLast)) {
+            if (!AcceptBlockHeader(header, state, &pindexLast, n >= nFirstNew && n < nHashed ? &vPoWHashes[n] : NULL)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -4844,13 +5685,12 @@ bool CBlockUndo::WriteToDisk(CDiskBlockPos &pos, const uint256 &hashBlock)
 
 bool CBlockUndo::ReadFromDisk(const CDiskBlockPos &pos, const uint256 &hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("CBlockUndo::ReadFromDisk : OpenBlockFile failed");
-
-    // Read block
+    // Read undo data and the checksum following it
     uint256 hashChecksum;
+    CBlockFileRecord record;
+    if (!blockFileReader.Read(pos, "rev", record, hashChecksum.size()))
+        return error("CBlockUndo::ReadFromDisk : reading undo file failed");
+    CMemoryReader filein(record.begin(), record.end(), SER_DISK, CLIENT_VERSION);
     try {
         filein >> *this;
         filein >> hashChecksum;
@@ -4881,10 +5721,8 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
 
         // orphan transactions
         mapOrphanTransactions.clear();
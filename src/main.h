@@ -38,8 +38,12 @@
 
 #include <boost/unordered_map.hpp>
 
+class CBlockFileRecord;
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewDB;
+class CCoinsViewPrefetch;
+class CCoinsViewWriteBehind;
 class CBloomFilter;
 class CInv;
 class CScriptCheck;
@@ -78,6 +82,10 @@ static const int COINBASE_MATURITY = 100;
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of threads reading block inputs ahead of validation */
+static const int MAX_PREFETCH_THREADS = 64;
+/** -prefetch default (number of block input prefetching threads) */
+static const int DEFAULT_PREFETCH_THREADS = 4;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -94,6 +102,8 @@ static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
+/** Number of recently connected blocks whose merkle trees are kept in memory. */
+static const unsigned int MAX_RECENT_MERKLE_TREES = 16;
 
 /** Florincoin: Dust Threshold: outputs below this value in satoshis are assessed an additional 1000 bytes per txout */
 static const CAmount DUST_THRESHOLD = 100000; // 0.001 FLO
@@ -132,12 +142,23 @@ extern CConditionVariable cvBlockChange;
 extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
-extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
+/** Block whose ancestors are assumed to have valid scripts, or 0 to check all of them (-assumevalid) */
+extern uint256 hashAssumeValid;
+/** True if any block files have ever been pruned. */
+extern bool fHavePruned;
+/** True if we're running in -prune mode. */
+extern bool fPruneMode;
+/** Number of MiB of block files that we're trying to stay below. */
+extern uint64_t nPruneTarget;
+/** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
+static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
+/** Smallest -prune target: room for MIN_BLOCKS_TO_KEEP blocks, their undo data and preallocated file chunks. */
+static const uint64_t MIN_DISK_SPACE_FOR_BLOCK_FILES = 550 * 1024 * 1024;
 
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex *pindexBestHeader;
@@ -168,9 +189,10 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals);
  * @param[in]   pfrom   The node which we are receiving the block from; it is added to mapBlockSource and may be penalised if the block is invalid.
  * @param[in]   pblock  The block we want to process.
  * @param[out]  dbp     If pblock is stored to disk (or already there), this will be set to its location.
+ * @param[in]   phashPoW If given, pblock has already passed CheckBlock with this PoW hash, which is not computed again.
  * @return True if state.IsValid()
  */
-bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp = NULL);
+bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp = NULL, const uint256* phashPoW = NULL);
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
 /** Open a block file (blk?????.dat) */
@@ -187,6 +209,12 @@ bool InitBlockIndex();
 bool LoadBlockIndex();
 /** Unload database information */
 void UnloadBlockIndex();
+/**
+ * Replace an empty chainstate by the UTXO snapshot in the given file (see
+ * dumptxoutset), after checking that its hash matches hashExpected. The
+ * snapshot's base block becomes the tip; the blocks before it are not validated.
+ */
+bool LoadCoinsSnapshot(CValidationState &state, const boost::filesystem::path &path, const uint256 &hashExpected, CCoinsStats &stats);
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom);
 /**
@@ -198,6 +226,16 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the script checking thread used for mempool acceptance */
+void ThreadMempoolScriptCheck();
+/** Run the thread writing flushed chain state to disk in the background */
+void ThreadFlushState();
+/** Run an instance of the thread reading block inputs ahead of validation */
+void ThreadCoinsPrefetch();
+/** Run an instance of the PoW hashing thread used to pre-verify headers messages */
+void ThreadPoWHashCheck();
+/** Recompute and check the stored PoW hash of every block index entry, filling in missing ones */
+void ThreadVerifyBlockIndexPoW();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core */
@@ -218,6 +256,8 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Prune block files and flush state to disk. */
+void PruneAndFlush();
 
 
 /** (try to) add transaction to memory pool **/
@@ -299,13 +339,15 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
- * instead of being performed inline.
+ * instead of being performed inline. pctx, if given, must outlive those checks; inline checks of
+ * transactions with several inputs get a context of their own.
  */
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
-                 unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks = NULL);
+                 unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks = NULL,
+                 const CSignatureHashContext *pctx = NULL);
 
-/** Apply the effects of this transaction on the UTXO set represented by view */
-void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, CTxUndo &txundo, int nHeight);
+/** Apply the effects of this transaction on the UTXO set represented by view, and on pstats if given */
+void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, CTxUndo &txundo, int nHeight, CUtxoStats *pstats = NULL);
 
 /** Context-independent validity checks */
 bool CheckTransaction(const CTransaction& tx, CValidationState& state);
@@ -345,15 +387,16 @@ private:
     CScript scriptPubKey;
     const CTransaction *ptxTo;
     unsigned int nIn;
+    const CSignatureHashContext *pctx;
     unsigned int nFlags;
     bool cacheStore;
     ScriptError error;
 
 public:
-    CScriptCheck(): ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) :
+    CScriptCheck(): ptxTo(0), nIn(0), pctx(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
+    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, const CSignatureHashContext* pctxIn = NULL) :
         scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) { }
+        ptxTo(&txToIn), nIn(nInIn), pctx(pctxIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) { }
 
     bool operator()();
 
@@ -361,6 +404,7 @@ public:
         scriptPubKey.swap(check.scriptPubKey);
         std::swap(ptxTo, check.ptxTo);
         std::swap(nIn, check.nIn);
+        std::swap(pctx, check.pctx);
         std::swap(nFlags, check.nFlags);
         std::swap(cacheStore, check.cacheStore);
         std::swap(error, check.error);
@@ -372,8 +416,19 @@ public:
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
+/** Read a block, checking its proof of work against phashPoW if its PoW hash is already known */
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const uint256* phashPoW = NULL);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/**
+ * Read a block as it is stored, for passing it on without deserializing it. The
+ * stored serialization is the same as the network one. Only the header is
+ * checked: it must match pindex.
+ */
+bool ReadRawBlockFromDisk(CBlockFileRecord& record, const CBlockIndex* pindex);
+/** Remember the merkle tree of a block that was just connected to the active chain */
+void CacheMerkleTree(const CBlock& block, const uint256& hash);
+/** Fill in block.vMerkleTree from the trees of recently connected blocks, if present */
+bool GetCachedMerkleTree(const CBlock& block);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -381,15 +436,22 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+ *  of problems. Note that in any case, coins may be modified. If pstats is given, it is
+ *  updated along with coins. */
+bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL, CUtxoStats* pstats = NULL);
+
+/** Undo the effects of a block at the given height on the UTXO set represented by view, and on pstats if
+ *  given, using its undo data. Returns false if the two do not match; problems with the coins found on the
+ *  way clear fClean. The best block of view is left unchanged. */
+bool ApplyBlockUndo(const CBlock& block, const CBlockUndo& blockUndo, int nHeight, CCoinsViewCache& view, bool& fClean, CUtxoStats* pstats = NULL);
 
-/** Apply the effects of this block (with given index) on the UTXO set represented by coins */
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false);
+/** Apply the effects of this block (with given index) on the UTXO set represented by coins, and on pstats if given */
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false, CUtxoStats* pstats = NULL);
 
 /** Context-independent validity checks */
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+/** If phashPoW is given, it is used as the block's precomputed scrypt hash instead of hashing again */
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true, const uint256* phashPoW = NULL);
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true, const uint256* phashPoW = NULL);
 
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex *pindexPrev);
@@ -398,9 +460,12 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex *pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
-/** Store block on disk. If dbp is provided, the file is known to already reside on disk */
-bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex **pindex, CDiskBlockPos* dbp = NULL);
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL);
+/**
+ * Store block, which must have passed CheckBlock, on disk. If dbp is provided, the file is known
+ * to already reside on disk. If phashPoW is provided, it is the block's PoW hash.
+ */
+bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex **pindex, CDiskBlockPos* dbp = NULL, const uint256* phashPoW = NULL);
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL, const uint256* phashPoW = NULL);
 
 
 
@@ -541,9 +606,21 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex);
 /** The currently-connected chain of blocks. */
 extern CChain chainActive;
 
+/** Global variable that points to the coin database at the bottom of the pcoinsTip view stack */
+extern CCoinsViewDB *pcoinsdbview;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Statistics about the UTXO set at the tip of chainActive (protected by cs_main) */
+extern CUtxoStats utxoStats;
+
+/** Global variable that points to the view pcoinsTip flushes into, which writes to disk in the background */
+extern CCoinsViewWriteBehind *pcoinsWriteBehind;
+
+/** Global variable that points to the view pcoinsWriteBehind reads through, which prefetches block inputs (may be NULL) */
+extern CCoinsViewPrefetch *pcoinsPrefetch;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
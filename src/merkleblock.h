@@ -67,11 +67,11 @@ protected:
         return (nTransactions+(1 << height)-1) >> height;
     }
 
-    /** calculate the hash of a node in the merkle tree (at leaf level: the txid's themselves) */
-    uint256 CalcHash(int height, unsigned int pos, const std::vector<uint256> &vTxid);
+    /** look up the hash of a node in the full merkle tree vTree (at leaf level: the txid's themselves) */
+    uint256 CalcHash(int height, unsigned int pos, const std::vector<uint256> &vTree);
 
     /** recursive function that traverses tree nodes, storing the data as bits and hashes */
-    void TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch);
+    void TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTree, const std::vector<bool> &vMatch);
 
     /**
      * recursive function that traverses tree nodes, consuming the bits and hashes produced by TraverseAndBuild.
@@ -104,8 +104,11 @@ public:
         }
     }
 
-    /** Construct a partial merkle tree from a list of transaction id's, and a mask that selects a subset of them */
-    CPartialMerkleTree(const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch);
+    /**
+     * Construct a partial merkle tree from a list of transaction id's, and a mask that selects a subset of them.
+     * pvTree may point to their full tree as built by ComputeMerkleTree, to avoid hashing it again.
+     */
+    CPartialMerkleTree(const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch, const std::vector<uint256> *pvTree = NULL);
 
     CPartialMerkleTree();
 
@@ -417,6 +417,9 @@ void static BitcoinMiner(CWallet *pwallet)
     CReserveKey reservekey(pwallet);
     unsigned int nExtraNonce = 0;
 
+    // Scratchpad for the multi-lane scrypt kernel, reused for every batch of nonces
+    std::vector<char> vScratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+
     try {
         while (true) {
             if (Params().MiningRequiresPeers()) {
@@ -457,19 +460,28 @@ void static BitcoinMiner(CWallet *pwallet)
             //
             int64_t nStart = GetTime();
             uint256 hashTarget = uint256().SetCompact(pblock->nBits);
-            uint256 thash;
             while (true) {
                 unsigned int nHashesDone = 0;
-                char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+                // Everything but the nonce is fixed for this run, so hash from a midstate
+                scrypt_midstate midstate;
+                scrypt_1024_1_1_256_midstate(BEGIN(pblock->nVersion), &midstate);
                 while(true)
                 {
-                    scrypt_1024_1_1_256_sp(BEGIN(pblock->nVersion), BEGIN(thash), scratchpad);
-                    if (thash <= hashTarget)
+                    uint256 hashes[SCRYPT_MAX_WAYS];
+                    scrypt_1024_1_1_256_sp_nonces(BEGIN(pblock->nVersion), &midstate, pblock->nNonce, SCRYPT_MAX_WAYS, BEGIN(hashes[0]), &vScratchpad[0]);
+                    int nFound = -1;
+                    for (int i = 0; i < SCRYPT_MAX_WAYS && nFound < 0; i++) {
+                        if (hashes[i] <= hashTarget)
+                            nFound = i;
+                    }
+                    if (nFound >= 0)
                     {
                         // Found a solution
+                        pblock->nNonce += nFound;
+                        nHashesDone += nFound + 1;
                         SetThreadPriority(THREAD_PRIORITY_NORMAL);
                         LogPrintf("FlorincoinMiner:\n");
-                        LogPrintf("proof-of-work found  \n  powhash: %s  \ntarget: %s\n", thash.GetHex(), hashTarget.GetHex());
+                        LogPrintf("proof-of-work found  \n  powhash: %s  \ntarget: %s\n", hashes[nFound].GetHex(), hashTarget.GetHex());
                         ProcessBlockFound(pblock, *pwallet, reservekey);
                         SetThreadPriority(THREAD_PRIORITY_LOWEST);
 
@@ -479,8 +491,8 @@ void static BitcoinMiner(CWallet *pwallet)
 
                         break;
                     }
-                    pblock->nNonce += 1;
-                    nHashesDone += 1;
+                    pblock->nNonce += SCRYPT_MAX_WAYS;
+                    nHashesDone += SCRYPT_MAX_WAYS;
                     if ((pblock->nNonce & 0xFF) == 0)
                         break;
                 }
@@ -0,0 +1,166 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "muhash.h"
+
+#include "crypto/sha256.h"
+#include "crypto/sha512.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+#include <ios>
+#include <stdexcept>
+
+#include <openssl/bn.h>
+
+namespace {
+
+void Check(bool fOk)
+{
+    if (!fOk)
+        throw std::runtime_error("CMuHash3072 : OpenSSL bignum operation failed");
+}
+
+BIGNUM* NewBN()
+{
+    BIGNUM *bn = BN_new();
+    Check(bn != NULL);
+    return bn;
+}
+
+BIGNUM* NewModulus()
+{
+    BIGNUM *bn = NewBN();
+    Check(BN_set_bit(bn, 3072) && BN_sub_word(bn, 1103717));
+    return bn;
+}
+
+/** The modulus 2^3072 - 1103717, the largest 3072-bit safe prime. */
+const BIGNUM* GetModulus()
+{
+    static const BIGNUM *modulus = NewModulus();
+    return modulus;
+}
+
+BN_MONT_CTX* NewMontgomery()
+{
+    BN_MONT_CTX *mont = BN_MONT_CTX_new();
+    BN_CTX *ctx = BN_CTX_new();
+    bool fOk = mont != NULL && ctx != NULL && BN_MONT_CTX_set(mont, GetModulus(), ctx);
+    BN_CTX_free(ctx);
+    Check(fOk);
+    return mont;
+}
+
+BN_MONT_CTX* GetMontgomery()
+{
+    static BN_MONT_CTX *mont = NewMontgomery();
+    return mont;
+}
+
+/** Big-endian, zero-padded to CMuHash3072::BYTES. */
+void BNToBytes(const BIGNUM *bn, unsigned char *data)
+{
+    int nBytes = BN_num_bytes(bn);
+    assert(nBytes <= (int)CMuHash3072::BYTES);
+    memset(data, 0, CMuHash3072::BYTES - nBytes);
+    BN_bn2bin(bn, data + CMuHash3072::BYTES - nBytes);
+}
+
+}
+
+CMuHash3072::CMuHash3072() : numerator(NewBN()), denominator(NewBN()), ctx(BN_CTX_new())
+{
+    Check(ctx != NULL && BN_one(numerator) && BN_one(denominator));
+}
+
+CMuHash3072::CMuHash3072(const CMuHash3072& other) : numerator(NewBN()), denominator(NewBN()), ctx(BN_CTX_new())
+{
+    Check(ctx != NULL && BN_copy(numerator, other.numerator) && BN_copy(denominator, other.denominator));
+}
+
+CMuHash3072& CMuHash3072::operator=(const CMuHash3072& other)
+{
+    Check(BN_copy(numerator, other.numerator) && BN_copy(denominator, other.denominator));
+    return *this;
+}
+
+CMuHash3072::~CMuHash3072()
+{
+    BN_free(numerator);
+    BN_free(denominator);
+    BN_CTX_free(ctx);
+}
+
+void CMuHash3072::Multiply(BIGNUM *r, const uint256& hash)
+{
+    // Expand the hash to 3072 bits, which are below the modulus except with
+    // negligible probability.
+    unsigned char data[BYTES];
+    for (unsigned char i = 0; i < BYTES / CSHA512::OUTPUT_SIZE; i++)
+        CSHA512().Write(hash.begin(), hash.size()).Write(&i, 1).Finalize(data + i * CSHA512::OUTPUT_SIZE);
+    BN_CTX_start(ctx);
+    BIGNUM *x = BN_CTX_get(ctx);
+    bool fOk = x != NULL && BN_bin2bn(data, BYTES, x) &&
+               (BN_cmp(x, GetModulus()) < 0 || BN_sub(x, x, GetModulus()));
+    // A Montgomery multiplication (three times faster than BN_mod_mul) also
+    // divides by 2^3072 mod p. That is just part of mapping the element to
+    // a number: it is the same for every element, added or removed.
+    fOk = fOk && BN_mod_mul_montgomery(r, r, x, GetMontgomery(), ctx);
+    BN_CTX_end(ctx);
+    Check(fOk);
+}
+
+void CMuHash3072::Insert(const uint256& hash)
+{
+    Multiply(numerator, hash);
+}
+
+void CMuHash3072::Remove(const uint256& hash)
+{
+    Multiply(denominator, hash);
+}
+
+uint256 CMuHash3072::GetHash() const
+{
+    // Not ctx: that belongs to whoever updates this object, while a const
+    // method may be called from other threads (on a copy taken under a lock).
+    BN_CTX *ctxHash = BN_CTX_new();
+    BIGNUM *r = ctxHash != NULL ? BN_new() : NULL;
+    bool fOk = r != NULL && BN_mod_inverse(r, denominator, GetModulus(), ctxHash) &&
+               BN_mod_mul(r, r, numerator, GetModulus(), ctxHash);
+    unsigned char data[BYTES];
+    if (fOk)
+        BNToBytes(r, data);
+    BN_free(r);
+    BN_CTX_free(ctxHash);
+    Check(fOk);
+
+    uint256 hash;
+    CSHA256().Write(data, BYTES).Finalize(hash.begin());
+    return hash;
+}
+
+void CMuHash3072::swap(CMuHash3072& other)
+{
+    std::swap(numerator, other.numerator);
+    std::swap(denominator, other.denominator);
+    std::swap(ctx, other.ctx);
+}
+
+void CMuHash3072::ToBytes(unsigned char data[2 * BYTES]) const
+{
+    BNToBytes(numerator, data);
+    BNToBytes(denominator, data + BYTES);
+}
+
+void CMuHash3072::FromBytes(const unsigned char data[2 * BYTES])
+{
+    Check(BN_bin2bn(data, BYTES, numerator) && BN_bin2bn(data + BYTES, BYTES, denominator));
+    if (BN_is_zero(numerator) || BN_is_zero(denominator) ||
+        BN_cmp(numerator, GetModulus()) >= 0 || BN_cmp(denominator, GetModulus()) >= 0)
+        throw std::ios_base::failure("CMuHash3072 : invalid state");
+}
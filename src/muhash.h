@@ -0,0 +1,68 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MUHASH_H
+#define BITCOIN_MUHASH_H
+
+#include "uint256.h"
+
+#include <stddef.h>
+
+struct bignum_st;
+struct bignum_ctx;
+
+/**
+ * A hash of a multiset that does not depend on the order of its elements and
+ * can be updated as elements are added or removed, without access to the rest
+ * of the set ("MuHash"). Every element, given as a 256-bit hash, is expanded
+ * to a number modulo the prime 2^3072 - 1103717. The state is the product of
+ * the numbers of all added elements, over the product of those removed.
+ */
+class CMuHash3072
+{
+public:
+    static const size_t BYTES = 384;
+
+    CMuHash3072();
+    CMuHash3072(const CMuHash3072& other);
+    CMuHash3072& operator=(const CMuHash3072& other);
+    ~CMuHash3072();
+
+    void Insert(const uint256& hash);
+    void Remove(const uint256& hash);
+    //! Hash of the current multiset; the empty set hashes like any other. Safe to
+    //! call concurrently with other const methods.
+    uint256 GetHash() const;
+
+    void swap(CMuHash3072& other);
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return 2 * BYTES;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        unsigned char data[2 * BYTES];
+        ToBytes(data);
+        s.write((const char*)data, sizeof(data));
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        unsigned char data[2 * BYTES];
+        s.read((char*)data, sizeof(data));
+        FromBytes(data);
+    }
+
+private:
+    bignum_st *numerator;
+    bignum_st *denominator;
+    bignum_ctx *ctx;
+
+    void Multiply(bignum_st *r, const uint256& hash);
+    void ToBytes(unsigned char data[2 * BYTES]) const;
+    void FromBytes(const unsigned char data[2 * BYTES]);
+};
+
+#endif // BITCOIN_MUHASH_H
@@ -0,0 +1,175 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ORDEREDQUEUE_H
+#define BITCOIN_ORDEREDQUEUE_H
+
+#include "util.h"
+
+#include <deque>
+#include <string>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+/**
+ * Queue of work items that are processed in parallel by a pool of worker
+ * threads, and handed back in the order they were pushed. Items are of a
+ * type T with a bool fDone member, which is set once the process function
+ * has run on them.
+ *
+ * The consumer that pops items helps processing while the oldest item is
+ * not done yet, so that without workers it does all the processing itself.
+ */
+template <typename T>
+class COrderedWorkQueue
+{
+public:
+    typedef boost::function<void (T&)> ProcessFunc;
+
+private:
+    //! Mutex to protect the inner state
+    boost::mutex mutex;
+
+    //! Workers, producers waiting for room and consumers waiting for items block on this
+    boost::condition_variable cond;
+
+    //! All items pushed and not popped yet, in push order
+    std::deque<T*> queue;
+
+    //! The items in queue that no thread has picked up yet
+    std::deque<T*> queueToProcess;
+
+    //! No more items will be pushed
+    bool fClosed;
+
+    //! Stop processing, and fail any push
+    bool fStop;
+
+    ProcessFunc process;
+    std::string strThreadName;
+    boost::thread_group threads;
+
+    //! Process one item picked up under lock, which is released meanwhile
+    void ProcessOne(boost::unique_lock<boost::mutex>& lock)
+    {
+        T* pitem = queueToProcess.front();
+        queueToProcess.pop_front();
+        lock.unlock();
+        process(*pitem);
+        lock.lock();
+        pitem->fDone = true;
+        cond.notify_all();
+    }
+
+    void Thread()
+    {
+        if (!strThreadName.empty())
+            RenameThread(strThreadName.c_str());
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (true) {
+            while (queueToProcess.empty() && !fClosed && !fStop)
+                cond.wait(lock);
+            if (queueToProcess.empty() || fStop)
+                return;
+            ProcessOne(lock);
+        }
+    }
+
+public:
+    //! Start nWorkers threads (named strThreadNameIn, if given) running processIn on the items pushed
+    COrderedWorkQueue(int nWorkers, ProcessFunc processIn, const std::string& strThreadNameIn = "") :
+        fClosed(false), fStop(false), process(processIn), strThreadName(strThreadNameIn)
+    {
+        for (int i = 0; i < nWorkers; i++)
+            threads.create_thread(boost::bind(&COrderedWorkQueue::Thread, this));
+    }
+
+    //! Stop the workers, and drop the items not popped
+    ~COrderedWorkQueue()
+    {
+        Stop();
+        threads.join_all();
+        BOOST_FOREACH(T* pitem, queue)
+            delete pitem;
+    }
+
+    //! Make pending and future pushes fail, and the workers return
+    void Stop()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        cond.notify_all();
+    }
+
+    //! Signal that nothing more will be pushed, so that Pop returns NULL once the queue is empty
+    void Close()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fClosed = true;
+        }
+        cond.notify_all();
+    }
+
+    size_t size()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return queue.size();
+    }
+
+    /**
+     * Queue pitem, taking ownership. If nMaxQueued is nonzero, first wait
+     * until fewer items than that are queued. Returns false (and deletes
+     * pitem) if the queue was stopped.
+     */
+    bool Push(T* pitem, size_t nMaxQueued = 0)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (nMaxQueued > 0 && queue.size() >= nMaxQueued && !fStop)
+            cond.wait(lock);
+        if (fStop) {
+            delete pitem;
+            return false;
+        }
+        queue.push_back(pitem);
+        queueToProcess.push_back(pitem);
+        cond.notify_all();
+        return true;
+    }
+
+    /**
+     * Return the oldest item once processed (processing items while waiting
+     * for that), or NULL once the queue is closed or stopped, and empty. The
+     * caller takes ownership.
+     */
+    T* Pop()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (true) {
+            if (!queue.empty() && queue.front()->fDone) {
+                T* pitem = queue.front();
+                queue.pop_front();
+                cond.notify_all();
+                return pitem;
+            }
+            if (!queueToProcess.empty()) {
+                ProcessOne(lock);
+                continue;
+            }
+            if (queue.empty() && (fClosed || fStop))
+                return NULL;
+            cond.wait(lock);
+        }
+    }
+};
+
+#endif // BITCOIN_ORDEREDQUEUE_H
@@ -11,6 +11,8 @@
 #include "uint256.h"
 #include "util.h"
 
+#include <limits>
+
 unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock)
 {
     static const int nMinActualTimespan_Version1 = Params().nAveragingTargetTimespan_Version1 * (100 - Params().nMaxAdjustUp_Version1) / 100;
@@ -166,3 +168,22 @@ uint256 GetBlockProof(const CBlockIndex& block)
     // or ~bnTarget / (nTarget+1) + 1.
     return (~bnTarget / (bnTarget + 1)) + 1;
 }
+
+int64_t GetBlockProofEquivalentTime(const CBlockIndex& to, const CBlockIndex& from, const CBlockIndex& tip)
+{
+    uint256 r;
+    int sign = 1;
+    if (to.nChainWork > from.nChainWork) {
+        r = to.nChainWork - from.nChainWork;
+    } else {
+        r = from.nChainWork - to.nChainWork;
+        sign = -1;
+    }
+    uint256 bnTipProof = GetBlockProof(tip);
+    if (bnTipProof == 0)
+        return sign * std::numeric_limits<int64_t>::max();
+    r = r * (uint32_t)Params().TargetSpacing() / bnTipProof;
+    if (r.bits() > 63)
+        return sign * std::numeric_limits<int64_t>::max();
+    return sign * (int64_t)r.GetLow64();
+}
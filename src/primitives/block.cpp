@@ -7,6 +7,7 @@
 
 #include "hash.h"
 #include "crypto/scrypt.h"
+#include "crypto/sha256.h"
 #include "tinyformat.h"
 #include "utilstrencodings.h"
 #include <iostream>
@@ -23,6 +24,16 @@ uint256 CBlockHeader::GetPoWHash() const
     return thash;
 }
 
+void GetPoWHashes(const CBlockHeader* pheaders, size_t nCount, uint256* phashes)
+{
+    if (nCount == 0)
+        return;
+    std::vector<char> vInput(80 * nCount);
+    for (size_t i = 0; i < nCount; i++)
+        memcpy(&vInput[80 * i], BEGIN(pheaders[i].nVersion), 80);
+    scrypt_1024_1_1_256_multi(&vInput[0], BEGIN(phashes[0]), nCount);
+}
+
 uint256 CBlock::BuildMerkleTree(bool* fMutated) const
 {
     /* WARNING! If you're reading this because you're learning about crypto
@@ -64,19 +75,32 @@ uint256 CBlock::BuildMerkleTree(bool* fMutated) const
     vMerkleTree.reserve(vtx.size() * 2 + 16); // Safe upper bound for the number of total nodes.
     for (std::vector<CTransaction>::const_iterator it(vtx.begin()); it != vtx.end(); ++it)
         vMerkleTree.push_back(it->GetHash());
-    int j = 0;
+    return ComputeMerkleTree(vMerkleTree, fMutated);
+}
+
+uint256 ComputeMerkleTree(std::vector<uint256>& vMerkleTree, bool* fMutated)
+{
+    size_t nTotal = vMerkleTree.size();
+    for (size_t nSize = vMerkleTree.size(); nSize > 1; nSize = (nSize + 1) / 2)
+        nTotal += (nSize + 1) / 2;
+
+    size_t j = 0;
     bool mutated = false;
-    for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+    size_t nSize = vMerkleTree.size();
+    vMerkleTree.resize(nTotal);
+    for (; nSize > 1; nSize = (nSize + 1) / 2)
     {
-        for (int i = 0; i < nSize; i += 2)
-        {
-            int i2 = std::min(i+1, nSize-1);
-            if (i2 == i + 1 && i2 + 1 == nSize && vMerkleTree[j+i] == vMerkleTree[j+i2]) {
-                // Two identical hashes at the end of the list at a particular level.
-                mutated = true;
-            }
-            vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                       BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
+        uint256* pLevel = &vMerkleTree[j];
+        uint256* pNext = pLevel + nSize;
+        // The pairs of a level are adjacent 64-byte messages, so hash them all in one batch.
+        SHA256D64(pNext->begin(), pLevel->begin(), nSize / 2);
+        if (nSize & 1) {
+            // An odd last hash is paired with itself.
+            pNext[nSize / 2] = Hash(BEGIN(pLevel[nSize - 1]), END(pLevel[nSize - 1]),
+                                    BEGIN(pLevel[nSize - 1]), END(pLevel[nSize - 1]));
+        } else if (pLevel[nSize - 2] == pLevel[nSize - 1]) {
+            // Two identical hashes at the end of the list at a particular level.
+            mutated = true;
         }
         j += nSize;
     }
@@ -76,6 +76,20 @@ public:
 };
 
 
+/**
+ * Compute the scrypt PoW hashes of nCount headers at once, using the
+ * multi-lane scrypt kernel selected by scrypt_detect_avx2().
+ */
+void GetPoWHashes(const CBlockHeader* pheaders, size_t nCount, uint256* phashes);
+
+/**
+ * Extend vMerkleTree, which must hold just the leaf hashes, with all higher
+ * levels of their merkle tree and return the root. Each level is hashed as one
+ * batch of SHA256D64(). *fMutated is set as in CBlock::BuildMerkleTree.
+ */
+uint256 ComputeMerkleTree(std::vector<uint256>& vMerkleTree, bool* fMutated = NULL);
+
+
 class CBlock : public CBlockHeader
 {
 public:
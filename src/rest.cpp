@@ -5,6 +5,9 @@
 
 #include "primitives/block.h"
 #include "primitives/transaction.h"
+#include "addressindex.h"
+#include "blockreader.h"
+#include "commentindex.h"
 #include "main.h"
 #include "rpcserver.h"
 #include "streams.h"
@@ -12,6 +15,8 @@
 #include "utilstrencodings.h"
 #include "version.h"
 
+#include <limits>
+
 #include <boost/algorithm/string.hpp>
 
 using namespace std;
@@ -43,6 +48,10 @@ public:
 
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry);
 extern Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern Array commentsToJSON(const std::vector<CTxComment>& vComment);
+extern Array addressTxidsToJSON(const std::vector<CAddressDelta>& vDelta);
+extern Object addressBalanceToJSON(CAmount nBalance, CAmount nReceived);
+extern Array addressUtxosToJSON(const std::vector<std::pair<COutPoint, CAddressUnspentValue> >& vUnspent);
 
 static RestErr RESTERR(enum HTTPStatusCode status, string message)
 {
@@ -103,7 +112,9 @@ static bool rest_block(AcceptedConnection* conn,
     if (!ParseHashStr(hashStr, hash))
         throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
+    // The binary and hex formats pass on the block as stored.
     CBlock block;
+    CBlockFileRecord record;
     CBlockIndex* pblockindex = NULL;
     {
         LOCK(cs_main);
@@ -111,22 +122,19 @@ static bool rest_block(AcceptedConnection* conn,
             throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
 
         pblockindex = mapBlockIndex[hash];
-        if (!ReadBlockFromDisk(block, pblockindex))
+        if (rf == RF_JSON ? !ReadBlockFromDisk(block, pblockindex) : !ReadRawBlockFromDisk(record, pblockindex))
             throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-    ssBlock << block;
-
     switch (rf) {
     case RF_BINARY: {
-        string binaryBlock = ssBlock.str();
+        string binaryBlock(record.begin(), record.end());
         conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryBlock.size(), "application/octet-stream") << binaryBlock << std::flush;
         return true;
     }
 
     case RF_HEX: {
-        string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        string strHex = HexStr(record.begin(), record.end()) + "\n";
         conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
         return true;
     }
@@ -214,6 +222,144 @@ static bool rest_tx(AcceptedConnection* conn,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_txcomment(AcceptedConnection* conn,
+                           string& strReq,
+                           map<string, string>& mapHeaders,
+                           bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+    if (rf != RF_JSON)
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: json)");
+    if (!pcommentindex)
+        throw RESTERR(HTTP_NOT_FOUND, "comment index not enabled (use -commentindex)");
+    if (!pcommentindex->IsSynced())
+        throw RESTERR(HTTP_SERVICE_UNAVAILABLE, "comment index still being built");
+
+    string hashStr = params[0];
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    std::vector<CTxComment> vComment(1);
+    if (!pcommentindex->FindComment(hash, vComment[0]))
+        throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
+
+    string strJSON = write_string(commentsToJSON(vComment)[0], false) + "\n";
+    conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+    return true;
+}
+
+// Comments are searched as height/START/END, prefix/HEX-ENCODED-PREFIX or keyword/KEYWORD.
+static bool rest_txcomments(AcceptedConnection* conn,
+                            string& strReq,
+                            map<string, string>& mapHeaders,
+                            bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+    if (rf != RF_JSON)
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: json)");
+    if (!pcommentindex)
+        throw RESTERR(HTTP_NOT_FOUND, "comment index not enabled (use -commentindex)");
+    if (!pcommentindex->IsSynced())
+        throw RESTERR(HTTP_SERVICE_UNAVAILABLE, "comment index still being built");
+
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+    std::vector<CTxComment> vComment;
+    bool fOk = false;
+    if (path.size() == 3 && path[0] == "height") {
+        int32_t nStartHeight, nEndHeight;
+        if (!ParseInt32(path[1], &nStartHeight) || !ParseInt32(path[2], &nEndHeight) || nStartHeight < 0 || nEndHeight < nStartHeight)
+            throw RESTERR(HTTP_BAD_REQUEST, "Invalid block height range: " + path[1] + "/" + path[2]);
+        fOk = pcommentindex->FindByHeight(nStartHeight, nEndHeight, MAX_COMMENT_RESULTS, vComment);
+    } else if (path.size() == 2 && path[0] == "prefix") {
+        if (path[1].empty() || !IsHex(path[1]))
+            throw RESTERR(HTTP_BAD_REQUEST, "Invalid hex-encoded prefix: " + path[1]);
+        vector<unsigned char> vchPrefix = ParseHex(path[1]);
+        fOk = pcommentindex->FindByPrefix(string(vchPrefix.begin(), vchPrefix.end()), 0, MAX_COMMENT_RESULTS, vComment);
+    } else if (path.size() == 2 && path[0] == "keyword") {
+        vector<string> vKeyword = GetCommentKeywords(path[1]);
+        if (vKeyword.size() != 1 || vKeyword[0].size() != path[1].size())
+            throw RESTERR(HTTP_BAD_REQUEST, "Invalid keyword: " + path[1]);
+        fOk = pcommentindex->FindByKeyword(vKeyword[0], 0, MAX_COMMENT_RESULTS, vComment);
+    } else {
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid comment query: " + params[0]);
+    }
+    if (!fOk)
+        throw RESTERR(HTTP_INTERNAL_SERVER_ERROR, "Failed to read the comment index");
+
+    string strJSON = write_string(Value(commentsToJSON(vComment)), false) + "\n";
+    conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+    return true;
+}
+
+// Paging argument n of an address query, or nDefault if it is left out
+static int32_t GetAddressPathArg(const vector<string>& path, size_t n, int32_t nDefault, int32_t nMin, int32_t nMax, const string& strName)
+{
+    if (path.size() <= n)
+        return nDefault;
+    int32_t nValue;
+    if (!ParseInt32(path[n], &nValue) || nValue < nMin || nValue > nMax)
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid " + strName + ": " + path[n]);
+    return nValue;
+}
+
+// Addresses are queried as balance/ADDRESS, txids/ADDRESS[/START-HEIGHT[/SKIP[/COUNT]]]
+// or utxos/ADDRESS[/SKIP[/COUNT]], paged as getaddresstxids and getaddressutxos are.
+static bool rest_address(AcceptedConnection* conn,
+                         string& strReq,
+                         map<string, string>& mapHeaders,
+                         bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+    if (rf != RF_JSON)
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: json)");
+    if (!paddressindex)
+        throw RESTERR(HTTP_NOT_FOUND, "address index not enabled (use -addressindex)");
+    if (!paddressindex->IsSynced())
+        throw RESTERR(HTTP_SERVICE_UNAVAILABLE, "address index still being built");
+
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+    if (path.size() < 2 || path.size() > (path[0] == "txids" ? 5 : path[0] == "utxos" ? 4 : 2))
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid address query: " + params[0]);
+    uint160 hashScript;
+    if (!GetAddressScriptHash(path[1], hashScript))
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid address: " + path[1]);
+
+    Value result;
+    bool fOk = false;
+    if (path[0] == "balance") {
+        CAmount nBalance, nReceived;
+        fOk = paddressindex->GetBalance(hashScript, nBalance, nReceived);
+        result = addressBalanceToJSON(nBalance, nReceived);
+    } else if (path[0] == "txids") {
+        int nStartHeight = GetAddressPathArg(path, 2, 0, 0, std::numeric_limits<int32_t>::max(), "start height");
+        int nSkip = GetAddressPathArg(path, 3, 0, 0, std::numeric_limits<int32_t>::max(), "skip");
+        int nCount = GetAddressPathArg(path, 4, MAX_ADDRESS_RESULTS, 1, MAX_ADDRESS_RESULTS, "count");
+        vector<CAddressDelta> vDelta;
+        fOk = paddressindex->FindDeltas(hashScript, nStartHeight, std::numeric_limits<int>::max(), nSkip, nCount, vDelta);
+        result = addressTxidsToJSON(vDelta);
+    } else if (path[0] == "utxos") {
+        int nSkip = GetAddressPathArg(path, 2, 0, 0, std::numeric_limits<int32_t>::max(), "skip");
+        int nCount = GetAddressPathArg(path, 3, MAX_ADDRESS_RESULTS, 1, MAX_ADDRESS_RESULTS, "count");
+        vector<pair<COutPoint, CAddressUnspentValue> > vUnspent;
+        fOk = paddressindex->FindUnspent(hashScript, nSkip, nCount, vUnspent);
+        result = addressUtxosToJSON(vUnspent);
+    } else {
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid address query: " + params[0]);
+    }
+    if (!fOk)
+        throw RESTERR(HTTP_INTERNAL_SERVER_ERROR, "Failed to read the address index");
+
+    string strJSON = write_string(result, false) + "\n";
+    conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+    return true;
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(AcceptedConnection* conn,
@@ -222,6 +368,9 @@ static const struct {
                     bool fRun);
 } uri_prefixes[] = {
       {"/rest/tx/", rest_tx},
+      {"/rest/txcomment/", rest_txcomment},
+      {"/rest/txcomments/", rest_txcomments},
+      {"/rest/address/", rest_address},
       {"/rest/block/notxdetails/", rest_block_notxdetails},
       {"/rest/block/", rest_block_extended},
 };
@@ -3,14 +3,22 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addressindex.h"
+#include "blockreader.h"
 #include "checkpoints.h"
+#include "commentindex.h"
 #include "main.h"
 #include "rpcserver.h"
 #include "sync.h"
+#include "txdb.h"
 #include "util.h"
 
 #include <stdint.h>
 
+#include <limits>
+
+#include <boost/filesystem.hpp>
+
 #include "json/json_spirit_value.h"
 
 using namespace json_spirit;
@@ -290,58 +298,210 @@ Value getblock(const Array& params, bool fHelp)
     CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
-    if(!ReadBlockFromDisk(block, pblockindex))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
     if (!fVerbose)
     {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
+        CBlockFileRecord record;
+        if (!ReadRawBlockFromDisk(record, pblockindex))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        std::string strHex = HexStr(record.begin(), record.end());
         return strHex;
     }
 
+    if(!ReadBlockFromDisk(block, pblockindex))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
     return blockToJSON(block, pblockindex);
 }
 
 Value gettxoutsetinfo(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( fullscan )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. fullscan    (boolean, optional, default=false) Scan the whole set to compute bytes_serialized\n"
+            "               and hash_serialized, instead of only returning the statistics kept up to date\n"
+            "               as blocks are connected. Note this may take some time.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
-            "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
-            "  \"total_amount\": x.xxx          (numeric) The total amount\n"
+            "  \"total_amount\": x.xxx,  (numeric) The total amount\n"
+            "  \"muhash\": \"hash\",      (string) Hash of the set of unspent outputs, independent of their order\n"
+            "  \"bytes_serialized\": n,  (numeric) The serialized size (fullscan only)\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash (fullscan only)\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "true")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    bool fFullScan = false;
+    if (params.size() > 0)
+        fFullScan = params[0].get_bool();
+
     Object ret;
+    if (!fFullScan) {
+        // Copy the statistics, and hash them without holding up the node.
+        CUtxoStats stats;
+        int nHeight;
+        {
+            LOCK(cs_main);
+            stats = utxoStats;
+            nHeight = chainActive.Height();
+        }
+        ret.push_back(Pair("height", (int64_t)nHeight));
+        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+        ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+        ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        ret.push_back(Pair("muhash", stats.muhash.GetHash().GetHex()));
+        return ret;
+    }
 
+    // The muhash is computed from the same scan, so that it belongs to the
+    // same block even if the chain moves on meanwhile.
     CCoinsStats stats;
+    CUtxoStats utxostats;
     FlushStateToDisk();
-    if (pcoinsTip->GetStats(stats)) {
+    if (pcoinsdbview->GetUtxoStats(utxostats, &stats)) {
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        ret.push_back(Pair("muhash", utxostats.muhash.GetHash().GetHex()));
         ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
         ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
-        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     }
     return ret;
 }
 
+Value dumptxoutset(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrite the unspent transaction output set at the current tip to a file, for loadtxoutset.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"       (string, required) The file to write, relative to the data directory if not absolute. It must not exist yet.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_written\": n,        (numeric) The number of transactions with unspent outputs written\n"
+            "  \"base_hash\": \"hash\",      (string) The hash of the block the set was taken at\n"
+            "  \"base_height\": n,          (numeric) The height of that block\n"
+            "  \"hash_serialized\": \"hash\", (string) The serialized hash, as reported by gettxoutsetinfo\n"
+            "  \"path\": \"path\"            (string) The absolute path of the file written\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path = params[0].get_str();
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    FlushStateToDisk();
+    CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        throw JSONRPCError(RPC_MISC_ERROR, "Cannot open " + path.string() + " for writing");
+
+    // The chain may move on while the coins are written, so the header is
+    // filled in afterwards, from the block the coins database was at.
+    CCoinsSnapshotHeader header;
+    memcpy(header.pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE);
+    CCoinsStats stats;
+    bool fOk = false;
+    try {
+        fileout << header;
+        if (pcoinsdbview->DumpSnapshot(fileout, stats)) {
+            LOCK(cs_main);
+            BlockMap::const_iterator mi = mapBlockIndex.find(stats.hashBlock);
+            if (mi != mapBlockIndex.end() && mi->second->nChainTx > 0) {
+                header.hashBlock = stats.hashBlock;
+                header.nHeight = mi->second->nHeight;
+                header.nChainTx = mi->second->nChainTx;
+                fOk = true;
+            }
+        }
+        if (fOk) {
+            fOk = fseek(fileout.Get(), 0, SEEK_SET) == 0;
+            if (fOk)
+                fileout << header;
+        }
+    } catch (const std::exception &) {
+        fOk = false;
+    }
+    if (!fOk) {
+        fileout.fclose();
+        boost::filesystem::remove(path);
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to write the unspent transaction output set");
+    }
+
+    Object ret;
+    ret.push_back(Pair("coins_written", (int64_t)stats.nTransactions));
+    ret.push_back(Pair("base_hash", header.hashBlock.GetHex()));
+    ret.push_back(Pair("base_height", (int64_t)header.nHeight));
+    ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
+Value loadtxoutset(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "loadtxoutset \"path\" \"hash\"\n"
+            "\nReplace the (empty) chainstate by an unspent transaction output set written by dumptxoutset.\n"
+            "The block it was taken at becomes the tip, and the node continues from there. The blocks\n"
+            "before it are neither downloaded nor validated, now or later, so the node trusts the source of\n"
+            "the hash that the set results from a valid chain. This is only allowed with -allowunvalidatedsnapshot.\n"
+            "The headers up to that block must be known already.\n"
+            "\nArguments:\n"
+            "1. \"path\"       (string, required) The file to read, relative to the data directory if not absolute\n"
+            "2. \"hash\"       (string, required) The expected hash_serialized of the set, as reported by gettxoutsetinfo true\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_loaded\": n,     (numeric) The number of transactions with unspent outputs loaded\n"
+            "  \"tip_hash\": \"hash\",   (string) The hash of the new tip\n"
+            "  \"base_height\": n,      (numeric) The height of the new tip\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\" \"d2fc2a3a47bd2bf0ae7cf1d7b3b6ae9e1c3fc4a7b0b0d0b7c3b9a8d2f1e0c4b5\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\", \"d2fc2a3a47bd2bf0ae7cf1d7b3b6ae9e1c3fc4a7b0b0d0b7c3b9a8d2f1e0c4b5\"")
+        );
+
+    if (!GetBoolArg("-allowunvalidatedsnapshot", false))
+        throw JSONRPCError(RPC_MISC_ERROR, "Loading a snapshot skips validating the blocks before it; restart with -allowunvalidatedsnapshot to allow it");
+
+    boost::filesystem::path path = params[0].get_str();
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+    uint256 hashExpected = ParseHashV(params[1], "hash");
+
+    CValidationState state;
+    CCoinsStats stats;
+    if (!LoadCoinsSnapshot(state, path, hashExpected, stats))
+        throw JSONRPCError(RPC_MISC_ERROR, state.GetRejectReason());
+
+    Object ret;
+    ret.push_back(Pair("coins_loaded", (int64_t)stats.nTransactions));
+    ret.push_back(Pair("tip_hash", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("base_height", (int64_t)stats.nHeight));
+    return ret;
+}
+
 Value gettxout(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -461,6 +621,8 @@ Value getblockchaininfo(const Array& params, bool fHelp)
             "  \"difficulty\": xxxxxx,     (numeric) the current difficulty\n"
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
+            "  \"pruneheight\": xxxxxx,    (numeric) lowest-height complete block stored\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getblockchaininfo", "")
@@ -475,6 +637,15 @@ Value getblockchaininfo(const Array& params, bool fHelp)
     obj.push_back(Pair("difficulty",            (double)GetDifficulty()));
     obj.push_back(Pair("verificationprogress",  Checkpoints::GuessVerificationProgress(chainActive.Tip())));
     obj.push_back(Pair("chainwork",             chainActive.Tip()->nChainWork.GetHex()));
+    obj.push_back(Pair("pruned",                fPruneMode));
+    if (fPruneMode)
+    {
+        CBlockIndex *block = chainActive.Tip();
+        while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
+            block = block->pprev;
+
+        obj.push_back(Pair("pruneheight",        block->nHeight));
+    }
     return obj;
 }
 
@@ -680,3 +851,336 @@ Value reconsiderblock(const Array& params, bool fHelp)
 
     return Value::null;
 }
+
+Array commentsToJSON(const std::vector<CTxComment>& vComment)
+{
+    LOCK(cs_main);
+    // After a reorganization, until the index has caught up, the block at a
+    // comment's height may not be the one the comment came from.
+    bool fSynced = pcommentindex && pcommentindex->IsSynced();
+    Array result;
+    BOOST_FOREACH(const CTxComment& comment, vComment) {
+        Object entry;
+        entry.push_back(Pair("txid", comment.txid.GetHex()));
+        entry.push_back(Pair("height", comment.nHeight));
+        if (fSynced && comment.nHeight <= chainActive.Height())
+            entry.push_back(Pair("blockhash", chainActive[comment.nHeight]->GetBlockHash().GetHex()));
+        entry.push_back(Pair("tx-comment", comment.strComment));
+        result.push_back(entry);
+    }
+    return result;
+}
+
+static void EnsureCommentIndex()
+{
+    if (!pcommentindex)
+        throw JSONRPCError(RPC_MISC_ERROR, "The comment index is not enabled (use -commentindex)");
+    // Until then, searches miss comments and may return those of disconnected blocks.
+    if (!pcommentindex->IsSynced())
+        throw JSONRPCError(RPC_MISC_ERROR, strprintf("The comment index is still being built (at height %d)", pcommentindex->GetBestHeight()));
+}
+
+static unsigned int GetCommentResultsParam(const Array& params, unsigned int nParam)
+{
+    if (params.size() <= nParam)
+        return DEFAULT_COMMENT_RESULTS;
+    int nCount = params[nParam].get_int();
+    if (nCount <= 0 || (unsigned int)nCount > MAX_COMMENT_RESULTS)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("count must be between 1 and %u", MAX_COMMENT_RESULTS));
+    return nCount;
+}
+
+Value gettxcomment(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "gettxcomment \"txid\"\n"
+            "\nReturns the comment of a transaction in the block chain, from the comment index (-commentindex).\n"
+            "\nArguments:\n"
+            "1. \"txid\"      (string, required) The transaction id\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\" : \"txid\",         (string) The transaction id\n"
+            "  \"height\" : n,             (numeric) The height of the block containing the transaction\n"
+            "  \"blockhash\" : \"hash\",    (string) The hash of that block (left out while the index catches up with a reorganization)\n"
+            "  \"tx-comment\" : \"text\"    (string) The comment\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("gettxcomment", "\"mytxid\"")
+            + HelpExampleRpc("gettxcomment", "\"mytxid\"")
+        );
+
+    EnsureCommentIndex();
+    uint256 hash = ParseHashV(params[0], "txid");
+    std::vector<CTxComment> vComment(1);
+    if (!pcommentindex->FindComment(hash, vComment[0]))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No comment found for this transaction");
+    return commentsToJSON(vComment)[0];
+}
+
+Value listtxcomments(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "listtxcomments startheight ( endheight count )\n"
+            "\nReturns the transaction comments in a range of blocks, in block chain order, from the comment index (-commentindex).\n"
+            "\nArguments:\n"
+            "1. startheight   (numeric, required) The height of the first block\n"
+            "2. endheight     (numeric, optional, default=the current height) The height of the last block\n"
+            "3. count         (numeric, optional, default=" + strprintf("%u", DEFAULT_COMMENT_RESULTS) + ") The maximum number of comments to return\n"
+            "\nResult:\n"
+            "[                 (array of json objects, as returned by gettxcomment)\n"
+            "  ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("listtxcomments", "1000000 1001000")
+            + HelpExampleRpc("listtxcomments", "1000000, 1001000")
+        );
+
+    EnsureCommentIndex();
+    int nStartHeight = params[0].get_int();
+    int nEndHeight = std::numeric_limits<int>::max();
+    if (params.size() > 1)
+        nEndHeight = params[1].get_int();
+    if (nStartHeight < 0 || nEndHeight < nStartHeight)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height range");
+    unsigned int nCount = GetCommentResultsParam(params, 2);
+
+    std::vector<CTxComment> vComment;
+    if (!pcommentindex->FindByHeight(nStartHeight, nEndHeight, nCount, vComment))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the comment index");
+    return commentsToJSON(vComment);
+}
+
+Value searchtxcomments(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 4)
+        throw runtime_error(
+            "searchtxcomments \"text\" ( \"type\" count startheight )\n"
+            "\nSearches the transaction comments of the block chain, using the comment index (-commentindex).\n"
+            "\nArguments:\n"
+            "1. \"text\"        (string, required) What to search for\n"
+            "2. \"type\"        (string, optional, default=\"prefix\") \"prefix\" for the comments starting with text (ordered by comment),\n"
+            "                 or \"keyword\" for the comments containing text as a word (in block chain order).\n"
+            "                 Keywords are words of " + strprintf("%u to %u", MIN_COMMENT_KEYWORD_SIZE, MAX_COMMENT_KEYWORD_SIZE) + " letters and digits, and match regardless of case.\n"
+            "3. count         (numeric, optional, default=" + strprintf("%u", DEFAULT_COMMENT_RESULTS) + ") The maximum number of comments to return\n"
+            "4. startheight   (numeric, optional, default=0) Only return comments from this height on\n"
+            "\nResult:\n"
+            "[                 (array of json objects, as returned by gettxcomment)\n"
+            "  ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("searchtxcomments", "\"text:\"")
+            + HelpExampleCli("searchtxcomments", "\"florincoin\" \"keyword\" 10 1000000")
+            + HelpExampleRpc("searchtxcomments", "\"florincoin\", \"keyword\", 10, 1000000")
+        );
+
+    EnsureCommentIndex();
+    std::string strText = params[0].get_str();
+    std::string strType = "prefix";
+    if (params.size() > 1)
+        strType = params[1].get_str();
+    unsigned int nCount = GetCommentResultsParam(params, 2);
+    int nStartHeight = 0;
+    if (params.size() > 3)
+        nStartHeight = params[3].get_int();
+
+    std::vector<CTxComment> vComment;
+    bool fOk;
+    if (strType == "prefix") {
+        if (strText.empty())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Empty prefix, use listtxcomments to list all comments");
+        fOk = pcommentindex->FindByPrefix(strText, nStartHeight, nCount, vComment);
+    } else if (strType == "keyword") {
+        std::vector<std::string> vKeyword = GetCommentKeywords(strText);
+        if (vKeyword.size() != 1 || vKeyword[0].size() != strText.size())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid keyword, use a single word of " + strprintf("%u to %u", MIN_COMMENT_KEYWORD_SIZE, MAX_COMMENT_KEYWORD_SIZE) + " letters and digits");
+        fOk = pcommentindex->FindByKeyword(vKeyword[0], nStartHeight, nCount, vComment);
+    } else {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid type, use \"prefix\" or \"keyword\"");
+    }
+    if (!fOk)
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the comment index");
+    return commentsToJSON(vComment);
+}
+
+Array addressTxidsToJSON(const std::vector<CAddressDelta>& vDelta)
+{
+    Array result;
+    for (unsigned int i = 0; i < vDelta.size(); i++) {
+        // A transaction can have several deltas, which are adjacent.
+        if (i > 0 && vDelta[i].txid == vDelta[i - 1].txid)
+            continue;
+        Object entry;
+        entry.push_back(Pair("txid", vDelta[i].txid.GetHex()));
+        entry.push_back(Pair("height", vDelta[i].nHeight));
+        result.push_back(entry);
+    }
+    return result;
+}
+
+Object addressBalanceToJSON(CAmount nBalance, CAmount nReceived)
+{
+    Object result;
+    result.push_back(Pair("balance", ValueFromAmount(nBalance)));
+    result.push_back(Pair("received", ValueFromAmount(nReceived)));
+    return result;
+}
+
+Array addressUtxosToJSON(const std::vector<std::pair<COutPoint, CAddressUnspentValue> >& vUnspent)
+{
+    Array result;
+    for (unsigned int i = 0; i < vUnspent.size(); i++) {
+        Object entry;
+        entry.push_back(Pair("txid", vUnspent[i].first.hash.GetHex()));
+        entry.push_back(Pair("vout", (int)vUnspent[i].first.n));
+        entry.push_back(Pair("amount", ValueFromAmount(vUnspent[i].second.nValue)));
+        entry.push_back(Pair("height", vUnspent[i].second.nHeight));
+        result.push_back(entry);
+    }
+    return result;
+}
+
+static void EnsureAddressIndex()
+{
+    if (!paddressindex)
+        throw JSONRPCError(RPC_MISC_ERROR, "The address index is not enabled (use -addressindex)");
+    // Until then, balances and histories are incomplete.
+    if (!paddressindex->IsSynced())
+        throw JSONRPCError(RPC_MISC_ERROR, strprintf("The address index is still being built (at height %d)", paddressindex->GetBestHeight()));
+}
+
+static uint160 GetAddressParam(const Value& param)
+{
+    uint160 hashScript;
+    if (!GetAddressScriptHash(param.get_str(), hashScript))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Florincoin address");
+    return hashScript;
+}
+
+static unsigned int GetAddressResultsParam(const Array& params, unsigned int nParam)
+{
+    if (params.size() <= nParam)
+        return DEFAULT_ADDRESS_RESULTS;
+    int nCount = params[nParam].get_int();
+    if (nCount <= 0 || (unsigned int)nCount > MAX_ADDRESS_RESULTS)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("count must be between 1 and %u", MAX_ADDRESS_RESULTS));
+    return nCount;
+}
+
+Value getaddressbalance(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance \"address\"\n"
+            "\nReturns the balance of an address in the block chain, from the address index (-addressindex).\n"
+            "\nArguments:\n"
+            "1. \"address\"     (string, required) The Florincoin address\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"balance\" : x.xxx,     (numeric) The amount of the unspent outputs paying to the address\n"
+            "  \"received\" : x.xxx     (numeric) The amount of all outputs ever paying to the address\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressbalance", "\"Ler4HNAEfwYhBmGXcFP2Po1NpRUEiK8km2\"")
+            + HelpExampleRpc("getaddressbalance", "\"Ler4HNAEfwYhBmGXcFP2Po1NpRUEiK8km2\"")
+        );
+
+    EnsureAddressIndex();
+    uint160 hashScript = GetAddressParam(params[0]);
+    CAmount nBalance, nReceived;
+    if (!paddressindex->GetBalance(hashScript, nBalance, nReceived))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index");
+    return addressBalanceToJSON(nBalance, nReceived);
+}
+
+Value getaddresstxids(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 5)
+        throw runtime_error(
+            "getaddresstxids \"address\" ( startheight endheight count skip )\n"
+            "\nReturns the transactions paying to or spending from an address, in block chain order, from the address index (-addressindex).\n"
+            "To page through them, pass the height of the last transaction returned as startheight, and as skip the number of transactions returned at that height so far.\n"
+            "\nArguments:\n"
+            "1. \"address\"     (string, required) The Florincoin address\n"
+            "2. startheight   (numeric, optional, default=0) The height of the first block\n"
+            "3. endheight     (numeric, optional, default=the current height) The height of the last block\n"
+            "4. count         (numeric, optional, default=" + strprintf("%u", DEFAULT_ADDRESS_RESULTS) + ") The maximum number of transactions to return\n"
+            "5. skip          (numeric, optional, default=0) The number of transactions to skip, from startheight on\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txid\" : \"txid\",     (string) The transaction id\n"
+            "    \"height\" : n         (numeric) The height of the block containing the transaction\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddresstxids", "\"Ler4HNAEfwYhBmGXcFP2Po1NpRUEiK8km2\"")
+            + HelpExampleCli("getaddresstxids", "\"Ler4HNAEfwYhBmGXcFP2Po1NpRUEiK8km2\" 1000000 1001000 10 10")
+            + HelpExampleRpc("getaddresstxids", "\"Ler4HNAEfwYhBmGXcFP2Po1NpRUEiK8km2\", 1000000, 1001000, 10, 10")
+        );
+
+    EnsureAddressIndex();
+    uint160 hashScript = GetAddressParam(params[0]);
+    int nStartHeight = 0;
+    if (params.size() > 1)
+        nStartHeight = params[1].get_int();
+    int nEndHeight = std::numeric_limits<int>::max();
+    if (params.size() > 2)
+        nEndHeight = params[2].get_int();
+    if (nStartHeight < 0 || nEndHeight < nStartHeight)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height range");
+    unsigned int nCount = GetAddressResultsParam(params, 3);
+    int nSkip = 0;
+    if (params.size() > 4)
+        nSkip = params[4].get_int();
+    if (nSkip < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative skip");
+
+    std::vector<CAddressDelta> vDelta;
+    if (!paddressindex->FindDeltas(hashScript, nStartHeight, nEndHeight, nSkip, nCount, vDelta))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index");
+    return addressTxidsToJSON(vDelta);
+}
+
+Value getaddressutxos(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "getaddressutxos \"address\" ( count skip )\n"
+            "\nReturns the unspent outputs paying to an address, from the address index (-addressindex).\n"
+            "\nArguments:\n"
+            "1. \"address\"     (string, required) The Florincoin address\n"
+            "2. count         (numeric, optional, default=" + strprintf("%u", DEFAULT_ADDRESS_RESULTS) + ") The maximum number of outputs to return\n"
+            "3. skip          (numeric, optional, default=0) The number of outputs to skip\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txid\" : \"txid\",     (string) The transaction id\n"
+            "    \"vout\" : n,          (numeric) The output number\n"
+            "    \"amount\" : x.xxx,    (numeric) The amount of the output\n"
+            "    \"height\" : n         (numeric) The height of the block containing the transaction\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressutxos", "\"Ler4HNAEfwYhBmGXcFP2Po1NpRUEiK8km2\"")
+            + HelpExampleCli("getaddressutxos", "\"Ler4HNAEfwYhBmGXcFP2Po1NpRUEiK8km2\" 100 100")
+            + HelpExampleRpc("getaddressutxos", "\"Ler4HNAEfwYhBmGXcFP2Po1NpRUEiK8km2\", 100, 100")
+        );
+
+    EnsureAddressIndex();
+    uint160 hashScript = GetAddressParam(params[0]);
+    unsigned int nCount = GetAddressResultsParam(params, 1);
+    int nSkip = 0;
+    if (params.size() > 2)
+        nSkip = params[2].get_int();
+    if (nSkip < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative skip");
+
+    std::vector<std::pair<COutPoint, CAddressUnspentValue> > vUnspent;
+    if (!paddressindex->FindUnspent(hashScript, nSkip, nCount, vUnspent))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index");
+    return addressUtxosToJSON(vUnspent);
+}
@@ -67,6 +67,18 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "listunspent", 1 },
     { "listunspent", 2 },
     { "getblock", 1 },
+    { "gettxoutsetinfo", 0 },
+    { "listtxcomments", 0 },
+    { "listtxcomments", 1 },
+    { "listtxcomments", 2 },
+    { "searchtxcomments", 2 },
+    { "searchtxcomments", 3 },
+    { "getaddresstxids", 1 },
+    { "getaddresstxids", 2 },
+    { "getaddresstxids", 3 },
+    { "getaddresstxids", 4 },
+    { "getaddressutxos", 1 },
+    { "getaddressutxos", 2 },
     { "gettransaction", 1 },
     { "getrawtransaction", 1 },
     { "createrawtransaction", 0 },
@@ -14,6 +14,7 @@
 #include "script/script.h"
 #include "script/sign.h"
 #include "script/standard.h"
+#include "txindex.h"
 #include "uint256.h"
 #ifdef ENABLE_WALLET
 #include "wallet.h"
@@ -180,8 +181,11 @@ Value getrawtransaction(const Array& params, bool fHelp)
 
     CTransaction tx;
     uint256 hashBlock = 0;
-    if (!GetTransaction(hash, tx, hashBlock, true))
+    if (!GetTransaction(hash, tx, hashBlock, true)) {
+        if (ptxindex && !ptxindex->IsSynced())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strprintf("No information available about transaction, the transaction index is still being built (at height %d)", ptxindex->GetBestHeight()));
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available about transaction");
+    }
 
     string strHex = EncodeHexTx(tx);
 
@@ -267,10 +267,18 @@ static const CRPCCommand vRPCCommands[] =
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,      true,       false },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true,      false,      false },
     { "blockchain",         "gettxout",               &gettxout,               true,      false,      false },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false,      false },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      true,       false },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true,      true,       false },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           false,     true,       false },
     { "blockchain",         "verifychain",            &verifychain,            true,      false,      false },
     { "blockchain",         "invalidateblock",        &invalidateblock,        true,      true,       false },
     { "blockchain",         "reconsiderblock",        &reconsiderblock,        true,      true,       false },
+    { "blockchain",         "gettxcomment",           &gettxcomment,           true,      true,       false },
+    { "blockchain",         "listtxcomments",         &listtxcomments,         true,      true,       false },
+    { "blockchain",         "searchtxcomments",       &searchtxcomments,       true,      true,       false },
+    { "blockchain",         "getaddressbalance",      &getaddressbalance,      true,      true,       false },
+    { "blockchain",         "getaddresstxids",        &getaddresstxids,        true,      true,       false },
+    { "blockchain",         "getaddressutxos",        &getaddressutxos,        true,      true,       false },
 
     /* Mining */
     { "mining",             "getblocktemplate",       &getblocktemplate,       true,      false,      false },
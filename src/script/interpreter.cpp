@@ -6,6 +6,7 @@
 #include "interpreter.h"
 
 #include "primitives/transaction.h"
+#include "crypto/common.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
@@ -1073,9 +1074,96 @@ public:
     }
 };
 
+/** Stream that appends serialized data to a byte vector */
+class CVectorWriter
+{
+private:
+    std::vector<unsigned char>& vch;
+
+public:
+    CVectorWriter(std::vector<unsigned char>& vchIn) : vch(vchIn) {}
+
+    CVectorWriter& write(const char *pch, size_t size) {
+        vch.insert(vch.end(), (const unsigned char*)pch, (const unsigned char*)pch + size);
+        return (*this);
+    }
+
+    template<typename T>
+    CVectorWriter& operator<<(const T& obj) {
+        ::Serialize(*this, obj, SER_GETHASH, 0);
+        return (*this);
+    }
+};
+
+/** Serialized size of an input with its script blanked out: prevout, empty script, nSequence */
+static const size_t BLANK_INPUT_SIZE = 32 + 4 + 1 + 4;
+
 } // anon namespace
 
-uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+void CSignatureHashContext::Init(const CTransaction& txTo)
+{
+    vPrefix.clear();
+    vchInputs.clear();
+    vchTail.clear();
+
+    std::vector<unsigned char> vchHeader;
+    CVectorWriter header(vchHeader);
+    header << txTo.nVersion;
+    ::WriteCompactSize(header, txTo.vin.size());
+    CHash256 hasher;
+    hasher.Write(&vchHeader[0], vchHeader.size());
+
+    vPrefix.reserve(txTo.vin.size());
+    vchInputs.reserve(txTo.vin.size() * BLANK_INPUT_SIZE);
+    CVectorWriter inputs(vchInputs);
+    for (unsigned int nInput = 0; nInput < txTo.vin.size(); nInput++) {
+        vPrefix.push_back(hasher);
+        inputs << txTo.vin[nInput].prevout << CScript() << txTo.vin[nInput].nSequence;
+        hasher.Write(&vchInputs[nInput * BLANK_INPUT_SIZE], BLANK_INPUT_SIZE);
+    }
+    assert(vchInputs.size() == txTo.vin.size() * BLANK_INPUT_SIZE);
+
+    CVectorWriter tail(vchTail);
+    ::WriteCompactSize(tail, txTo.vout.size());
+    for (unsigned int nOutput = 0; nOutput < txTo.vout.size(); nOutput++)
+        tail << txTo.vout[nOutput];
+    tail << txTo.nLockTime;
+}
+
+bool CSignatureHashContext::Covers(const CTransaction& txTo, int nHashType) const
+{
+    if (nHashType & SIGHASH_ANYONECANPAY)
+        return false;
+    if ((nHashType & 0x1f) == SIGHASH_NONE || (nHashType & 0x1f) == SIGHASH_SINGLE)
+        return false;
+    return !vPrefix.empty() && vPrefix.size() == txTo.vin.size();
+}
+
+uint256 CSignatureHashContext::SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType) const
+{
+    // Only the input being signed differs from the precomputed serialization
+    std::vector<unsigned char> vchInput;
+    CVectorWriter input(vchInput);
+    input << txTo.vin[nIn].prevout;
+    CTransactionSignatureSerializer(txTo, scriptCode, nIn, nHashType).SerializeScriptCode(input, SER_GETHASH, 0);
+    input << txTo.vin[nIn].nSequence;
+
+    CHash256 hasher(vPrefix[nIn]);
+    hasher.Write(&vchInput[0], vchInput.size());
+    size_t nOffset = (nIn + 1) * BLANK_INPUT_SIZE;
+    if (nOffset < vchInputs.size())
+        hasher.Write(&vchInputs[nOffset], vchInputs.size() - nOffset);
+    hasher.Write(&vchTail[0], vchTail.size());
+    unsigned char vchHashType[4];
+    WriteLE32(vchHashType, nHashType);
+    hasher.Write(vchHashType, sizeof(vchHashType));
+
+    uint256 result;
+    hasher.Finalize((unsigned char*)&result);
+    return result;
+}
+
+uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CSignatureHashContext* pctx)
 {
     if (nIn >= txTo.vin.size()) {
         //  nIn out of range
@@ -1090,6 +1178,9 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
         }
     }
 
+    if (pctx && pctx->Covers(txTo, nHashType))
+        return pctx->SignatureHash(scriptCode, txTo, nIn, nHashType);
+
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
@@ -1117,7 +1208,7 @@ bool TransactionSignatureChecker::CheckSig(const vector<unsigned char>& vchSigIn
     int nHashType = vchSig.back();
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType);
+    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType, pctx);
 
     if (!VerifySignature(vchSig, pubkey, sighash))
         return false;
@@ -1162,7 +1253,158 @@ bool TransactionSignatureChecker::CheckLockTime(const CScriptNum& nLockTime) con
 }
 
 
-bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+namespace {
+
+/**
+ * Collect the values pushed by a push-only scriptSig, applying the same size
+ * and minimal push rules as EvalScript. Returns false for anything else.
+ */
+bool GetScriptPushes(const CScript& script, unsigned int flags, vector<valtype>& vPushes)
+{
+    if (script.size() > 10000)
+        return false;
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    valtype vchPushValue;
+    while (pc < script.end()) {
+        if (!script.GetOp(pc, opcode, vchPushValue) || opcode > OP_PUSHDATA4)
+            return false;
+        if (vchPushValue.size() > MAX_SCRIPT_ELEMENT_SIZE)
+            return false;
+        if ((flags & SCRIPT_VERIFY_MINIMALDATA) != 0 && !CheckMinimalPush(vchPushValue, opcode))
+            return false;
+        vPushes.push_back(vchPushValue);
+    }
+    return true;
+}
+
+/**
+ * Match OP_m <pubkey>... OP_n OP_CHECKMULTISIG with directly pushed keys, the
+ * multisig template of Solver() in script/standard.cpp.
+ */
+bool MatchMultisig(const CScript& script, int& nRequired, vector<valtype>& vKeys)
+{
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    valtype vch;
+    if (!script.GetOp(pc, opcode) || opcode < OP_1 || opcode > OP_16)
+        return false;
+    nRequired = CScript::DecodeOP_N(opcode);
+    while (script.GetOp(pc, opcode, vch)) {
+        if (opcode < OP_PUSHDATA1 && (unsigned int)opcode == vch.size() && vch.size() >= 33 && vch.size() <= 65)
+            vKeys.push_back(vch);
+        else
+            break;
+    }
+    if (opcode < OP_1 || opcode > OP_16 || CScript::DecodeOP_N(opcode) != (int)vKeys.size())
+        return false;
+    if (!script.GetOp(pc, opcode) || opcode != OP_CHECKMULTISIG || pc != script.end())
+        return false;
+    return nRequired <= (int)vKeys.size();
+}
+
+/**
+ * Verify pay-to-pubkey-hash and pay-to-script-hash multisig spends without
+ * running the interpreter. Returns false if the scripts are not in one of
+ * those forms; otherwise the verification result, with the same error that
+ * EvalScript would have reported, is stored in fResult.
+ */
+bool VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror, bool& fResult)
+{
+    // OP_DUP OP_HASH160 <20 bytes> OP_EQUALVERIFY OP_CHECKSIG
+    if (scriptPubKey.size() == 25 && scriptPubKey[0] == OP_DUP && scriptPubKey[1] == OP_HASH160 &&
+        scriptPubKey[2] == 20 && scriptPubKey[23] == OP_EQUALVERIFY && scriptPubKey[24] == OP_CHECKSIG)
+    {
+        vector<valtype> vPushes;
+        if (!GetScriptPushes(scriptSig, flags, vPushes) || vPushes.size() != 2)
+            return false;
+        const valtype& vchSig = vPushes[0];
+        const valtype& vchPubKey = vPushes[1];
+
+        unsigned char vchHash[20];
+        CHash160().Write(begin_ptr(vchPubKey), vchPubKey.size()).Finalize(vchHash);
+        if (memcmp(vchHash, &scriptPubKey[3], sizeof(vchHash)) != 0) {
+            fResult = set_error(serror, SCRIPT_ERR_EQUALVERIFY);
+            return true;
+        }
+
+        CScript scriptCode(scriptPubKey);
+        scriptCode.FindAndDelete(CScript(vchSig));
+        if (!CheckSignatureEncoding(vchSig, flags, serror) || !CheckPubKeyEncoding(vchPubKey, flags, serror)) {
+            // serror is set
+            fResult = false;
+            return true;
+        }
+        if (!checker.CheckSig(vchSig, vchPubKey, scriptCode))
+            fResult = set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+        else
+            fResult = set_success(serror);
+        return true;
+    }
+
+    // OP_0 <sig>... <OP_m <pubkey>... OP_n OP_CHECKMULTISIG> against OP_HASH160 <20 bytes> OP_EQUAL
+    if ((flags & SCRIPT_VERIFY_P2SH) != 0 && scriptPubKey.IsPayToScriptHash())
+    {
+        vector<valtype> vPushes;
+        if (!GetScriptPushes(scriptSig, flags, vPushes) || vPushes.size() < 2)
+            return false;
+        const valtype& vchRedeemScript = vPushes.back();
+        CScript scriptCode(vchRedeemScript.begin(), vchRedeemScript.end());
+        int nSigsCount;
+        vector<valtype> vKeys;
+        if (!MatchMultisig(scriptCode, nSigsCount, vKeys) || vPushes.size() != (size_t)nSigsCount + 2)
+            return false;
+
+        unsigned char vchHash[20];
+        CHash160().Write(begin_ptr(vchRedeemScript), vchRedeemScript.size()).Finalize(vchHash);
+        if (memcmp(vchHash, &scriptPubKey[2], sizeof(vchHash)) != 0) {
+            fResult = set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+            return true;
+        }
+
+        // Signatures sit at vPushes[1..nSigsCount], below the redeem script.
+        // Like OP_CHECKMULTISIG, work from the top of the stack downwards.
+        int isig = nSigsCount;
+        int ikey = vKeys.size() - 1;
+        int nKeysCount = vKeys.size();
+        for (int k = 0; k < nSigsCount; k++)
+            scriptCode.FindAndDelete(CScript(vPushes[isig - k]));
+
+        bool fSuccess = true;
+        while (fSuccess && nSigsCount > 0)
+        {
+            const valtype& vchSig = vPushes[isig];
+            const valtype& vchPubKey = vKeys[ikey];
+            if (!CheckSignatureEncoding(vchSig, flags, serror) || !CheckPubKeyEncoding(vchPubKey, flags, serror)) {
+                // serror is set
+                fResult = false;
+                return true;
+            }
+            if (checker.CheckSig(vchSig, vchPubKey, scriptCode)) {
+                isig--;
+                nSigsCount--;
+            }
+            ikey--;
+            nKeysCount--;
+            if (nSigsCount > nKeysCount)
+                fSuccess = false;
+        }
+
+        if ((flags & SCRIPT_VERIFY_NULLDUMMY) != 0 && vPushes[0].size())
+            fResult = set_error(serror, SCRIPT_ERR_SIG_NULLDUMMY);
+        else if (!fSuccess)
+            fResult = set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+        else
+            fResult = set_success(serror);
+        return true;
+    }
+
+    return false;
+}
+
+} // anon namespace
+
+static bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror, bool fStandard)
 {
     set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR);
 
@@ -1170,6 +1412,11 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigne
         return set_error(serror, SCRIPT_ERR_SIG_PUSHONLY);
     }
 
+    // Most spends are of a standard form that can be checked directly
+    bool fResult;
+    if (fStandard && VerifyStandardScript(scriptSig, scriptPubKey, flags, checker, serror, fResult))
+        return fResult;
+
     vector<vector<unsigned char> > stack, stackCopy;
     if (!EvalScript(stack, scriptSig, flags, checker, serror))
         // serror is set
@@ -1214,3 +1461,13 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigne
 
     return set_success(serror);
 }
+
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+{
+    return VerifyScript(scriptSig, scriptPubKey, flags, checker, serror, true);
+}
+
+bool VerifyScriptInterpreted(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+{
+    return VerifyScript(scriptSig, scriptPubKey, flags, checker, serror, false);
+}
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_SCRIPT_INTERPRETER_H
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
+#include "hash.h"
 #include "script_error.h"
 #include "primitives/transaction.h"
 
@@ -76,7 +77,32 @@ enum
     SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY = (1U << 9),
 };
 
-uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+/**
+ * The parts of a transaction's signature hash serialization that are the same
+ * for every input, computed once so that checking a transaction with many
+ * inputs does not reserialize the whole transaction for each of them. Holds
+ * the hash state after every prefix of blanked inputs, the blanked inputs
+ * themselves and the serialized outputs and nLockTime. Only used for hash
+ * types that commit to all inputs and outputs; the others serialize as before.
+ * Read-only once initialized, so it can be shared by concurrent script checks.
+ */
+class CSignatureHashContext
+{
+private:
+    std::vector<CHash256> vPrefix;
+    std::vector<unsigned char> vchInputs;
+    std::vector<unsigned char> vchTail;
+
+public:
+    CSignatureHashContext() {}
+    explicit CSignatureHashContext(const CTransaction& txTo) { Init(txTo); }
+
+    void Init(const CTransaction& txTo);
+    bool Covers(const CTransaction& txTo, int nHashType) const;
+    uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType) const;
+};
+
+uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CSignatureHashContext* pctx = NULL);
 
 class BaseSignatureChecker
 {
@@ -99,12 +125,13 @@ class TransactionSignatureChecker : public BaseSignatureChecker
 private:
     const CTransaction* txTo;
     unsigned int nIn;
+    const CSignatureHashContext* pctx;
 
 protected:
     virtual bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 
 public:
-    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn) : txTo(txToIn), nIn(nInIn) {}
+    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CSignatureHashContext* pctxIn = NULL) : txTo(txToIn), nIn(nInIn), pctx(pctxIn) {}
     bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const;
     bool CheckLockTime(const CScriptNum& nLockTime) const;
 };
@@ -120,5 +147,7 @@ public:
 
 bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL);
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL);
+/** VerifyScript running every spend through EvalScript, without its direct checks of standard ones; for testing that they agree */
+bool VerifyScriptInterpreted(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL);
 
 #endif // BITCOIN_SCRIPT_INTERPRETER_H
@@ -5,86 +5,125 @@
 
 #include "sigcache.h"
 
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
 
-namespace {
+CSignatureCache::CSignatureCache(int64_t nMaxCacheSize) : nMaxDepth(0)
+{
+    uint256 nonce = GetRandHash();
+    memcpy(salt, nonce.begin(), sizeof(salt));
+
+    if (nMaxCacheSize <= 0)
+        return;
+    size_t nSlots = (size_t)(nMaxCacheSize * 1024 * 1024) / sizeof(CSlot);
+    vSlots.resize(std::min<size_t>(nSlots, 0xffffffff));
+    for (size_t n = vSlots.size(); n > 1; n >>= 1)
+        nMaxDepth++;
+    LogPrintf("Using %u MiB for signature cache (%u entries)\n", (unsigned int)nMaxCacheSize, (unsigned int)vSlots.size());
+}
 
-/**
- * Valid signature cache, to avoid doing expensive ECDSA signature checking
- * twice for every transaction (once when accepted into memory pool, and
- * again when accepted into the block chain)
- */
-class CSignatureCache
+uint32_t CSignatureCache::SlotIndex(const uint256& entry, int n) const
 {
-private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
-
-public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
-    {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
+    return ((uint64_t)ReadLE32(entry.begin() + 4 * n) * vSlots.size()) >> 32;
+}
+
+bool CSignatureCache::ReadSlot(const CSlot& slot, const uint256& entry) const
+{
+    while (true) {
+        uint32_t nSequence = slot.nSequence;
+        __sync_synchronize();
+        bool fMatch = slot.hash == entry;
+        __sync_synchronize();
+        if (!(nSequence & 1) && nSequence == slot.nSequence)
+            return fMatch;
+    }
+}
+
+void CSignatureCache::WriteSlot(CSlot& slot, const uint256& entry)
+{
+    slot.nSequence = slot.nSequence + 1;
+    __sync_synchronize();
+    slot.hash = entry;
+    __sync_synchronize();
+    slot.nSequence = slot.nSequence + 1;
+}
+
+uint256 CSignatureCache::ComputeEntry(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey) const
+{
+    uint256 entry;
+    CSHA256().Write(salt, sizeof(salt)).Write(hash.begin(), 32).Write(pubKey.begin(), pubKey.size()).Write(vchSig.empty() ? NULL : &vchSig[0], vchSig.size()).Finalize(entry.begin());
+    return entry;
+}
+
+bool CSignatureCache::Get(const uint256& entry) const
+{
+    if (vSlots.empty())
         return false;
+    for (int n = 0; n < SLOT_CHOICES; n++) {
+        if (ReadSlot(vSlots[SlotIndex(entry, n)], entry))
+            return true;
     }
+    return false;
+}
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
-    {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
-        }
+void CSignatureCache::Set(uint256 entry)
+{
+    if (vSlots.empty())
+        return;
+
+    boost::unique_lock<boost::mutex> lock(cs_insert);
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+    for (int n = 0; n < SLOT_CHOICES; n++) {
+        if (vSlots[SlotIndex(entry, n)].hash == entry)
+            return;
     }
-};
 
+    // Displace entries along a cuckoo path until one lands in an empty
+    // slot. If the path grows too long the last displaced entry is
+    // dropped; which one that is depends on the salt, which helps foil
+    // would-be DoS attackers who might try to pre-generate and re-use a
+    // set of valid signatures just-slightly-greater than our cache size.
+    int nChoice = insecure_rand() % SLOT_CHOICES;
+    for (unsigned int nDepth = 0; nDepth <= nMaxDepth; nDepth++) {
+        for (int n = 0; n < SLOT_CHOICES; n++) {
+            CSlot& slot = vSlots[SlotIndex(entry, n)];
+            if (slot.hash == 0) {
+                WriteSlot(slot, entry);
+                return;
+            }
+        }
+        uint32_t nIndex = SlotIndex(entry, nChoice);
+        uint256 displaced = vSlots[nIndex].hash;
+        WriteSlot(vSlots[nIndex], entry);
+        entry = displaced;
+        // Move the displaced entry on to the slot after the one it was
+        // evicted from, so that it does not simply swap back.
+        nChoice = 0;
+        while (nChoice < SLOT_CHOICES - 1 && SlotIndex(entry, nChoice) != nIndex)
+            nChoice++;
+        nChoice = (nChoice + 1) % SLOT_CHOICES;
+    }
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
-    static CSignatureCache signatureCache;
+    static CSignatureCache signatureCache(std::min(GetArg("-sigcachesize", DEFAULT_SIG_CACHE_SIZE), MAX_SIG_CACHE_SIZE));
+
+    uint256 entry = signatureCache.ComputeEntry(sighash, vchSig, pubkey);
 
-    if (signatureCache.Get(sighash, vchSig, pubkey))
+    if (signatureCache.Get(entry))
         return true;
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
 
     if (store)
-        signatureCache.Set(sighash, vchSig, pubkey);
+        signatureCache.Set(entry);
     return true;
 }
@@ -7,18 +7,75 @@
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
 #include "script/interpreter.h"
+#include "uint256.h"
 
 #include <vector>
 
+#include <boost/thread/mutex.hpp>
+
 class CPubKey;
 
+/** Default for -sigcachesize, the signature cache size in MiB */
+static const int64_t DEFAULT_SIG_CACHE_SIZE = 32;
+/** Upper bound for -sigcachesize */
+static const int64_t MAX_SIG_CACHE_SIZE = 16384;
+
+/**
+ * Valid signature cache, to avoid doing expensive ECDSA signature checking
+ * twice for every transaction (once when accepted into memory pool, and
+ * again when accepted into the block chain)
+ *
+ * Entries are salted SHA256 hashes of (signature hash, public key, signature)
+ * kept in a fixed-size cuckoo table, where each entry may live in any of eight
+ * slots picked by the words of its hash. Lookups take no lock: every slot has a
+ * sequence number that is odd while a writer updates it, and a reader that sees
+ * it change re-reads the slot. Inserts are serialized by a mutex. An entry that
+ * is being moved between slots can be missed by a concurrent reader, which only
+ * costs a signature check.
+ */
+class CSignatureCache
+{
+private:
+    static const int SLOT_CHOICES = 8;
+
+    struct CSlot
+    {
+        volatile uint32_t nSequence;
+        uint256 hash;
+
+        CSlot() : nSequence(0) {}
+    };
+
+    //! Random salt, so that nobody can predict which entries collide
+    unsigned char salt[32];
+    std::vector<CSlot> vSlots;
+    //! Number of displacements tried before an insert drops an entry
+    unsigned int nMaxDepth;
+    boost::mutex cs_insert;
+
+    uint32_t SlotIndex(const uint256& entry, int n) const;
+    bool ReadSlot(const CSlot& slot, const uint256& entry) const;
+    void WriteSlot(CSlot& slot, const uint256& entry);
+
+public:
+    //! A cache taking nMaxCacheSize MiB; it caches nothing if that is not positive
+    explicit CSignatureCache(int64_t nMaxCacheSize);
+
+    //! Number of entries the cache can hold
+    size_t GetCapacity() const { return vSlots.size(); }
+
+    uint256 ComputeEntry(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey) const;
+    bool Get(const uint256& entry) const;
+    void Set(uint256 entry);
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
     bool store;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, bool storeIn=true) : TransactionSignatureChecker(txToIn, nInIn), store(storeIn) {}
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, bool storeIn=true, const CSignatureHashContext* pctxIn=NULL) : TransactionSignatureChecker(txToIn, nInIn, pctxIn), store(storeIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
@@ -0,0 +1,269 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+
+#include "base58.h"
+#include "hash.h"
+#include "main.h"
+#include "random.h"
+#include "script/standard.h"
+#include "undo.h"
+
+#include <limits>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+// Exposes the collection of deltas, which the index thread normally drives.
+class CTestAddressIndex : public CAddressIndex
+{
+public:
+    CTestAddressIndex() : CAddressIndex(1 << 20, true, true) {}
+
+    bool Connect(std::vector<CAddressDelta> vDelta) { return ConnectDeltas(vDelta) && WriteBatch(CBlockLocator()); }
+    bool Disconnect(std::vector<CAddressDelta> vDelta) { return DisconnectDeltas(vDelta) && WriteBatch(CBlockLocator()); }
+};
+
+static CAddressDelta Funding(const uint160 &hashScript, int nHeight, unsigned int nTx, const uint256 &txid, unsigned int n, CAmount nValue)
+{
+    return CAddressDelta(hashScript, nHeight, nTx, txid, n, false, nValue);
+}
+
+static CAddressDelta Spending(const uint160 &hashScript, int nHeight, unsigned int nTx, const uint256 &txid, unsigned int nIn, const COutPoint &prevout, CAmount nValue)
+{
+    CAddressDelta delta(hashScript, nHeight, nTx, txid, nIn, true, -nValue);
+    delta.prevout = prevout;
+    return delta;
+}
+
+static void CheckBalance(const CAddressIndex &index, const uint160 &hashScript, CAmount nBalance, CAmount nReceived)
+{
+    CAmount nBalanceFound = -1, nReceivedFound = -1;
+    BOOST_REQUIRE(index.GetBalance(hashScript, nBalanceFound, nReceivedFound));
+    BOOST_CHECK_EQUAL(nBalanceFound, nBalance);
+    BOOST_CHECK_EQUAL(nReceivedFound, nReceived);
+}
+
+BOOST_AUTO_TEST_SUITE(addressindex_tests)
+
+BOOST_AUTO_TEST_CASE(addressindex_scripthash)
+{
+    CKeyID keyID(Hash160(std::vector<unsigned char>(1, 42)));
+    CScript script = GetScriptForDestination(keyID);
+    uint160 hashScript;
+    BOOST_REQUIRE(GetAddressScriptHash(CBitcoinAddress(keyID).ToString(), hashScript));
+    BOOST_CHECK(hashScript == GetScriptHash(script));
+    BOOST_CHECK(!GetAddressScriptHash("notanaddress", hashScript));
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_block)
+{
+    CScript scriptA = CScript() << OP_1;
+    CScript scriptB = CScript() << OP_2;
+
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 100;
+    coinbase.vout[0].scriptPubKey = scriptA;
+    block.vtx.push_back(coinbase);
+
+    CMutableTransaction tx;
+    tx.vin.resize(2);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 3);
+    tx.vin[1].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout.resize(2);
+    tx.vout[0].nValue = 0;
+    tx.vout[0].scriptPubKey = CScript() << OP_RETURN;
+    tx.vout[1].nValue = 70;
+    tx.vout[1].scriptPubKey = scriptA;
+    block.vtx.push_back(tx);
+
+    CBlockUndo blockundo;
+    blockundo.vtxundo.resize(1);
+    blockundo.vtxundo[0].vprevout.push_back(CTxInUndo(CTxOut(50, scriptB)));
+    blockundo.vtxundo[0].vprevout.push_back(CTxInUndo(CTxOut(30, scriptA)));
+
+    std::vector<CAddressDelta> vDelta;
+    BOOST_REQUIRE(GetBlockAddressDeltas(block, blockundo, 7, vDelta));
+    BOOST_REQUIRE_EQUAL(vDelta.size(), 4U);
+    // The coinbase output
+    BOOST_CHECK(vDelta[0].hashScript == GetScriptHash(scriptA));
+    BOOST_CHECK(vDelta[0].txid == block.vtx[0].GetHash());
+    BOOST_CHECK_EQUAL(vDelta[0].nHeight, 7);
+    BOOST_CHECK_EQUAL(vDelta[0].nTx, 0U);
+    BOOST_CHECK(!vDelta[0].fSpending);
+    BOOST_CHECK_EQUAL(vDelta[0].nValue, 100);
+    // The inputs, then the spendable outputs
+    BOOST_CHECK(vDelta[1].hashScript == GetScriptHash(scriptB));
+    BOOST_CHECK(vDelta[1].fSpending);
+    BOOST_CHECK_EQUAL(vDelta[1].nTx, 1U);
+    BOOST_CHECK_EQUAL(vDelta[1].nIndex, 0U);
+    BOOST_CHECK_EQUAL(vDelta[1].nValue, -50);
+    BOOST_CHECK(vDelta[1].prevout == tx.vin[0].prevout);
+    BOOST_CHECK(vDelta[2].hashScript == GetScriptHash(scriptA));
+    BOOST_CHECK(vDelta[2].fSpending);
+    BOOST_CHECK_EQUAL(vDelta[2].nIndex, 1U);
+    BOOST_CHECK_EQUAL(vDelta[2].nValue, -30);
+    BOOST_CHECK(vDelta[3].hashScript == GetScriptHash(scriptA));
+    BOOST_CHECK(!vDelta[3].fSpending);
+    BOOST_CHECK_EQUAL(vDelta[3].nIndex, 1U);
+    BOOST_CHECK_EQUAL(vDelta[3].nValue, 70);
+
+    blockundo.vtxundo[0].vprevout.pop_back();
+    BOOST_CHECK(!GetBlockAddressDeltas(block, blockundo, 7, vDelta));
+    blockundo.vtxundo.clear();
+    BOOST_CHECK(!GetBlockAddressDeltas(block, blockundo, 7, vDelta));
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_connect_disconnect)
+{
+    CTestAddressIndex index;
+    uint160 hashA = GetScriptHash(CScript() << OP_1);
+    uint160 hashB = GetScriptHash(CScript() << OP_2);
+    uint256 txid1 = GetRandHash(), txid2 = GetRandHash(), txid3 = GetRandHash();
+
+    // Block 1 pays 50 to A and 10 to B; it also spends an output the index
+    // does not know.
+    std::vector<CAddressDelta> vBlock1;
+    vBlock1.push_back(Spending(hashB, 1, 1, txid1, 0, COutPoint(GetRandHash(), 0), 5));
+    vBlock1.push_back(Funding(hashA, 1, 1, txid1, 0, 50));
+    vBlock1.push_back(Funding(hashB, 1, 1, txid1, 1, 10));
+    BOOST_REQUIRE(index.Connect(vBlock1));
+
+    // Block 2 moves A's 50 to 30 for B and 20 for A, and in a second
+    // transaction A's 20 to B.
+    std::vector<CAddressDelta> vBlock2;
+    vBlock2.push_back(Spending(hashA, 2, 1, txid2, 0, COutPoint(txid1, 0), 50));
+    vBlock2.push_back(Funding(hashB, 2, 1, txid2, 0, 30));
+    vBlock2.push_back(Funding(hashA, 2, 1, txid2, 1, 20));
+    vBlock2.push_back(Spending(hashA, 2, 2, txid3, 0, COutPoint(txid2, 1), 20));
+    vBlock2.push_back(Funding(hashB, 2, 2, txid3, 0, 20));
+    BOOST_REQUIRE(index.Connect(vBlock2));
+
+    CheckBalance(index, hashA, 0, 70);
+    CheckBalance(index, hashB, 55, 60);
+
+    std::vector<std::pair<COutPoint, CAddressUnspentValue> > vUnspent;
+    BOOST_REQUIRE(index.FindUnspent(hashA, 0, 100, vUnspent));
+    BOOST_CHECK(vUnspent.empty());
+    BOOST_REQUIRE(index.FindUnspent(hashB, 0, 100, vUnspent));
+    BOOST_REQUIRE_EQUAL(vUnspent.size(), 3U);
+    for (unsigned int i = 0; i < vUnspent.size(); i++) {
+        if (vUnspent[i].first == COutPoint(txid1, 1)) {
+            BOOST_CHECK_EQUAL(vUnspent[i].second.nValue, 10);
+            BOOST_CHECK_EQUAL(vUnspent[i].second.nHeight, 1);
+        } else {
+            BOOST_CHECK(vUnspent[i].first == COutPoint(txid2, 0) || vUnspent[i].first == COutPoint(txid3, 0));
+            BOOST_CHECK_EQUAL(vUnspent[i].second.nHeight, 2);
+        }
+    }
+    std::vector<std::pair<COutPoint, CAddressUnspentValue> > vPage;
+    BOOST_REQUIRE(index.FindUnspent(hashB, 1, 1, vPage));
+    BOOST_REQUIRE_EQUAL(vPage.size(), 1U);
+    BOOST_CHECK(vPage[0].first == vUnspent[1].first);
+
+    // A's history, in chain order, with the heights of the outputs spent.
+    std::vector<CAddressDelta> vDelta;
+    BOOST_REQUIRE(index.FindDeltas(hashA, 0, std::numeric_limits<int>::max(), 0, 100, vDelta));
+    BOOST_REQUIRE_EQUAL(vDelta.size(), 4U);
+    BOOST_CHECK(vDelta[0].txid == txid1);
+    BOOST_CHECK(vDelta[1].txid == txid2 && vDelta[1].fSpending);
+    BOOST_CHECK(vDelta[1].prevout == COutPoint(txid1, 0));
+    BOOST_CHECK_EQUAL(vDelta[1].nPrevHeight, 1);
+    BOOST_CHECK(vDelta[2].txid == txid2 && !vDelta[2].fSpending);
+    BOOST_CHECK(vDelta[3].txid == txid3);
+    // Spent in the same batch as it was created
+    BOOST_CHECK_EQUAL(vDelta[3].nPrevHeight, 2);
+    vDelta.clear();
+    BOOST_REQUIRE(index.FindDeltas(hashB, 0, 1, 0, 100, vDelta));
+    BOOST_REQUIRE_EQUAL(vDelta.size(), 2U);
+    BOOST_CHECK_EQUAL(vDelta[0].nPrevHeight, -1);
+
+    // Results are limited by transaction, keeping the deltas of each whole.
+    vDelta.clear();
+    BOOST_REQUIRE(index.FindDeltas(hashA, 0, std::numeric_limits<int>::max(), 0, 2, vDelta));
+    BOOST_REQUIRE_EQUAL(vDelta.size(), 3U);
+    BOOST_CHECK(vDelta[2].txid == txid2);
+    vDelta.clear();
+    BOOST_REQUIRE(index.FindDeltas(hashA, 2, 2, 0, 1, vDelta));
+    BOOST_REQUIRE_EQUAL(vDelta.size(), 2U);
+    BOOST_CHECK(vDelta[0].txid == txid2);
+
+    // Disconnecting block 2 brings back A's first output.
+    BOOST_REQUIRE(index.Disconnect(vBlock2));
+    CheckBalance(index, hashA, 50, 50);
+    CheckBalance(index, hashB, 5, 10);
+    vUnspent.clear();
+    BOOST_REQUIRE(index.FindUnspent(hashA, 0, 100, vUnspent));
+    BOOST_REQUIRE_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].first == COutPoint(txid1, 0));
+    BOOST_CHECK_EQUAL(vUnspent[0].second.nValue, 50);
+    BOOST_CHECK_EQUAL(vUnspent[0].second.nHeight, 1);
+
+    // The output unknown to the index is not brought back.
+    BOOST_REQUIRE(index.Disconnect(vBlock1));
+    CheckBalance(index, hashA, 0, 0);
+    CheckBalance(index, hashB, 0, 0);
+    vUnspent.clear();
+    BOOST_REQUIRE(index.FindUnspent(hashB, 0, 100, vUnspent));
+    BOOST_CHECK(vUnspent.empty());
+    BOOST_CHECK(!index.Disconnect(vBlock1));
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_paging)
+{
+    CTestAddressIndex index;
+    uint160 hashScript = GetScriptHash(CScript() << OP_1);
+
+    // More transactions at one height than fit in a page, each with an input
+    // and an output, between one at height 4 and one at height 6.
+    std::vector<uint256> vTxid;
+    std::vector<CAddressDelta> vBlock;
+    vTxid.push_back(GetRandHash());
+    vBlock.push_back(Funding(hashScript, 4, 1, vTxid.back(), 0, 1000));
+    BOOST_REQUIRE(index.Connect(vBlock));
+    vBlock.clear();
+    for (unsigned int i = 0; i < 25; i++) {
+        COutPoint prevout(vTxid.back(), 0);
+        vTxid.push_back(GetRandHash());
+        vBlock.push_back(Spending(hashScript, 5, i + 1, vTxid.back(), 0, prevout, 1000 - i));
+        vBlock.push_back(Funding(hashScript, 5, i + 1, vTxid.back(), 0, 1000 - i - 1));
+    }
+    BOOST_REQUIRE(index.Connect(vBlock));
+    vBlock.clear();
+    vTxid.push_back(GetRandHash());
+    vBlock.push_back(Funding(hashScript, 6, 1, vTxid.back(), 0, 1));
+    BOOST_REQUIRE(index.Connect(vBlock));
+    CheckBalance(index, hashScript, 976, 25676);
+
+    // Page through them as getaddresstxids callers do: from the height of the
+    // last transaction returned, skipping those already returned there.
+    std::vector<uint256> vFound;
+    int nStartHeight = 0;
+    unsigned int nSkip = 0;
+    while (true) {
+        std::vector<CAddressDelta> vDelta;
+        BOOST_REQUIRE(index.FindDeltas(hashScript, nStartHeight, std::numeric_limits<int>::max(), nSkip, 10, vDelta));
+        if (vDelta.empty())
+            break;
+        BOOST_REQUIRE(vFound.size() < vTxid.size());
+        for (unsigned int i = 0; i < vDelta.size(); i++) {
+            if (vFound.empty() || vFound.back() != vDelta[i].txid) {
+                vFound.push_back(vDelta[i].txid);
+                if (vDelta[i].nHeight != nStartHeight) {
+                    nStartHeight = vDelta[i].nHeight;
+                    nSkip = 0;
+                }
+                nSkip++;
+            }
+        }
+    }
+    BOOST_CHECK(vFound == vTxid);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,124 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockimport.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "random.h"
+#include "streams.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <stdio.h>
+
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+/** Fake checks: slow down at random so that workers finish out of order, and fail every seventh block. */
+bool CheckTestBlock(const CBlock& block, uint256& hashPoW)
+{
+    if (insecure_rand() % 4 == 0)
+        MilliSleep(insecure_rand() % 3);
+    hashPoW = block.GetHash();
+    return block.nNonce % 7 != 0;
+}
+
+/**
+ * Write nBlocks blocks to a file as the block files store them, with some
+ * junk in between that the reader must skip, and return their positions.
+ */
+std::vector<unsigned int> WriteBlocks(const boost::filesystem::path& path, unsigned int nBlocks)
+{
+    std::vector<unsigned int> vPos;
+    CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!fileout.IsNull());
+    for (unsigned int i = 0; i < nBlocks; i++) {
+        if (i % 10 == 3) {
+            // junk, and a record that is too short to be a block
+            fileout << FLATDATA("junk");
+            fileout << FLATDATA(Params().MessageStart()) << (unsigned int)8 << (uint64_t)0;
+        }
+        CBlock block;
+        block.nVersion = 2;
+        block.nTime = 1400000000 + i;
+        block.nNonce = i;
+        fileout << FLATDATA(Params().MessageStart()) << (unsigned int)::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        vPos.push_back(ftell(fileout.Get()));
+        fileout << block;
+    }
+    return vPos;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(blockimport_tests)
+
+BOOST_AUTO_TEST_CASE(blockimport_order)
+{
+    boost::filesystem::path path = GetTempPath() / strprintf("test_florincoin_import_%lu", (unsigned long)GetRand(1000000));
+    // More than fit in the queue, so that the reader has to wait.
+    const unsigned int nBlocks = 3 * CBlockImporter::MAX_QUEUED;
+    std::vector<unsigned int> vPos = WriteBlocks(path, nBlocks);
+
+    // Without workers the caller does the checks; with them, they finish out
+    // of order. Either way blocks come out in file order.
+    for (int nWorkers = 0; nWorkers <= 4; nWorkers += 2) {
+        CDiskBlockPos pos(7, 0);
+        CBlockImporter importer(fopen(path.string().c_str(), "rb"), &pos, nWorkers, CheckTestBlock);
+        for (unsigned int i = 0; i < nBlocks; i++) {
+            boost::scoped_ptr<CImportedBlock> pimport(importer.Next());
+            BOOST_REQUIRE(pimport);
+            BOOST_CHECK(pimport->fDone);
+            BOOST_CHECK_EQUAL(pimport->block.nNonce, i);
+            BOOST_CHECK_EQUAL(pimport->fChecked, i % 7 != 0);
+            BOOST_CHECK(pimport->hashPoW == pimport->block.GetHash());
+            BOOST_CHECK_EQUAL(pimport->pos.nFile, 7);
+            BOOST_CHECK_EQUAL(pimport->pos.nPos, vPos[i]);
+        }
+        BOOST_CHECK(importer.Next() == NULL);
+        BOOST_CHECK(importer.Next() == NULL);
+    }
+
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(blockimport_stop)
+{
+    boost::filesystem::path path = GetTempPath() / strprintf("test_florincoin_import_%lu", (unsigned long)GetRand(1000000));
+    const unsigned int nBlocks = 3 * CBlockImporter::MAX_QUEUED;
+    WriteBlocks(path, nBlocks);
+
+    // Destroying the importer stops the reader, which may be waiting for room
+    // in the queue, and the workers, which may be waiting for blocks.
+    for (unsigned int nTaken = 0; nTaken < nBlocks; nTaken += nBlocks / 4) {
+        CBlockImporter importer(fopen(path.string().c_str(), "rb"), NULL, 2, CheckTestBlock);
+        for (unsigned int i = 0; i < nTaken; i++) {
+            boost::scoped_ptr<CImportedBlock> pimport(importer.Next());
+            BOOST_REQUIRE(pimport);
+            BOOST_CHECK_EQUAL(pimport->block.nNonce, i);
+            BOOST_CHECK(pimport->pos.IsNull());
+        }
+        if (nTaken > 0)
+            MilliSleep(10);
+    }
+
+    // An empty file is just the end.
+    FILE* file = fopen(path.string().c_str(), "wb");
+    BOOST_REQUIRE(file != NULL);
+    fclose(file);
+    {
+        CBlockImporter importer(fopen(path.string().c_str(), "rb"), NULL, 2, CheckTestBlock);
+        BOOST_CHECK(importer.Next() == NULL);
+    }
+
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
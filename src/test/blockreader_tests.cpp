@@ -0,0 +1,104 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockreader.h"
+
+#include "clientversion.h"
+#include "main.h"
+#include "streams.h"
+
+#include <stdio.h>
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+// Append a record the way WriteBlockToDisk does, and return its position.
+static CDiskBlockPos AppendRecord(int nFile, const char* prefix, const std::string& strData)
+{
+    CDiskBlockPos pos(nFile, 0);
+    boost::filesystem::path path = GetBlockPosFilename(pos, prefix);
+    boost::filesystem::create_directories(path.parent_path());
+    CAutoFile file(fopen(path.string().c_str(), "ab"), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!file.IsNull());
+    unsigned char pchMessageStart[4] = { 0xfd, 0xc0, 0xa5, 0xf1 };
+    unsigned int nSize = strData.size();
+    file << FLATDATA(pchMessageStart) << nSize;
+    pos.nPos = ftell(file.Get());
+    file.write(strData.data(), strData.size());
+    return pos;
+}
+
+static std::string ReadRecord(CBlockFileReader& reader, const CDiskBlockPos& pos, const char* prefix, unsigned int nExtra = 0)
+{
+    CBlockFileRecord record;
+    if (!reader.Read(pos, prefix, record, nExtra))
+        return "<failed>";
+    return std::string(record.begin(), record.end());
+}
+
+BOOST_AUTO_TEST_SUITE(blockreader_tests)
+
+BOOST_AUTO_TEST_CASE(blockreader_read)
+{
+    CBlockFileReader reader(2);
+
+    CDiskBlockPos pos1 = AppendRecord(1000, "blk", "first");
+    CDiskBlockPos pos2 = AppendRecord(1000, "blk", "second");
+    BOOST_CHECK_EQUAL(ReadRecord(reader, pos2, "blk"), "second");
+    BOOST_CHECK_EQUAL(ReadRecord(reader, pos1, "blk"), "first");
+
+    // A record kept across the file growing and being dropped stays valid.
+    CBlockFileRecord record;
+    BOOST_REQUIRE(reader.Read(pos1, "blk", record));
+    CDiskBlockPos pos3 = AppendRecord(1000, "blk", "third, appended after the file was mapped");
+    BOOST_CHECK_EQUAL(ReadRecord(reader, pos3, "blk"), "third, appended after the file was mapped");
+    reader.Forget(1000);
+    BOOST_CHECK_EQUAL(std::string(record.begin(), record.end()), "first");
+    BOOST_CHECK_EQUAL(ReadRecord(reader, pos2, "blk"), "second");
+
+    // Trailing data, like the checksum after undo data.
+    CDiskBlockPos posUndo = AppendRecord(1000, "rev", "undo");
+    CAutoFile file(fopen(GetBlockPosFilename(posUndo, "rev").string().c_str(), "ab"), SER_DISK, CLIENT_VERSION);
+    file.write("sum", 3);
+    file.fclose();
+    BOOST_CHECK_EQUAL(ReadRecord(reader, posUndo, "rev", 3), "undosum");
+    BOOST_CHECK_EQUAL(ReadRecord(reader, posUndo, "rev", 4), "<failed>");
+
+    // More files than the reader keeps open.
+    CDiskBlockPos posOther = AppendRecord(1001, "blk", "other");
+    BOOST_CHECK_EQUAL(ReadRecord(reader, posOther, "blk"), "other");
+    BOOST_CHECK_EQUAL(ReadRecord(reader, pos3, "blk"), "third, appended after the file was mapped");
+    BOOST_CHECK_EQUAL(ReadRecord(reader, posUndo, "rev", 3), "undosum");
+    BOOST_CHECK_EQUAL(ReadRecord(reader, posOther, "blk"), "other");
+
+    // Positions that do not exist.
+    BOOST_CHECK_EQUAL(ReadRecord(reader, CDiskBlockPos(), "blk"), "<failed>");
+    BOOST_CHECK_EQUAL(ReadRecord(reader, CDiskBlockPos(1002, 8), "blk"), "<failed>");
+    BOOST_CHECK_EQUAL(ReadRecord(reader, CDiskBlockPos(1000, 1 << 20), "blk"), "<failed>");
+
+    reader.Clear();
+    BOOST_CHECK_EQUAL(ReadRecord(reader, pos2, "blk"), "second");
+}
+
+BOOST_AUTO_TEST_CASE(blockreader_memory_reader)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << 42 << std::string("florincoin") << (uint64_t)7;
+
+    CMemoryReader reader(&ss[0], &ss[0] + ss.size(), SER_DISK, CLIENT_VERSION);
+    int n;
+    std::string str;
+    reader >> n >> str;
+    BOOST_CHECK_EQUAL(n, 42);
+    BOOST_CHECK_EQUAL(str, "florincoin");
+    BOOST_CHECK_EQUAL(reader.GetPos(), ss.size() - 8);
+    reader.ignore(4);
+    BOOST_CHECK_THROW(reader.ignore(5), std::ios_base::failure);
+    BOOST_CHECK_THROW(reader >> n >> n, std::ios_base::failure);
+    BOOST_CHECK(reader.eof());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,195 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainindex.h"
+
+#include "clientversion.h"
+#include "main.h"
+#include "serialize.h"
+#include "utiltime.h"
+
+#include <utility>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+/**
+ * Index that keeps the hashes of the blocks it holds in memory, in chain
+ * order, and the blocks removed from it.
+ */
+class CTestChainIndex : public CChainIndex
+{
+private:
+    mutable boost::mutex mutex;
+    std::vector<uint256> vIndexed;
+    std::vector<uint256> vRemoved;
+    CBlockLocator locatorBest;
+    //! collected and not written yet, and whether they are removals
+    std::vector<std::pair<uint256, bool> > vBatch;
+
+protected:
+    bool AppendBlock(const CBlockIndex *pindex, const CDiskBlockPos &pos, const char* pbegin, const char* pend)
+    {
+        vBatch.push_back(std::make_pair(pindex->GetBlockHash(), false));
+        return true;
+    }
+
+    bool RemoveBlock(const CBlockIndex *pindex, const char* pbegin, const char* pend)
+    {
+        vBatch.push_back(std::make_pair(pindex->GetBlockHash(), true));
+        return true;
+    }
+
+    size_t GetBatchSize() const { return vBatch.size(); }
+
+    bool WriteBatch(const CBlockLocator &locator)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        for (unsigned int i = 0; i < vBatch.size(); i++) {
+            if (!vBatch[i].second) {
+                vIndexed.push_back(vBatch[i].first);
+            } else {
+                // Blocks are removed from the tip down.
+                if (vIndexed.empty() || vIndexed.back() != vBatch[i].first)
+                    return false;
+                vIndexed.pop_back();
+                vRemoved.push_back(vBatch[i].first);
+            }
+        }
+        vBatch.clear();
+        locatorBest = locator;
+        return true;
+    }
+
+    bool ReadBestBlock(CBlockLocator &locator) const
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        locator = locatorBest;
+        return true;
+    }
+
+public:
+    CTestChainIndex() : CChainIndex("testindex") {}
+
+    std::vector<uint256> GetIndexed() const { boost::unique_lock<boost::mutex> lock(mutex); return vIndexed; }
+    std::vector<uint256> GetRemoved() const { boost::unique_lock<boost::mutex> lock(mutex); return vRemoved; }
+};
+
+/**
+ * Store nBlocks blocks after pindexPrev at pos, which is advanced past them,
+ * and add them to the block index.
+ */
+std::vector<CBlockIndex*> AddBranch(CBlockIndex *pindexPrev, unsigned int nBlocks, unsigned int nBranch, CDiskBlockPos &pos)
+{
+    std::vector<CBlockIndex*> vBranch;
+    for (unsigned int i = 0; i < nBlocks; i++) {
+        CBlock block;
+        block.nVersion = 2;
+        block.hashPrevBlock = pindexPrev->GetBlockHash();
+        block.nTime = pindexPrev->nTime + 60;
+        block.nNonce = nBranch;
+        BOOST_REQUIRE(WriteBlockToDisk(block, pos));
+
+        CBlockIndex *pindex = new CBlockIndex(block);
+        BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(block.GetHash(), pindex)).first;
+        pindex->phashBlock = &mi->first;
+        pindex->pprev = pindexPrev;
+        pindex->nHeight = pindexPrev->nHeight + 1;
+        pindex->BuildSkip();
+        pindex->nFile = pos.nFile;
+        pindex->nDataPos = pos.nPos;
+        pindex->nStatus |= BLOCK_HAVE_DATA;
+        vBranch.push_back(pindex);
+
+        pos.nPos += ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        pindexPrev = pindex;
+    }
+    return vBranch;
+}
+
+bool WaitSynced(const CChainIndex &index)
+{
+    for (int i = 0; i < 1000 && !index.IsSynced(); i++)
+        MilliSleep(10);
+    return index.IsSynced();
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(chainindex_tests)
+
+BOOST_AUTO_TEST_CASE(chainindex_rewind)
+{
+    // Two branches off the genesis block, stored in a block file of their own.
+    CBlockIndex *pindexGenesis;
+    std::vector<CBlockIndex*> vA, vB;
+    {
+        LOCK(cs_main);
+        pindexGenesis = chainActive.Genesis();
+        BOOST_REQUIRE(pindexGenesis != NULL && chainActive.Tip() == pindexGenesis);
+        CDiskBlockPos pos(999, 0);
+        vA = AddBranch(pindexGenesis, 2, 1, pos);
+        vB = AddBranch(pindexGenesis, 3, 2, pos);
+        chainActive.SetTip(vA.back());
+    }
+
+    CTestChainIndex index;
+    BOOST_CHECK(!index.IsSynced());
+    BOOST_CHECK_EQUAL(index.GetBestHeight(), -1);
+    boost::thread thread(boost::bind(&CChainIndex::Thread, &index));
+
+    BOOST_REQUIRE(WaitSynced(index));
+    BOOST_CHECK_EQUAL(index.GetBestHeight(), 2);
+    std::vector<uint256> vIndexed = index.GetIndexed();
+    BOOST_REQUIRE_EQUAL(vIndexed.size(), 3U);
+    BOOST_CHECK(vIndexed[0] == pindexGenesis->GetBlockHash());
+    BOOST_CHECK(vIndexed[2] == vA[1]->GetBlockHash());
+
+    {
+        // Holding cs_main keeps the index thread from catching up meanwhile.
+        LOCK(cs_main);
+        // The index holds blocks the active chain no longer contains, even
+        // before the new tip is announced...
+        chainActive.SetTip(vB.back());
+        BOOST_CHECK(!index.IsSynced());
+        chainActive.SetTip(vA.back());
+        BOOST_CHECK(index.IsSynced());
+        // ...and once a tip of another branch is announced, it is not synced
+        // until the thread has rewound it.
+        index.NotifyBlockTip(vB.back()->GetBlockHash());
+        BOOST_CHECK(!index.IsSynced());
+        chainActive.SetTip(vB.back());
+    }
+
+    // The blocks of the old branch are removed from the tip down, and those of
+    // the new one appended.
+    BOOST_REQUIRE(WaitSynced(index));
+    BOOST_CHECK_EQUAL(index.GetBestHeight(), 3);
+    vIndexed = index.GetIndexed();
+    BOOST_REQUIRE_EQUAL(vIndexed.size(), 4U);
+    BOOST_CHECK(vIndexed[0] == pindexGenesis->GetBlockHash());
+    for (unsigned int i = 0; i < vB.size(); i++)
+        BOOST_CHECK(vIndexed[i + 1] == vB[i]->GetBlockHash());
+    std::vector<uint256> vRemoved = index.GetRemoved();
+    BOOST_REQUIRE_EQUAL(vRemoved.size(), 2U);
+    BOOST_CHECK(vRemoved[0] == vA[1]->GetBlockHash());
+    BOOST_CHECK(vRemoved[1] == vA[0]->GetBlockHash());
+
+    thread.interrupt();
+    thread.join();
+
+    LOCK(cs_main);
+    chainActive.SetTip(pindexGenesis);
+    for (unsigned int i = 0; i < vA.size() + vB.size(); i++) {
+        CBlockIndex *pindex = i < vA.size() ? vA[i] : vB[i - vA.size()];
+        mapBlockIndex.erase(pindex->GetBlockHash());
+        delete pindex;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
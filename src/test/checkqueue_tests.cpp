@@ -0,0 +1,136 @@
+// Copyright (c) 2012-2014 The Bitcoin Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+
+#include "tinyformat.h"
+#include "utiltime.h"
+
+#include <stdlib.h>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+volatile int nChecksRun = 0;
+
+/** Check that burns a little CPU and fails if asked to. */
+class CDummyCheck
+{
+private:
+    unsigned int nWork;
+    bool fFail;
+
+public:
+    CDummyCheck() : nWork(0), fFail(false) {}
+    CDummyCheck(unsigned int nWorkIn, bool fFailIn = false) : nWork(nWorkIn), fFail(fFailIn) {}
+
+    bool operator()()
+    {
+        volatile uint32_t x = nWork;
+        for (unsigned int i = 0; i < nWork; i++)
+            x = x * 1103515245 + 12345;
+        __sync_fetch_and_add(&nChecksRun, 1);
+        return !fFail;
+    }
+
+    void swap(CDummyCheck& check)
+    {
+        std::swap(nWork, check.nWork);
+        std::swap(fFail, check.fFail);
+    }
+};
+
+template <typename Q>
+void RunBatches(Q& queue, int nBatches, int nPerBatch, unsigned int nWork, int nFailAt, bool fExpect)
+{
+    nChecksRun = 0;
+    {
+        CCheckQueueControl<CDummyCheck, Q> control(&queue);
+        for (int i = 0; i < nBatches; i++) {
+            std::vector<CDummyCheck> vChecks;
+            for (int j = 0; j < nPerBatch; j++)
+                vChecks.push_back(CDummyCheck(nWork, i * nPerBatch + j == nFailAt));
+            control.Add(vChecks);
+        }
+        BOOST_CHECK_EQUAL(control.Wait(), fExpect);
+    }
+    if (fExpect)
+        BOOST_CHECK_EQUAL(nChecksRun, nBatches * nPerBatch);
+    BOOST_CHECK(queue.IsIdle());
+}
+
+template <typename Q>
+void TestQueue(int nThreads)
+{
+    Q queue(16);
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads; i++)
+        threads.create_thread(boost::bind(&Q::Thread, &queue));
+
+    RunBatches(queue, 1, 1, 10, -1, true);
+    RunBatches(queue, 50, 100, 10, -1, true);
+    RunBatches(queue, 50, 100, 10, 2500, false);
+    // a failure must not leak into the next round
+    RunBatches(queue, 10, 7, 10, -1, true);
+    RunBatches(queue, 0, 0, 10, -1, true);
+
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+template <typename Q>
+int64_t TimeQueue(int nThreads, int nBatches, int nPerBatch, unsigned int nWork)
+{
+    Q queue(128);
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads - 1; i++)
+        threads.create_thread(boost::bind(&Q::Thread, &queue));
+
+    int64_t nStart = GetTimeMicros();
+    for (int n = 0; n < 10; n++)
+        RunBatches(queue, nBatches, nPerBatch, nWork, -1, true);
+    int64_t nTime = GetTimeMicros() - nStart;
+
+    threads.interrupt_all();
+    threads.join_all();
+    return nTime;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(checkqueue_tests)
+
+BOOST_AUTO_TEST_CASE(checkqueue_correct)
+{
+    for (int nThreads = 0; nThreads <= 4; nThreads++) {
+        TestQueue<CCheckQueue<CDummyCheck> >(nThreads);
+        TestQueue<CWorkStealingCheckQueue<CDummyCheck> >(nThreads);
+    }
+}
+
+// Compare both queues on many cheap checks, added one transaction's worth at
+// a time like ConnectBlock does. This takes a while, so make check skips it;
+// set CHECKQUEUE_BENCH=1 and run with --run_test=checkqueue_tests/checkqueue_bench
+// --log_level=message to see timings.
+BOOST_AUTO_TEST_CASE(checkqueue_bench)
+{
+    if (!getenv("CHECKQUEUE_BENCH")) {
+        BOOST_TEST_MESSAGE("checkqueue_bench skipped, set CHECKQUEUE_BENCH=1 to run it");
+        return;
+    }
+
+    static const int nThreadCounts[] = {1, 2, 4, 8, 16};
+    for (unsigned int i = 0; i < sizeof(nThreadCounts) / sizeof(nThreadCounts[0]); i++) {
+        int nThreads = nThreadCounts[i];
+        int64_t nLocked = TimeQueue<CCheckQueue<CDummyCheck> >(nThreads, 5000, 2, 50);
+        int64_t nStealing = TimeQueue<CWorkStealingCheckQueue<CDummyCheck> >(nThreads, 5000, 2, 50);
+        BOOST_TEST_MESSAGE(strprintf("checkqueue %2d threads: locked %6.2fms, work-stealing %6.2fms", nThreads, nLocked * 0.001, nStealing * 0.001));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 
 #include "coins.h"
 #include "random.h"
+#include "script/script.h"
 #include "uint256.h"
 
 #include <vector>
@@ -58,6 +59,22 @@ public:
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
+
+    void SelfTest() const
+    {
+        // Manually recompute the dynamic usage of the whole data, and compare it.
+        size_t ret = cacheCoins.DynamicMemoryUsage();
+        for (CCoinsMap::const_iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+            ret += it->second.coins.DynamicMemoryUsage();
+        }
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
+    }
+};
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
@@ -89,8 +106,8 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
-    std::vector<CCoinsViewCache*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCache(&base)); // Start with one cache.
+    std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
+    stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
@@ -115,6 +132,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 coins.nVersion = insecure_rand();
                 coins.vout.resize(1);
                 coins.vout[0].nValue = insecure_rand();
+                coins.vout[0].scriptPubKey.assign(insecure_rand() % 64, OP_TRUE);
                 *entry = coins;
             } else {
                 coins.Clear();
@@ -135,6 +153,8 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                     missed_an_entry = true;
                 }
             }
+            for (unsigned int n = 0; n < stack.size(); n++)
+                stack[n]->SelfTest();
         }
 
         if (insecure_rand() % 100 == 0) {
@@ -151,7 +171,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCache(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -175,4 +195,65 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+// Random inserts, lookups and erases on a CCoinsMap, checked against a std::map.
+BOOST_AUTO_TEST_CASE(coins_map_test)
+{
+    CCoinsMap map;
+    std::map<uint256, int> expected;
+
+    std::vector<uint256> keys(2000);
+    for (unsigned int i = 0; i < keys.size(); i++)
+        keys[i] = GetRandHash();
+
+    // References to entries must survive the table growing.
+    map[keys[0]].coins.nHeight = 1;
+    expected[keys[0]] = 1;
+    const CCoinsCacheEntry* pFirst = &map.find(keys[0])->second;
+
+    for (unsigned int i = 0; i < NUM_SIMULATION_ITERATIONS; i++) {
+        const uint256& key = keys[insecure_rand() % keys.size()];
+        if (key == keys[0])
+            continue;
+        if (insecure_rand() % 3 == 0) {
+            CCoinsMap::iterator it = map.find(key);
+            BOOST_CHECK_EQUAL(it != map.end(), expected.count(key) != 0);
+            if (it != map.end()) {
+                BOOST_CHECK(it->first == key);
+                map.erase(it);
+                expected.erase(key);
+            }
+        } else {
+            int nHeight = insecure_rand() & 0xFFFF;
+            std::pair<CCoinsMap::iterator, bool> ret = map.insert(std::make_pair(key, CCoinsCacheEntry()));
+            BOOST_CHECK_EQUAL(ret.second, expected.count(key) == 0);
+            ret.first->second.coins.nHeight = nHeight;
+            expected[key] = nHeight;
+        }
+        BOOST_CHECK_EQUAL(map.size(), expected.size());
+    }
+    BOOST_CHECK(&map.find(keys[0])->second == pFirst);
+    BOOST_CHECK(map.DynamicMemoryUsage() > 0);
+
+    // Iteration visits every entry exactly once, also when erasing along the way.
+    size_t nEntries = map.size();
+    size_t nVisited = 0;
+    for (CCoinsMap::iterator it = map.begin(); it != map.end(); ) {
+        std::map<uint256, int>::iterator itExpected = expected.find(it->first);
+        BOOST_CHECK(itExpected != expected.end());
+        if (itExpected != expected.end()) {
+            BOOST_CHECK_EQUAL(it->second.coins.nHeight, itExpected->second);
+            expected.erase(itExpected);
+        }
+        nVisited++;
+        map.erase(it++);
+    }
+    BOOST_CHECK_EQUAL(nVisited, nEntries);
+    BOOST_CHECK(expected.empty());
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.find(keys[0]) == map.end());
+
+    map.clear();
+    BOOST_CHECK_EQUAL(map.DynamicMemoryUsage(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
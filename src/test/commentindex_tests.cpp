@@ -0,0 +1,181 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "commentindex.h"
+
+#include "clientversion.h"
+#include "main.h"
+#include "random.h"
+#include "streams.h"
+#include "txdb.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+static std::vector<uint256> FindTxids(const std::vector<CTxComment>& vComment)
+{
+    std::vector<uint256> vTxid;
+    for (unsigned int i = 0; i < vComment.size(); i++)
+        vTxid.push_back(vComment[i].txid);
+    return vTxid;
+}
+
+BOOST_AUTO_TEST_SUITE(commentindex_tests)
+
+BOOST_AUTO_TEST_CASE(commentindex_keywords)
+{
+    std::vector<std::string> vKeyword = GetCommentKeywords("Hello, World! a ab abc ABC t3st hello");
+    BOOST_REQUIRE_EQUAL(vKeyword.size(), 4U);
+    BOOST_CHECK_EQUAL(vKeyword[0], "abc");
+    BOOST_CHECK_EQUAL(vKeyword[1], "hello");
+    BOOST_CHECK_EQUAL(vKeyword[2], "t3st");
+    BOOST_CHECK_EQUAL(vKeyword[3], "world");
+
+    // Words longer than MAX_COMMENT_KEYWORD_SIZE are left out.
+    std::string strLong(MAX_COMMENT_KEYWORD_SIZE, 'x');
+    vKeyword = GetCommentKeywords(strLong + " " + strLong + "y");
+    BOOST_REQUIRE_EQUAL(vKeyword.size(), 1U);
+    BOOST_CHECK_EQUAL(vKeyword[0], strLong);
+
+    std::string strMany;
+    for (unsigned int i = 0; i < 2 * MAX_COMMENT_KEYWORDS; i++)
+        strMany += strprintf("word%u ", i);
+    BOOST_CHECK_EQUAL(GetCommentKeywords(strMany).size(), MAX_COMMENT_KEYWORDS);
+}
+
+BOOST_AUTO_TEST_CASE(commentindex_block)
+{
+    CBlock block;
+    for (unsigned int i = 0; i < 3; i++) {
+        CMutableTransaction tx;
+        tx.nVersion = 2;
+        tx.nLockTime = i;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.SetNull();
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 1000;
+        tx.strTxComment = i == 1 ? "" : strprintf("comment %u", i);
+        block.vtx.push_back(tx);
+    }
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << block;
+
+    std::vector<CTxComment> vComment;
+    BOOST_REQUIRE(GetBlockComments(&ss[0], &ss[0] + ss.size(), 42, vComment));
+    BOOST_REQUIRE_EQUAL(vComment.size(), 2U);
+    BOOST_CHECK(vComment[0].txid == block.vtx[0].GetHash());
+    BOOST_CHECK_EQUAL(vComment[0].nHeight, 42);
+    BOOST_CHECK_EQUAL(vComment[0].nTx, 0U);
+    BOOST_CHECK_EQUAL(vComment[0].strComment, "comment 0");
+    BOOST_CHECK(vComment[1].txid == block.vtx[2].GetHash());
+    BOOST_CHECK_EQUAL(vComment[1].nTx, 2U);
+    BOOST_CHECK_EQUAL(vComment[1].strComment, "comment 2");
+
+    BOOST_CHECK(!GetBlockComments(&ss[0], &ss[0] + ss.size() - 1, 42, vComment));
+}
+
+BOOST_AUTO_TEST_CASE(commentindex_db)
+{
+    CCommentIndexDB db(1 << 20, true);
+    std::string strLong = std::string(COMMENT_PREFIX_SIZE, 'l');
+
+    std::vector<CTxComment> vWrite;
+    vWrite.push_back(CTxComment(GetRandHash(), 10, 1, "text:Florincoin block chain"));
+    vWrite.push_back(CTxComment(GetRandHash(), 10, 3, "text:florincoin"));
+    vWrite.push_back(CTxComment(GetRandHash(), 11, 0, "other text FLORINCOIN"));
+    vWrite.push_back(CTxComment(GetRandHash(), 300, 2, strLong + "a"));
+    vWrite.push_back(CTxComment(GetRandHash(), 301, 1, strLong + "b"));
+    // A comment that is a prefix of the search, with a txid that continues it.
+    uint256 txidShort;
+    memset(txidShort.begin(), ':', txidShort.size());
+    *txidShort.begin() = 't';
+    vWrite.push_back(CTxComment(txidShort, 12, 1, "tex"));
+
+    CBlockLocator locator;
+    locator.vHave.push_back(GetRandHash());
+    BOOST_REQUIRE(db.WriteComments(std::vector<CTxComment>(), vWrite, locator));
+
+    CBlockLocator locatorRead;
+    BOOST_REQUIRE(db.ReadBestBlock(locatorRead));
+    BOOST_CHECK(locatorRead.vHave == locator.vHave);
+
+    CTxComment comment;
+    BOOST_REQUIRE(db.ReadComment(vWrite[2].txid, comment));
+    BOOST_CHECK(comment.txid == vWrite[2].txid);
+    BOOST_CHECK_EQUAL(comment.nHeight, 11);
+    BOOST_CHECK_EQUAL(comment.nTx, 0U);
+    BOOST_CHECK_EQUAL(comment.strComment, vWrite[2].strComment);
+    BOOST_CHECK(!db.ReadComment(GetRandHash(), comment));
+
+    // Height ranges, in chain order.
+    std::vector<CTxComment> vComment;
+    BOOST_REQUIRE(db.FindByHeight(10, 299, 100, vComment));
+    BOOST_REQUIRE_EQUAL(vComment.size(), 4U);
+    BOOST_CHECK(vComment[0].txid == vWrite[0].txid);
+    BOOST_CHECK(vComment[1].txid == vWrite[1].txid);
+    BOOST_CHECK(vComment[2].txid == vWrite[2].txid);
+    BOOST_CHECK(vComment[3].txid == txidShort);
+    BOOST_CHECK_EQUAL(vComment[3].strComment, "tex");
+    vComment.clear();
+    BOOST_REQUIRE(db.FindByHeight(11, 1000, 2, vComment));
+    BOOST_REQUIRE_EQUAL(vComment.size(), 2U);
+    BOOST_CHECK(vComment[0].txid == vWrite[2].txid);
+    BOOST_CHECK(vComment[1].txid == txidShort);
+
+    // Prefixes, ordered by comment.
+    vComment.clear();
+    BOOST_REQUIRE(db.FindByPrefix("text:", 0, 100, vComment));
+    BOOST_REQUIRE_EQUAL(vComment.size(), 2U);
+    BOOST_CHECK(vComment[0].txid == vWrite[0].txid);
+    BOOST_CHECK(vComment[1].txid == vWrite[1].txid);
+    vComment.clear();
+    BOOST_REQUIRE(db.FindByPrefix("tex", 0, 100, vComment));
+    BOOST_CHECK_EQUAL(vComment.size(), 3U);
+    vComment.clear();
+    BOOST_REQUIRE(db.FindByPrefix("text:f", 0, 100, vComment));
+    BOOST_CHECK(FindTxids(vComment) == std::vector<uint256>(1, vWrite[1].txid));
+    // Beyond COMMENT_PREFIX_SIZE, comments are compared in full.
+    vComment.clear();
+    BOOST_REQUIRE(db.FindByPrefix(strLong, 0, 100, vComment));
+    BOOST_CHECK_EQUAL(vComment.size(), 2U);
+    vComment.clear();
+    BOOST_REQUIRE(db.FindByPrefix(strLong + "b", 0, 100, vComment));
+    BOOST_CHECK(FindTxids(vComment) == std::vector<uint256>(1, vWrite[4].txid));
+    vComment.clear();
+    BOOST_REQUIRE(db.FindByPrefix(strLong, 301, 100, vComment));
+    BOOST_CHECK(FindTxids(vComment) == std::vector<uint256>(1, vWrite[4].txid));
+
+    // Keywords, in chain order.
+    vComment.clear();
+    BOOST_REQUIRE(db.FindByKeyword("florincoin", 0, 100, vComment));
+    BOOST_REQUIRE_EQUAL(vComment.size(), 3U);
+    BOOST_CHECK(vComment[0].txid == vWrite[0].txid);
+    BOOST_CHECK(vComment[1].txid == vWrite[1].txid);
+    BOOST_CHECK(vComment[2].txid == vWrite[2].txid);
+    BOOST_CHECK_EQUAL(vComment[2].strComment, vWrite[2].strComment);
+    vComment.clear();
+    BOOST_REQUIRE(db.FindByKeyword("florincoin", 11, 100, vComment));
+    BOOST_CHECK(FindTxids(vComment) == std::vector<uint256>(1, vWrite[2].txid));
+    vComment.clear();
+    BOOST_REQUIRE(db.FindByKeyword("florin", 0, 100, vComment));
+    BOOST_CHECK(vComment.empty());
+
+    // Erasing the comments of a block takes them out of every search.
+    std::vector<CTxComment> vErase(vWrite.begin(), vWrite.begin() + 2);
+    BOOST_REQUIRE(db.WriteComments(vErase, std::vector<CTxComment>(), locator));
+    BOOST_CHECK(!db.ReadComment(vWrite[0].txid, comment));
+    vComment.clear();
+    BOOST_REQUIRE(db.FindByHeight(0, 1000, 100, vComment));
+    BOOST_CHECK_EQUAL(vComment.size(), 4U);
+    vComment.clear();
+    BOOST_REQUIRE(db.FindByPrefix("text:", 0, 100, vComment));
+    BOOST_CHECK(vComment.empty());
+    vComment.clear();
+    BOOST_REQUIRE(db.FindByKeyword("florincoin", 0, 100, vComment));
+    BOOST_CHECK(FindTxids(vComment) == std::vector<uint256>(1, vWrite[2].txid));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
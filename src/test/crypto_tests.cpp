@@ -131,6 +131,44 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    // Every selected kernel must agree with two passes of the portable hasher,
+    // including counts that leave remainders for the narrower kernels.
+    BOOST_TEST_MESSAGE("Using SHA256 implementation: " + SHA256AutoDetect());
+    TestSHA256("abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    TestSHA256(std::string(1000000, 'a'),
+               "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+    for (int blocks = 0; blocks <= 15; blocks++) {
+        std::vector<unsigned char> in(64 * blocks), out(32 * blocks), expected(32 * blocks);
+        for (size_t i = 0; i < in.size(); i++)
+            in[i] = insecure_rand() & 0xff;
+        for (int i = 0; i < blocks; i++) {
+            unsigned char buf[32];
+            CSHA256().Write(&in[64 * i], 64).Finalize(buf);
+            CSHA256().Write(buf, 32).Finalize(&expected[32 * i]);
+        }
+        SHA256D64(blocks ? &out[0] : NULL, blocks ? &in[0] : NULL, blocks);
+        BOOST_CHECK(out == expected);
+
+        // SHA-NI takes precedence over the multi-lane kernels, so check them directly too.
+#if defined(ENABLE_SSE41) && defined(__GNUC__)
+        if (blocks == 4 && __builtin_cpu_supports("sse4.1")) {
+            out.assign(out.size(), 0);
+            sha256d64_sse41::Transform_4way(&out[0], &in[0]);
+            BOOST_CHECK(out == expected);
+        }
+#endif
+#if defined(ENABLE_AVX2) && defined(__GNUC__)
+        if (blocks == 8 && __builtin_cpu_supports("avx2")) {
+            out.assign(out.size(), 0);
+            sha256d64_avx2::Transform_8way(&out[0], &in[0]);
+            BOOST_CHECK(out == expected);
+        }
+#endif
+    }
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
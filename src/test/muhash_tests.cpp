@@ -0,0 +1,211 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "muhash.h"
+
+#include "coins.h"
+#include "main.h"
+#include "random.h"
+#include "script/script.h"
+#include "streams.h"
+#include "undo.h"
+#include "uint256.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+static CMutableTransaction MakeTx(const std::vector<COutPoint>& vPrevout, unsigned int nOutputs, unsigned int nLockTime)
+{
+    CMutableTransaction tx;
+    tx.nLockTime = nLockTime;
+    if (vPrevout.empty()) {
+        tx.vin.resize(1);
+        tx.vin[0].prevout.SetNull();
+    }
+    for (unsigned int i = 0; i < vPrevout.size(); i++)
+        tx.vin.push_back(CTxIn(vPrevout[i]));
+    tx.vout.resize(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        tx.vout[i].nValue = 1000 * (i + 1) + nLockTime;
+        tx.vout[i].scriptPubKey << OP_TRUE;
+    }
+    return tx;
+}
+
+BOOST_AUTO_TEST_SUITE(muhash_tests)
+
+BOOST_AUTO_TEST_CASE(muhash_set_semantics)
+{
+    std::vector<uint256> vHash;
+    for (int i = 0; i < 16; i++)
+        vHash.push_back(GetRandHash());
+
+    CMuHash3072 empty, forward, backward;
+    for (unsigned int i = 0; i < vHash.size(); i++) {
+        forward.Insert(vHash[i]);
+        backward.Insert(vHash[vHash.size() - 1 - i]);
+    }
+    // Order does not matter, contents do.
+    BOOST_CHECK(forward.GetHash() == backward.GetHash());
+    BOOST_CHECK(forward.GetHash() != empty.GetHash());
+
+    // Removing everything again gives back the empty set, whatever the order.
+    CMuHash3072 drained(forward);
+    for (unsigned int i = 0; i < vHash.size(); i += 2)
+        drained.Remove(vHash[i]);
+    for (unsigned int i = 1; i < vHash.size(); i += 2)
+        drained.Remove(vHash[i]);
+    BOOST_CHECK(drained.GetHash() == empty.GetHash());
+
+    // Multiplicity matters.
+    CMuHash3072 twice(forward);
+    twice.Insert(vHash[0]);
+    BOOST_CHECK(twice.GetHash() != forward.GetHash());
+    twice.Remove(vHash[0]);
+    BOOST_CHECK(twice.GetHash() == forward.GetHash());
+
+    // Removing before inserting is fine as well.
+    CMuHash3072 early;
+    early.Remove(vHash[0]);
+    early.Insert(vHash[1]);
+    early.Insert(vHash[0]);
+    CMuHash3072 single;
+    single.Insert(vHash[1]);
+    BOOST_CHECK(early.GetHash() == single.GetHash());
+
+    // The state survives serialization, including pending removals.
+    CDataStream ss(SER_DISK, 0);
+    ss << early;
+    BOOST_CHECK_EQUAL(ss.size(), 2 * CMuHash3072::BYTES);
+    CMuHash3072 copy;
+    ss >> copy;
+    BOOST_CHECK(copy.GetHash() == early.GetHash());
+    copy.Insert(vHash[2]);
+    early.Insert(vHash[2]);
+    BOOST_CHECK(copy.GetHash() == early.GetHash());
+}
+
+// Spend and create outputs through UpdateCoins, and check that the statistics
+// it maintains match those computed from the resulting coins.
+BOOST_AUTO_TEST_CASE(muhash_utxo_stats)
+{
+    CCoinsView base;
+    CCoinsViewCache view(&base);
+    CUtxoStats stats;
+    std::vector<uint256> vTxid;
+    std::vector<COutPoint> vUnspent;
+
+    for (unsigned int n = 0; n < 200; n++) {
+        CMutableTransaction tx;
+        tx.nLockTime = n;
+        if (vUnspent.empty() || insecure_rand() % 10 == 0) {
+            tx.vin.resize(1);
+            tx.vin[0].prevout.SetNull();
+        } else {
+            for (unsigned int i = 1 + insecure_rand() % 3; i > 0 && !vUnspent.empty(); i--) {
+                unsigned int nPos = insecure_rand() % vUnspent.size();
+                tx.vin.push_back(CTxIn(vUnspent[nPos]));
+                vUnspent[nPos] = vUnspent.back();
+                vUnspent.pop_back();
+            }
+        }
+        tx.vout.resize(1 + insecure_rand() % 3);
+        for (unsigned int i = 0; i < tx.vout.size(); i++) {
+            tx.vout[i].nValue = 1 + insecure_rand() % 100000;
+            if (insecure_rand() % 8 == 0)
+                tx.vout[i].scriptPubKey << OP_RETURN;
+            else
+                tx.vout[i].scriptPubKey << OP_TRUE;
+        }
+
+        CTransaction txFinal(tx);
+        CValidationState state;
+        CTxUndo undo;
+        UpdateCoins(txFinal, state, view, undo, 1 + n, &stats);
+        vTxid.push_back(txFinal.GetHash());
+        for (unsigned int i = 0; i < txFinal.vout.size(); i++) {
+            if (!txFinal.vout[i].scriptPubKey.IsUnspendable())
+                vUnspent.push_back(COutPoint(txFinal.GetHash(), i));
+        }
+    }
+
+    CUtxoStats expected;
+    for (unsigned int i = 0; i < vTxid.size(); i++) {
+        const CCoins *coins = view.AccessCoins(vTxid[i]);
+        if (coins)
+            expected.AddCoins(vTxid[i], *coins);
+    }
+    BOOST_CHECK_EQUAL(stats.nTransactions, expected.nTransactions);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, expected.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, vUnspent.size());
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, expected.nTotalAmount);
+    BOOST_CHECK(stats.muhash.GetHash() == expected.muhash.GetHash());
+}
+
+// Connect a block through UpdateCoins, collecting undo data as ConnectBlock
+// does, and disconnect it again: the statistics must return to where they were.
+BOOST_AUTO_TEST_CASE(muhash_disconnect_block)
+{
+    CCoinsView base;
+    CCoinsViewCache view(&base);
+    CUtxoStats stats;
+    CValidationState state;
+
+    // A few earlier coinbases to spend from.
+    std::vector<CTransaction> vFunding;
+    for (unsigned int n = 0; n < 4; n++) {
+        vFunding.push_back(MakeTx(std::vector<COutPoint>(), 3, n));
+        CTxUndo undo;
+        UpdateCoins(vFunding.back(), state, view, undo, 1, &stats);
+    }
+    CUtxoStats statsBefore(stats);
+
+    // The block spends all outputs of the first funding transaction (so that
+    // it is restored from the undo data alone), one of the second, and an
+    // output created earlier in the same block.
+    CBlock block;
+    block.vtx.push_back(MakeTx(std::vector<COutPoint>(), 1, 100));
+    std::vector<COutPoint> vPrevout;
+    for (unsigned int i = 0; i < 3; i++)
+        vPrevout.push_back(COutPoint(vFunding[0].GetHash(), i));
+    vPrevout.push_back(COutPoint(vFunding[1].GetHash(), 1));
+    block.vtx.push_back(MakeTx(vPrevout, 2, 101));
+    block.vtx.push_back(MakeTx(std::vector<COutPoint>(1, COutPoint(block.vtx[1].GetHash(), 0)), 1, 102));
+
+    CBlockUndo blockundo;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        CTxUndo undoDummy;
+        if (i > 0)
+            blockundo.vtxundo.push_back(CTxUndo());
+        UpdateCoins(block.vtx[i], state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), 2, &stats);
+    }
+    // Three new transactions, one fully spent.
+    BOOST_CHECK_EQUAL(stats.nTransactions, statsBefore.nTransactions + 2);
+    BOOST_CHECK(stats.muhash.GetHash() != statsBefore.muhash.GetHash());
+
+    bool fClean = true;
+    BOOST_REQUIRE(ApplyBlockUndo(block, blockundo, 2, view, fClean, &stats));
+    BOOST_CHECK(fClean);
+    BOOST_CHECK_EQUAL(stats.nTransactions, statsBefore.nTransactions);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, statsBefore.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, statsBefore.nTotalAmount);
+    BOOST_CHECK(stats.muhash.GetHash() == statsBefore.muhash.GetHash());
+
+    // The restored coins are those the statistics describe.
+    CUtxoStats expected;
+    for (unsigned int n = 0; n < vFunding.size(); n++) {
+        const CCoins *coins = view.AccessCoins(vFunding[n].GetHash());
+        BOOST_REQUIRE(coins != NULL);
+        BOOST_CHECK(*coins == CCoins(vFunding[n], 1));
+        expected.AddCoins(vFunding[n].GetHash(), *coins);
+    }
+    BOOST_CHECK(expected.muhash.GetHash() == statsBefore.muhash.GetHash());
+
+    // Undo data that does not fit the block is refused.
+    blockundo.vtxundo.pop_back();
+    BOOST_CHECK(!ApplyBlockUndo(block, blockundo, 2, view, fClean, &stats));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
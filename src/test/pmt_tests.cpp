@@ -2,6 +2,7 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "hash.h"
 #include "merkleblock.h"
 #include "serialize.h"
 #include "streams.h"
@@ -104,4 +105,60 @@ BOOST_AUTO_TEST_CASE(pmt_test1)
     }
 }
 
+// Level-by-level merkle tree, as computed before levels were hashed in batches
+static uint256 SerialMerkleTree(std::vector<uint256>& vTree)
+{
+    int j = 0;
+    for (int nSize = vTree.size(); nSize > 1; nSize = (nSize + 1) / 2)
+    {
+        for (int i = 0; i < nSize; i += 2)
+        {
+            int i2 = std::min(i+1, nSize-1);
+            vTree.push_back(Hash(vTree[j+i].begin(),  vTree[j+i].end(),
+                                 vTree[j+i2].begin(), vTree[j+i2].end()));
+        }
+        j += nSize;
+    }
+    return (vTree.empty() ? 0 : vTree.back());
+}
+
+BOOST_AUTO_TEST_CASE(pmt_precomputed_tree)
+{
+    static const unsigned int nTxCounts[] = {1, 2, 3, 4, 7, 8, 9, 17, 56, 100, 127, 256, 312, 513};
+
+    for (int n = 0; n < 14; n++) {
+        unsigned int nTx = nTxCounts[n];
+
+        CBlock block;
+        for (unsigned int j=0; j<nTx; j++) {
+            CMutableTransaction tx;
+            tx.nLockTime = rand();
+            block.vtx.push_back(CTransaction(tx));
+        }
+        uint256 merkleRoot = block.BuildMerkleTree();
+
+        std::vector<uint256> vTxid(nTx, 0);
+        for (unsigned int j=0; j<nTx; j++)
+            vTxid[j] = block.vtx[j].GetHash();
+        std::vector<uint256> vSerial(vTxid);
+        BOOST_CHECK(SerialMerkleTree(vSerial) == merkleRoot);
+        BOOST_CHECK(vSerial == block.vMerkleTree);
+
+        // branches taken from the stored tree still lead to the root
+        for (unsigned int j=0; j<nTx; j++)
+            BOOST_CHECK(CBlock::CheckMerkleBranch(vTxid[j], block.GetMerkleBranch(j), j) == merkleRoot);
+
+        // a partial tree built from the stored tree matches one built from scratch
+        std::vector<bool> vMatch(nTx, false);
+        for (unsigned int j=0; j<nTx; j++)
+            vMatch[j] = (rand() & 3) == 0;
+        CPartialMerkleTree pmt1(vTxid, vMatch);
+        CPartialMerkleTree pmt2(vTxid, vMatch, &block.vMerkleTree);
+        CDataStream ss1(SER_NETWORK, PROTOCOL_VERSION), ss2(SER_NETWORK, PROTOCOL_VERSION);
+        ss1 << pmt1;
+        ss2 << pmt2;
+        BOOST_CHECK(ss1.str() == ss2.str());
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -971,4 +971,158 @@ BOOST_AUTO_TEST_CASE(script_IsPushOnly_on_invalid_scripts)
     BOOST_CHECK(!CScript(direct, direct+sizeof(direct)).IsPushOnly());
 }
 
+static std::vector<unsigned char> SignInput(const CKey& key, const CScript& scriptCode, const CTransaction& txTo, int nHashType)
+{
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(SignatureHash(scriptCode, txTo, 0, nHashType), vchSig));
+    vchSig.push_back((unsigned char)nHashType);
+    return vchSig;
+}
+
+// Pad R with a zero byte: still a valid number, but not strict DER.
+static std::vector<unsigned char> PadSignatureR(std::vector<unsigned char> vchSig)
+{
+    vchSig.insert(vchSig.begin() + 4, 0x00);
+    vchSig[1]++;
+    vchSig[3]++;
+    return vchSig;
+}
+
+static CScript PushNonMinimal(const std::vector<unsigned char>& vch)
+{
+    CScript script;
+    script.push_back(OP_PUSHDATA1);
+    script.push_back((unsigned char)vch.size());
+    script.insert(script.end(), vch.begin(), vch.end());
+    return script;
+}
+
+/**
+ * Check that VerifyScript, which verifies standard spends directly, agrees
+ * with the interpreter on result and error under every combination of the
+ * flags either looks at.
+ */
+static void CheckStandardSpend(const CScript& scriptSig, const CScript& scriptPubKey, const CMutableTransaction& txTo, const std::string& strCase)
+{
+    static const unsigned int vFlags[] = {
+        SCRIPT_VERIFY_P2SH, SCRIPT_VERIFY_STRICTENC, SCRIPT_VERIFY_DERSIG, SCRIPT_VERIFY_LOW_S,
+        SCRIPT_VERIFY_NULLDUMMY, SCRIPT_VERIFY_SIGPUSHONLY, SCRIPT_VERIFY_MINIMALDATA
+    };
+    static const unsigned int nFlags = sizeof(vFlags) / sizeof(vFlags[0]);
+    for (unsigned int nCombination = 0; nCombination < (1U << nFlags); nCombination++) {
+        unsigned int flags = 0;
+        for (unsigned int i = 0; i < nFlags; i++)
+            if (nCombination & (1U << i))
+                flags |= vFlags[i];
+        ScriptError err, errInterpreted;
+        bool fResult = VerifyScript(scriptSig, scriptPubKey, flags, MutableTransactionSignatureChecker(&txTo, 0), &err);
+        bool fResultInterpreted = VerifyScriptInterpreted(scriptSig, scriptPubKey, flags, MutableTransactionSignatureChecker(&txTo, 0), &errInterpreted);
+        BOOST_CHECK_MESSAGE(fResult == fResultInterpreted && err == errInterpreted,
+            strCase << " (" << FormatScriptFlags(flags) << "): " << ScriptErrorString(err) << " instead of " << ScriptErrorString(errInterpreted));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(script_standard_spends)
+{
+    static const unsigned int flagsAll = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC | SCRIPT_VERIFY_DERSIG | SCRIPT_VERIFY_LOW_S |
+        SCRIPT_VERIFY_NULLDUMMY | SCRIPT_VERIFY_SIGPUSHONLY | SCRIPT_VERIFY_MINIMALDATA;
+    const KeyData keys;
+
+    // Pay-to-pubkey-hash, with a compressed, an uncompressed and a hybrid key
+    const CKey* vKey[] = { &keys.key0C, &keys.key1, &keys.key0 };
+    const CPubKey* vPubKey[] = { &keys.pubkey0C, &keys.pubkey1, &keys.pubkey0H };
+    for (unsigned int i = 0; i < 3; i++) {
+        const CKey& key = *vKey[i];
+        std::vector<unsigned char> vchPubKey = ToByteVector(*vPubKey[i]);
+        CScript scriptPubKey = CScript() << OP_DUP << OP_HASH160 << ToByteVector(vPubKey[i]->GetID()) << OP_EQUALVERIFY << OP_CHECKSIG;
+        CMutableTransaction txTo = BuildSpendingTransaction(CScript(), BuildCreditingTransaction(scriptPubKey));
+        std::vector<unsigned char> vchSig = SignInput(key, scriptPubKey, txTo, SIGHASH_ALL);
+        std::vector<unsigned char> vchSigHighS = vchSig;
+        NegateSignatureS(vchSigHighS);
+        std::string strKey = strprintf("P2PKH key %u: ", i);
+
+        if (i < 2) {
+            ScriptError err;
+            BOOST_CHECK(VerifyScript(CScript() << vchSig << vchPubKey, scriptPubKey, flagsAll, MutableTransactionSignatureChecker(&txTo, 0), &err));
+            BOOST_CHECK_MESSAGE(err == SCRIPT_ERR_OK, ScriptErrorString(err));
+        }
+        CheckStandardSpend(CScript() << vchSig << vchPubKey, scriptPubKey, txTo, strKey + "valid");
+        CheckStandardSpend(CScript() << SignInput(keys.key2C, scriptPubKey, txTo, SIGHASH_ALL) << vchPubKey, scriptPubKey, txTo, strKey + "wrong signature");
+        CheckStandardSpend(CScript() << std::vector<unsigned char>() << vchPubKey, scriptPubKey, txTo, strKey + "empty signature");
+        CheckStandardSpend(CScript() << vchPubKey, scriptPubKey, txTo, strKey + "missing signature");
+        CheckStandardSpend(CScript() << vchSig << ToByteVector(keys.pubkey2C), scriptPubKey, txTo, strKey + "wrong pubkey");
+        CheckStandardSpend(CScript() << vchSig << OP_NOP << vchPubKey, scriptPubKey, txTo, strKey + "non-push scriptSig");
+        CheckStandardSpend(CScript() << OP_1 << vchSig << vchPubKey, scriptPubKey, txTo, strKey + "extra stack item");
+        CheckStandardSpend(CScript() << vchSig << vchPubKey << OP_1, scriptPubKey, txTo, strKey + "extra item on top");
+        CheckStandardSpend(CScript() << SignInput(key, scriptPubKey, txTo, 0x21) << vchPubKey, scriptPubKey, txTo, strKey + "undefined hash type");
+        CheckStandardSpend(CScript() << SignInput(key, scriptPubKey, txTo, SIGHASH_NONE) << vchPubKey, scriptPubKey, txTo, strKey + "SIGHASH_NONE");
+        CheckStandardSpend(CScript() << vchSigHighS << vchPubKey, scriptPubKey, txTo, strKey + "high S");
+        CheckStandardSpend(CScript() << PadSignatureR(vchSig) << vchPubKey, scriptPubKey, txTo, strKey + "non-DER signature");
+        CheckStandardSpend(CScript() << std::vector<unsigned char>(vchSig.begin(), vchSig.end() - 1) << vchPubKey, scriptPubKey, txTo, strKey + "signature without hash type");
+        CheckStandardSpend(PushNonMinimal(vchSig) << vchPubKey, scriptPubKey, txTo, strKey + "non-minimal push");
+    }
+
+    // Pay-to-script-hash multisig: 2-of-3, 1-of-1 and 3-of-3
+    std::vector<unsigned char> vchPubKeys[] = { ToByteVector(keys.pubkey0C), ToByteVector(keys.pubkey1), ToByteVector(keys.pubkey2C) };
+    const CKey* vMultisigKey[] = { &keys.key0C, &keys.key1, &keys.key2C };
+    CScript redeemScript = CScript() << OP_2 << vchPubKeys[0] << vchPubKeys[1] << vchPubKeys[2] << OP_3 << OP_CHECKMULTISIG;
+    std::vector<unsigned char> vchRedeemScript(redeemScript.begin(), redeemScript.end());
+    CScript scriptPubKey = CScript() << OP_HASH160 << ToByteVector(CScriptID(redeemScript)) << OP_EQUAL;
+    CMutableTransaction txTo = BuildSpendingTransaction(CScript(), BuildCreditingTransaction(scriptPubKey));
+    std::vector<unsigned char> vchSigs[3];
+    for (unsigned int i = 0; i < 3; i++)
+        vchSigs[i] = SignInput(*vMultisigKey[i], redeemScript, txTo, SIGHASH_ALL);
+    std::vector<unsigned char> vchSigHighS = vchSigs[1];
+    NegateSignatureS(vchSigHighS);
+
+    {
+        ScriptError err;
+        BOOST_CHECK(VerifyScript(CScript() << OP_0 << vchSigs[0] << vchSigs[2] << vchRedeemScript, scriptPubKey, flagsAll, MutableTransactionSignatureChecker(&txTo, 0), &err));
+        BOOST_CHECK_MESSAGE(err == SCRIPT_ERR_OK, ScriptErrorString(err));
+    }
+    CheckStandardSpend(CScript() << OP_0 << vchSigs[0] << vchSigs[1] << vchRedeemScript, scriptPubKey, txTo, "2-of-3: keys 0 and 1");
+    CheckStandardSpend(CScript() << OP_0 << vchSigs[0] << vchSigs[2] << vchRedeemScript, scriptPubKey, txTo, "2-of-3: keys 0 and 2");
+    CheckStandardSpend(CScript() << OP_0 << vchSigs[1] << vchSigs[2] << vchRedeemScript, scriptPubKey, txTo, "2-of-3: keys 1 and 2");
+    CheckStandardSpend(CScript() << OP_0 << vchSigs[1] << vchSigs[0] << vchRedeemScript, scriptPubKey, txTo, "2-of-3: out of order");
+    CheckStandardSpend(CScript() << OP_0 << vchSigs[0] << vchSigs[0] << vchRedeemScript, scriptPubKey, txTo, "2-of-3: same signature twice");
+    CheckStandardSpend(CScript() << OP_0 << vchSigs[0] << SignInput(keys.key1C, redeemScript, txTo, SIGHASH_ALL) << vchRedeemScript, scriptPubKey, txTo, "2-of-3: wrong signature");
+    CheckStandardSpend(CScript() << OP_0 << vchSigs[0] << std::vector<unsigned char>() << vchRedeemScript, scriptPubKey, txTo, "2-of-3: empty signature");
+    CheckStandardSpend(CScript() << std::vector<unsigned char>() << vchSigs[0] << vchSigs[1] << vchRedeemScript, scriptPubKey, txTo, "2-of-3: empty first signature");
+    CheckStandardSpend(CScript() << OP_0 << vchSigs[0] << vchRedeemScript, scriptPubKey, txTo, "2-of-3: missing signature");
+    CheckStandardSpend(CScript() << OP_0 << vchSigs[0] << vchSigs[1] << vchSigs[2] << vchRedeemScript, scriptPubKey, txTo, "2-of-3: extra signature");
+    CheckStandardSpend(CScript() << OP_0 << OP_0 << vchSigs[0] << vchSigs[1] << vchRedeemScript, scriptPubKey, txTo, "2-of-3: extra stack item");
+    CheckStandardSpend(CScript() << OP_1 << vchSigs[0] << vchSigs[1] << vchRedeemScript, scriptPubKey, txTo, "2-of-3: non-null dummy");
+    CheckStandardSpend(CScript() << std::vector<unsigned char>(1, 0x01) << vchSigs[0] << vchSigs[1] << vchRedeemScript, scriptPubKey, txTo, "2-of-3: pushed non-null dummy");
+    CheckStandardSpend(CScript() << std::vector<unsigned char>(1, 0x00) << vchSigs[1] << vchSigs[0] << vchRedeemScript, scriptPubKey, txTo, "2-of-3: pushed zero dummy, out of order");
+    CheckStandardSpend(CScript() << OP_0 << vchSigs[0] << OP_NOP << vchSigs[1] << vchRedeemScript, scriptPubKey, txTo, "2-of-3: non-push scriptSig");
+    CheckStandardSpend(CScript() << OP_0 << vchSigs[0] << SignInput(keys.key1, redeemScript, txTo, 0x21) << vchRedeemScript, scriptPubKey, txTo, "2-of-3: undefined hash type");
+    CheckStandardSpend(CScript() << OP_0 << SignInput(keys.key0C, redeemScript, txTo, 0x21) << vchSigs[2] << vchRedeemScript, scriptPubKey, txTo, "2-of-3: undefined hash type on a key skipped");
+    CheckStandardSpend(CScript() << OP_0 << vchSigs[0] << vchSigHighS << vchRedeemScript, scriptPubKey, txTo, "2-of-3: high S");
+    CheckStandardSpend(CScript() << OP_0 << PadSignatureR(vchSigs[0]) << vchSigs[1] << vchRedeemScript, scriptPubKey, txTo, "2-of-3: non-DER signature");
+    CheckStandardSpend((CScript() << OP_0 << vchSigs[0]) + PushNonMinimal(vchSigs[1]) << vchRedeemScript, scriptPubKey, txTo, "2-of-3: non-minimal push");
+    CheckStandardSpend(CScript() << OP_0 << vchSigs[0] << vchSigs[1] << ToByteVector(CScript(redeemScript) << OP_NOP), scriptPubKey, txTo, "2-of-3: wrong redeem script");
+    CheckStandardSpend(CScript() << OP_0 << vchSigs[0] << vchSigs[1], scriptPubKey, txTo, "2-of-3: missing redeem script");
+
+    // A hybrid key among them
+    CScript redeemScriptH = CScript() << OP_1 << ToByteVector(keys.pubkey0H) << vchPubKeys[2] << OP_2 << OP_CHECKMULTISIG;
+    CScript scriptPubKeyH = CScript() << OP_HASH160 << ToByteVector(CScriptID(redeemScriptH)) << OP_EQUAL;
+    CMutableTransaction txToH = BuildSpendingTransaction(CScript(), BuildCreditingTransaction(scriptPubKeyH));
+    std::vector<unsigned char> vchRedeemScriptH(redeemScriptH.begin(), redeemScriptH.end());
+    CheckStandardSpend(CScript() << OP_0 << SignInput(keys.key0, redeemScriptH, txToH, SIGHASH_ALL) << vchRedeemScriptH, scriptPubKeyH, txToH, "1-of-2: hybrid key");
+    CheckStandardSpend(CScript() << OP_0 << SignInput(keys.key2C, redeemScriptH, txToH, SIGHASH_ALL) << vchRedeemScriptH, scriptPubKeyH, txToH, "1-of-2: past a hybrid key");
+
+    for (unsigned int n = 1; n <= 3; n += 2) {
+        CScript redeemScriptN = CScript() << CScript::EncodeOP_N(n);
+        for (unsigned int i = 0; i < n; i++)
+            redeemScriptN << vchPubKeys[i];
+        redeemScriptN << CScript::EncodeOP_N(n) << OP_CHECKMULTISIG;
+        CScript scriptPubKeyN = CScript() << OP_HASH160 << ToByteVector(CScriptID(redeemScriptN)) << OP_EQUAL;
+        CMutableTransaction txToN = BuildSpendingTransaction(CScript(), BuildCreditingTransaction(scriptPubKeyN));
+        CScript scriptSig = CScript() << OP_0;
+        for (unsigned int i = 0; i < n; i++)
+            scriptSig << SignInput(*vMultisigKey[i], redeemScriptN, txToN, SIGHASH_ALL);
+        CheckStandardSpend(scriptSig << std::vector<unsigned char>(redeemScriptN.begin(), redeemScriptN.end()), scriptPubKeyN, txToN, strprintf("%u-of-%u", n, n));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
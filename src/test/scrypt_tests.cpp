@@ -2,7 +2,9 @@
 
 #include "uint256.h"
 #include "util.h"
+#include "utilstrencodings.h"
 #include "crypto/scrypt.h"
+#include "primitives/block.h"
 
 BOOST_AUTO_TEST_SUITE(scrypt_tests)
 
@@ -31,4 +33,78 @@ BOOST_AUTO_TEST_CASE(scrypt_hashtest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(scrypt_multi_hashtest)
+{
+    // Multi-lane kernels must agree with the single-lane kernel for every lane count
+    std::vector<unsigned char> inputbytes(80 * SCRYPT_MAX_WAYS);
+    for (size_t i = 0; i < inputbytes.size(); i++)
+        inputbytes[i] = (unsigned char)(i * 7 + 3);
+    std::vector<uint256> expected(SCRYPT_MAX_WAYS);
+    for (int i = 0; i < SCRYPT_MAX_WAYS; i++)
+        scrypt_1024_1_1_256((const char*)&inputbytes[80 * i], BEGIN(expected[i]));
+
+    std::vector<char> scratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    std::vector<uint256> hashes(SCRYPT_MAX_WAYS);
+    for (int n = 1; n <= SCRYPT_MAX_WAYS; n++) {
+        scrypt_1024_1_1_256_sp_multi_generic((const char*)&inputbytes[0], (char*)&hashes[0], &scratchpad[0], n);
+        for (int i = 0; i < n; i++)
+            BOOST_CHECK(hashes[i] == expected[i]);
+#if defined(ENABLE_AVX2)
+        if (scrypt_detect_avx2()) {
+            hashes.assign(SCRYPT_MAX_WAYS, 0);
+            scrypt_1024_1_1_256_sp_avx2_8way((const char*)&inputbytes[0], (char*)&hashes[0], &scratchpad[0], n);
+            for (int i = 0; i < n; i++)
+                BOOST_CHECK(hashes[i] == expected[i]);
+            for (int i = n; i < SCRYPT_MAX_WAYS; i++)
+                BOOST_CHECK(hashes[i] == 0);
+        }
+#endif
+    }
+
+    // The dispatching wrapper splits arbitrary counts into kernel-sized chunks
+    scrypt_detect_avx2();
+    hashes.assign(SCRYPT_MAX_WAYS, 0);
+    scrypt_1024_1_1_256_multi((const char*)&inputbytes[0], (char*)&hashes[0], SCRYPT_MAX_WAYS);
+    BOOST_CHECK(hashes == expected);
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_headers_batch)
+{
+    // Batched header hashing must match CBlockHeader::GetPoWHash for partial kernel widths too
+    std::vector<CBlockHeader> headers(SCRYPT_MAX_WAYS + 3);
+    for (unsigned int i = 0; i < headers.size(); i++) {
+        headers[i].nTime = 1371488396 + i;
+        headers[i].nBits = 0x1e0ffff0;
+        headers[i].nNonce = i * 1000003;
+    }
+    std::vector<uint256> hashes(headers.size());
+    GetPoWHashes(&headers[0], headers.size(), &hashes[0]);
+    for (unsigned int i = 0; i < headers.size(); i++)
+        BOOST_CHECK(hashes[i] == headers[i].GetPoWHash());
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_nonces_midstate)
+{
+    // The miner's midstate path must match hashing each nonce of the header from scratch
+    CBlockHeader header;
+    header.nVersion = 2;
+    header.hashMerkleRoot = uint256("0x4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b");
+    header.nTime = 1371488396;
+    header.nBits = 0x1e0ffff0;
+    header.nNonce = 12345;
+
+    scrypt_midstate midstate;
+    scrypt_1024_1_1_256_midstate(BEGIN(header.nVersion), &midstate);
+    std::vector<char> scratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    std::vector<uint256> hashes(SCRYPT_MAX_WAYS);
+    for (int n = 1; n <= SCRYPT_MAX_WAYS; n += SCRYPT_MAX_WAYS - 1) {
+        scrypt_1024_1_1_256_sp_nonces(BEGIN(header.nVersion), &midstate, header.nNonce, n, (char*)&hashes[0], &scratchpad[0]);
+        for (int i = 0; i < n; i++) {
+            CBlockHeader attempt = header;
+            attempt.nNonce += i;
+            BOOST_CHECK(hashes[i] == attempt.GetPoWHash());
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
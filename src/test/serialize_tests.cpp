@@ -2,6 +2,9 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chain.h"
+#include "clientversion.h"
+#include "random.h"
 #include "serialize.h"
 #include "streams.h"
 
@@ -161,4 +164,29 @@ BOOST_AUTO_TEST_CASE(insert_delete)
     BOOST_CHECK_EQUAL(ss.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(blockindex_powhash)
+{
+    CDiskBlockIndex index;
+    index.nStatus = BLOCK_VALID_TREE | BLOCK_HAVE_POWHASH;
+    index.nBits = 0x1e0ffff0;
+    index.hashPoW = GetRandHash();
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << index;
+    CDiskBlockIndex indexRead;
+    ss >> indexRead;
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK_EQUAL(indexRead.nStatus, index.nStatus);
+    BOOST_CHECK(indexRead.hashPoW == index.hashPoW);
+
+    // An older client keeps the status bit but drops the hash it does not know.
+    CDataStream ssOld(SER_DISK, POWHASH_INDEX_VERSION - 1);
+    ssOld << index;
+    CDiskBlockIndex indexOld;
+    ssOld >> indexOld;
+    BOOST_CHECK(ssOld.empty());
+    BOOST_CHECK_EQUAL(indexOld.nStatus, (unsigned int)BLOCK_VALID_TREE);
+    BOOST_CHECK(indexOld.GetBlockHash() == index.GetBlockHash());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
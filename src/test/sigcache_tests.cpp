@@ -0,0 +1,71 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "script/sigcache.h"
+
+#include "pubkey.h"
+#include "random.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(sigcache_tests)
+
+BOOST_AUTO_TEST_CASE(sigcache_disabled)
+{
+    CSignatureCache cache(0);
+    BOOST_CHECK_EQUAL(cache.GetCapacity(), 0U);
+    uint256 entry = GetRandHash();
+    cache.Set(entry);
+    BOOST_CHECK(!cache.Get(entry));
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_set_get)
+{
+    CSignatureCache cache(1);
+    // The size is in MiB, not in entries.
+    BOOST_CHECK(cache.GetCapacity() > 20000U);
+
+    // At half load every entry finds a place.
+    std::vector<uint256> vEntry;
+    for (size_t i = 0; i < cache.GetCapacity() / 2; i++) {
+        vEntry.push_back(GetRandHash());
+        cache.Set(vEntry.back());
+    }
+    for (size_t i = 0; i < vEntry.size(); i++)
+        BOOST_CHECK(cache.Get(vEntry[i]));
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK(!cache.Get(GetRandHash()));
+
+    // Overfilling drops entries, but never holds more than it has room for.
+    for (size_t i = 0; i < cache.GetCapacity(); i++) {
+        vEntry.push_back(GetRandHash());
+        cache.Set(vEntry.back());
+    }
+    size_t nFound = 0;
+    for (size_t i = 0; i < vEntry.size(); i++)
+        nFound += cache.Get(vEntry[i]);
+    BOOST_CHECK(nFound <= cache.GetCapacity());
+    BOOST_CHECK(nFound > cache.GetCapacity() / 2);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_salted)
+{
+    std::vector<unsigned char> vchPubKey(33, 0x11);
+    vchPubKey[0] = 0x02;
+    CPubKey pubkey(vchPubKey);
+    std::vector<unsigned char> vchSig(71, 0x22);
+    uint256 hash = GetRandHash();
+
+    CSignatureCache cache1(1), cache2(1);
+    uint256 entry = cache1.ComputeEntry(hash, vchSig, pubkey);
+    BOOST_CHECK(entry == cache1.ComputeEntry(hash, vchSig, pubkey));
+    BOOST_CHECK(entry != cache2.ComputeEntry(hash, vchSig, pubkey));
+    vchSig[0] = 0x23;
+    BOOST_CHECK(entry != cache1.ComputeEntry(hash, vchSig, pubkey));
+    BOOST_CHECK(entry != cache1.ComputeEntry(GetRandHash(), std::vector<unsigned char>(), pubkey));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
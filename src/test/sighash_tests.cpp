@@ -137,9 +137,12 @@ BOOST_AUTO_TEST_CASE(sighash_test)
         RandomScript(scriptCode);
         int nIn = insecure_rand() % txTo.vin.size();
 
-        uint256 sh, sho;
+        uint256 sh, sho, shc;
         sho = SignatureHashOld(scriptCode, txTo, nIn, nHashType);
         sh = SignatureHash(scriptCode, txTo, nIn, nHashType);
+        CTransaction tx(txTo);
+        CSignatureHashContext ctx(tx);
+        shc = SignatureHash(scriptCode, tx, nIn, nHashType, &ctx);
         #if defined(PRINT_SIGHASH_JSON)
         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
         ss << txTo;
@@ -156,6 +159,7 @@ BOOST_AUTO_TEST_CASE(sighash_test)
         std::cout << "\n";
         #endif
         BOOST_CHECK(sh == sho);
+        BOOST_CHECK(shc == sh);
     }
     #if defined(PRINT_SIGHASH_JSON)
     std::cout << "]\n";
@@ -209,6 +213,9 @@ BOOST_AUTO_TEST_CASE(sighash_from_data)
 
         sh = SignatureHash(scriptCode, tx, nIn, nHashType);
         BOOST_CHECK_MESSAGE(sh.GetHex() == sigHashHex, strTest);
+        CSignatureHashContext ctx(tx);
+        sh = SignatureHash(scriptCode, tx, nIn, nHashType, &ctx);
+        BOOST_CHECK_MESSAGE(sh.GetHex() == sigHashHex, strTest);
     }
 }
 BOOST_AUTO_TEST_SUITE_END()
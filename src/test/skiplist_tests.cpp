@@ -99,4 +99,28 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(arena_test)
+{
+    CBlockIndexArena arena;
+    std::vector<CBlockIndex*> vIndex;
+    CBlockHeader header;
+    header.nTime = 1234;
+    for (int i = 0; i < 10000; i++) {
+        CBlockIndex* pindex = (i % 2) ? arena.New(header) : arena.New();
+        BOOST_CHECK(pindex->pprev == NULL && pindex->nHeight == 0);
+        BOOST_CHECK_EQUAL(pindex->nTime, (i % 2) ? 1234U : 0U);
+        pindex->nHeight = i;
+        vIndex.push_back(pindex);
+    }
+    BOOST_CHECK_EQUAL(arena.size(), vIndex.size());
+    BOOST_CHECK(arena.DynamicMemoryUsage() >= vIndex.size() * sizeof(CBlockIndex));
+    for (int i = 0; i < 10000; i++)
+        BOOST_CHECK_EQUAL(vIndex[i]->nHeight, i);
+
+    arena.Clear();
+    BOOST_CHECK_EQUAL(arena.size(), 0U);
+    BOOST_CHECK_EQUAL(arena.New()->nHeight, 0);
+    BOOST_CHECK_EQUAL(arena.size(), 1U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,138 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txdb.h"
+
+#include "clientversion.h"
+#include "random.h"
+#include "streams.h"
+#include "util.h"
+
+#include <stdio.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+static void AddCoins(CCoinsMap &mapCoins, const uint256 &txid, int nHeight, unsigned int nOutputs)
+{
+    CCoinsCacheEntry &entry = mapCoins[txid];
+    entry.coins.nVersion = 1;
+    entry.coins.nHeight = nHeight;
+    entry.coins.fCoinBase = nHeight % 2 == 0;
+    entry.coins.vout.resize(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        entry.coins.vout[i].nValue = 1000 * (i + 1);
+        entry.coins.vout[i].scriptPubKey << OP_TRUE;
+    }
+    // A spent output in the middle must not be written.
+    if (nOutputs > 2)
+        entry.coins.Spend(1);
+    entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+}
+
+BOOST_AUTO_TEST_SUITE(snapshot_tests)
+
+BOOST_AUTO_TEST_CASE(snapshot_dump_load)
+{
+    boost::filesystem::path path = GetTempPath() / strprintf("test_florincoin_snapshot_%lu", (unsigned long)GetRand(1000000));
+
+    CCoinsViewDB viewFrom(1 << 20, true);
+    uint256 hashBlock = GetRandHash();
+    CCoinsMap mapCoins;
+    for (int i = 0; i < 500; i++)
+        AddCoins(mapCoins, GetRandHash(), i, 1 + i % 5);
+    BOOST_REQUIRE(viewFrom.BatchWrite(mapCoins, hashBlock));
+
+    CCoinsStats statsFrom;
+    BOOST_REQUIRE(viewFrom.GetStats(statsFrom));
+    BOOST_CHECK(statsFrom.hashBlock == hashBlock);
+    BOOST_CHECK_EQUAL(statsFrom.nTransactions, 500U);
+
+    // Dump, as dumptxoutset does.
+    CCoinsSnapshotHeader header;
+    header.hashBlock = hashBlock;
+    header.nHeight = 1000;
+    header.nChainTx = 2000;
+    {
+        CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!fileout.IsNull());
+        fileout << header;
+        CCoinsStats stats;
+        BOOST_REQUIRE(viewFrom.DumpSnapshot(fileout, stats));
+        BOOST_CHECK(stats.hashSerialized == statsFrom.hashSerialized);
+    }
+
+    // The hash read back from the file is the one gettxoutsetinfo reports.
+    {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!filein.IsNull());
+        CCoinsSnapshotHeader headerRead;
+        filein >> headerRead;
+        BOOST_CHECK(headerRead.hashBlock == hashBlock);
+        BOOST_CHECK_EQUAL(headerRead.nHeight, 1000);
+        BOOST_CHECK_EQUAL(headerRead.nChainTx, 2000U);
+        CCoinsStats stats;
+        BOOST_REQUIRE(ReadCoinsSnapshotStats(filein, headerRead, stats));
+        BOOST_CHECK(stats.hashSerialized == statsFrom.hashSerialized);
+        BOOST_CHECK_EQUAL(stats.nTransactions, statsFrom.nTransactions);
+        BOOST_CHECK_EQUAL(stats.nTransactionOutputs, statsFrom.nTransactionOutputs);
+        BOOST_CHECK_EQUAL(stats.nTotalAmount, statsFrom.nTotalAmount);
+    }
+
+    // Loading the records, in chunks as LoadCoinsSnapshot does, gives the same set.
+    CCoinsViewDB viewTo(1 << 20, true);
+    {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!filein.IsNull());
+        CCoinsSnapshotHeader headerRead;
+        filein >> headerRead;
+        CCoinsMap mapLoaded;
+        while (true) {
+            uint256 txid;
+            filein >> txid;
+            if (txid == 0)
+                break;
+            CCoinsCacheEntry &entry = mapLoaded[txid];
+            filein >> entry.coins;
+            entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+            if (mapLoaded.size() >= 100) {
+                BOOST_REQUIRE(viewTo.BatchWrite(mapLoaded, uint256(1)));
+                mapLoaded.clear();
+            }
+        }
+        BOOST_REQUIRE(viewTo.BatchWrite(mapLoaded, headerRead.hashBlock));
+    }
+    CCoinsStats statsTo;
+    BOOST_REQUIRE(viewTo.GetStats(statsTo));
+    BOOST_CHECK(statsTo.hashBlock == hashBlock);
+    BOOST_CHECK(statsTo.hashSerialized == statsFrom.hashSerialized);
+    BOOST_CHECK_EQUAL(statsTo.nTransactions, statsFrom.nTransactions);
+
+    // A changed byte in the middle of the records is detected.
+    {
+        FILE *file = fopen(path.string().c_str(), "r+b");
+        BOOST_REQUIRE(file != NULL);
+        long nSize = boost::filesystem::file_size(path);
+        fseek(file, nSize / 2, SEEK_SET);
+        int ch = fgetc(file);
+        fseek(file, nSize / 2, SEEK_SET);
+        fputc(ch ^ 0x01, file);
+        fclose(file);
+
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        CCoinsSnapshotHeader headerRead;
+        filein >> headerRead;
+        CCoinsStats stats;
+        bool fOk = false;
+        try {
+            fOk = ReadCoinsSnapshotStats(filein, headerRead, stats);
+        } catch (const std::exception &) {
+        }
+        BOOST_CHECK(!fOk);
+    }
+
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -25,7 +25,6 @@ extern bool fPrintToConsole;
 extern void noui_connect();
 
 struct TestingSetup {
-    CCoinsViewDB *pcoinsdbview;
     boost::filesystem::path pathTemp;
     boost::thread_group threadGroup;
 
@@ -43,7 +42,8 @@ struct TestingSetup {
         mapArgs["-datadir"] = pathTemp.string();
         pblocktree = new CBlockTreeDB(1 << 20, true);
         pcoinsdbview = new CCoinsViewDB(1 << 23, true);
-        pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        pcoinsWriteBehind = new CCoinsViewWriteBehind(pcoinsdbview);
+        pcoinsTip = new CCoinsViewCache(pcoinsWriteBehind);
         InitBlockIndex();
 #ifdef ENABLE_WALLET
         bool fFirstRun;
@@ -66,6 +66,7 @@ struct TestingSetup {
         pwalletMain = NULL;
 #endif
         delete pcoinsTip;
+        delete pcoinsWriteBehind;
         delete pcoinsdbview;
         delete pblocktree;
 #ifdef ENABLE_WALLET
@@ -0,0 +1,131 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txindex.h"
+
+#include "clientversion.h"
+#include "main.h"
+#include "random.h"
+#include "streams.h"
+#include "txdb.h"
+
+#include <utility>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+static CBlock MakeBlock()
+{
+    CBlock block;
+    block.nVersion = 2;
+    block.nTime = 1400000000;
+    for (unsigned int i = 0; i < 3; i++) {
+        CMutableTransaction tx;
+        tx.nLockTime = i;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.SetNull();
+        tx.vout.resize(1 + i);
+        for (unsigned int j = 0; j < tx.vout.size(); j++) {
+            tx.vout[j].nValue = 1000 * (j + 1);
+            tx.vout[j].scriptPubKey << OP_TRUE;
+        }
+        tx.strTxComment = std::string(i * 100, 'x');
+        block.vtx.push_back(tx);
+    }
+    return block;
+}
+
+BOOST_AUTO_TEST_SUITE(txindex_tests)
+
+BOOST_AUTO_TEST_CASE(txindex_positions)
+{
+    CBlock block = MakeBlock();
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << block;
+
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    CDiskBlockPos pos(7, 1234);
+    BOOST_REQUIRE(GetBlockTxPositions(&ss[0], &ss[0] + ss.size(), pos, vPos));
+    BOOST_REQUIRE_EQUAL(vPos.size(), block.vtx.size());
+    for (unsigned int i = 0; i < vPos.size(); i++) {
+        BOOST_CHECK(vPos[i].first == block.vtx[i].GetHash());
+        BOOST_CHECK_EQUAL(vPos[i].second.nFile, 7);
+        BOOST_CHECK_EQUAL(vPos[i].second.nPos, 1234);
+
+        // Read it back the way GetTransaction does.
+        CMemoryReader reader(&ss[0], &ss[0] + ss.size(), SER_DISK, CLIENT_VERSION);
+        CBlockHeader header;
+        CTransaction tx;
+        reader >> header;
+        reader.ignore(vPos[i].second.nTxOffset);
+        reader >> tx;
+        BOOST_CHECK(tx.GetHash() == block.vtx[i].GetHash());
+    }
+
+    // A truncated block fails as a whole.
+    vPos.clear();
+    BOOST_CHECK(!GetBlockTxPositions(&ss[0], &ss[0] + ss.size() - 1, pos, vPos));
+}
+
+BOOST_AUTO_TEST_CASE(txindex_db)
+{
+    CTxIndexDB db(1 << 20, true);
+    CBlockLocator locator;
+    BOOST_CHECK(!db.ReadBestBlock(locator));
+
+    CBlock block = MakeBlock();
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+        vPos.push_back(std::make_pair(block.vtx[i].GetHash(), CDiskTxPos(CDiskBlockPos(3, 100), 1 + i)));
+    locator.vHave.push_back(block.GetHash());
+    BOOST_REQUIRE(db.WriteTxPos(vPos, locator));
+
+    CBlockLocator locatorRead;
+    BOOST_REQUIRE(db.ReadBestBlock(locatorRead));
+    BOOST_CHECK(locatorRead.vHave == locator.vHave);
+    for (unsigned int i = 0; i < vPos.size(); i++) {
+        CDiskTxPos pos;
+        BOOST_REQUIRE(db.ReadTxPos(vPos[i].first, pos));
+        BOOST_CHECK_EQUAL(pos.nFile, 3);
+        BOOST_CHECK_EQUAL(pos.nPos, 100);
+        BOOST_CHECK_EQUAL(pos.nTxOffset, 1 + i);
+    }
+    CDiskTxPos pos;
+    BOOST_CHECK(!db.ReadTxPos(block.GetHash(), pos));
+}
+
+BOOST_AUTO_TEST_CASE(txindex_legacy_erase)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint64_t nErased = 1;
+    BOOST_CHECK(db.EraseLegacyTxIndex(nErased));
+    BOOST_CHECK_EQUAL(nErased, 0U);
+
+    // A block tree as older versions left it, with the index kept alongside.
+    std::vector<uint256> vTxid;
+    for (unsigned int i = 0; i < 1000; i++) {
+        vTxid.push_back(GetRandHash());
+        BOOST_REQUIRE(db.Write(std::make_pair('t', vTxid.back()), CDiskTxPos(CDiskBlockPos(0, i), 1)));
+    }
+    BOOST_REQUIRE(db.WriteFlag("txindex", true));
+    BOOST_REQUIRE(db.WriteFlag("prunedblockfiles", false));
+    BOOST_REQUIRE(db.WriteLastBlockFile(5));
+
+    BOOST_CHECK(db.EraseLegacyTxIndex(nErased));
+    BOOST_CHECK_EQUAL(nErased, vTxid.size());
+    for (unsigned int i = 0; i < vTxid.size(); i++)
+        BOOST_CHECK(!db.Exists(std::make_pair('t', vTxid[i])));
+    bool fValue;
+    BOOST_CHECK(!db.ReadFlag("txindex", fValue));
+
+    // Everything else stays, and the cleanup only runs once.
+    BOOST_CHECK(db.ReadFlag("prunedblockfiles", fValue));
+    int nFile;
+    BOOST_CHECK(db.ReadLastBlockFile(nFile) && nFile == 5);
+    BOOST_REQUIRE(db.Write(std::make_pair('t', GetRandHash()), CDiskTxPos()));
+    BOOST_CHECK(db.EraseLegacyTxIndex(nErased));
+    BOOST_CHECK_EQUAL(nErased, 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
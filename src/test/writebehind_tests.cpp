@@ -0,0 +1,227 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txdb.h"
+
+#include "coins.h"
+#include "random.h"
+#include "script/script.h"
+#include "utiltime.h"
+
+#include <map>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+/**
+ * Backing view whose writes can be held up or made to fail. Like
+ * CCoinsViewDB, it leaves the map it is given unmodified.
+ */
+class CCoinsViewGated : public CCoinsView
+{
+private:
+    mutable boost::mutex mutex;
+    boost::condition_variable cond;
+    std::map<uint256, CCoins> mapCoins;
+    uint256 hashBestBlock;
+    bool fHold;
+    bool fWriting;
+    bool fFail;
+
+public:
+    CCoinsViewGated() : hashBestBlock(0), fHold(false), fWriting(false), fFail(false) {}
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) const
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::map<uint256, CCoins>::const_iterator it = mapCoins.find(txid);
+        if (it == mapCoins.end())
+            return false;
+        coins = it->second;
+        return true;
+    }
+
+    bool HaveCoins(const uint256 &txid) const
+    {
+        CCoins coins;
+        return GetCoins(txid, coins) && !coins.IsPruned();
+    }
+
+    uint256 GetBestBlock() const
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return hashBestBlock;
+    }
+
+    bool BatchWrite(CCoinsMap &mapCoinsIn, const uint256 &hashBlock)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fWriting = true;
+        cond.notify_all();
+        while (fHold)
+            cond.wait(lock);
+        fWriting = false;
+        if (fFail)
+            return false;
+        for (CCoinsMap::const_iterator it = mapCoinsIn.begin(); it != mapCoinsIn.end(); it++) {
+            if (it->second.flags & CCoinsCacheEntry::DIRTY)
+                mapCoins[it->first] = it->second.coins;
+        }
+        hashBestBlock = hashBlock;
+        return true;
+    }
+
+    //! Make BatchWrite wait until Release(), and return once it does
+    void Hold() { boost::unique_lock<boost::mutex> lock(mutex); fHold = true; }
+    void WaitWriting()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fWriting)
+            cond.wait(lock);
+    }
+    void Release() { boost::unique_lock<boost::mutex> lock(mutex); fHold = false; cond.notify_all(); }
+    void SetFail(bool fFailIn) { boost::unique_lock<boost::mutex> lock(mutex); fFail = fFailIn; }
+};
+
+CCoins MakeCoins(CAmount nValue)
+{
+    CCoins coins;
+    coins.vout.resize(1);
+    coins.vout[0].nValue = nValue;
+    coins.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    coins.nHeight = 1;
+    return coins;
+}
+
+void AddCoins(CCoinsMap &mapCoins, const uint256 &txid, const CCoins &coins)
+{
+    CCoinsCacheEntry &entry = mapCoins[txid];
+    entry.coins = coins;
+    entry.flags = CCoinsCacheEntry::DIRTY;
+}
+
+void Commit(CCoinsViewWriteBehind *view, bool *pfOk)
+{
+    *pfOk = view->Commit();
+}
+
+void BatchWrite(CCoinsViewWriteBehind *view, CCoinsMap *pmapCoins, uint256 hashBlock, bool *pfOk)
+{
+    *pfOk = view->BatchWrite(*pmapCoins, hashBlock);
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(writebehind_tests)
+
+BOOST_AUTO_TEST_CASE(writebehind_read_during_flush)
+{
+    CCoinsViewGated base;
+    CCoinsViewWriteBehind view(&base);
+    uint256 txidOld = GetRandHash(), txidNew = GetRandHash(), txidSpent = GetRandHash();
+    uint256 hashBlock1 = GetRandHash(), hashBlock2 = GetRandHash();
+
+    CCoinsMap mapCoins;
+    AddCoins(mapCoins, txidOld, MakeCoins(1));
+    AddCoins(mapCoins, txidSpent, MakeCoins(2));
+    BOOST_REQUIRE(view.BatchWrite(mapCoins, hashBlock1));
+    BOOST_CHECK(mapCoins.empty());
+    BOOST_REQUIRE(view.Commit());
+    BOOST_CHECK(base.GetBestBlock() == hashBlock1);
+
+    // The second batch adds one entry and spends another.
+    AddCoins(mapCoins, txidNew, MakeCoins(3));
+    AddCoins(mapCoins, txidSpent, CCoins());
+    BOOST_REQUIRE(view.BatchWrite(mapCoins, hashBlock2));
+
+    // Reads are answered from the pending batch while it is being written.
+    base.Hold();
+    bool fOk = false;
+    boost::thread thread(boost::bind(&Commit, &view, &fOk));
+    base.WaitWriting();
+    CCoins coins;
+    BOOST_CHECK(view.GetBestBlock() == hashBlock2);
+    BOOST_CHECK(view.GetCoins(txidNew, coins) && coins.vout[0].nValue == 3);
+    BOOST_CHECK(view.HaveCoins(txidNew));
+    BOOST_CHECK(!view.HaveCoins(txidSpent));
+    BOOST_CHECK(view.GetCoins(txidOld, coins) && coins.vout[0].nValue == 1);
+    BOOST_CHECK(!base.GetCoins(txidNew, coins));
+    base.Release();
+    thread.join();
+    BOOST_CHECK(fOk);
+
+    // Once committed, they come from the backing view.
+    BOOST_CHECK(base.GetBestBlock() == hashBlock2);
+    BOOST_CHECK(view.GetBestBlock() == hashBlock2);
+    BOOST_CHECK(base.GetCoins(txidNew, coins) && coins.vout[0].nValue == 3);
+    BOOST_CHECK(view.HaveCoins(txidNew));
+    BOOST_CHECK(!view.HaveCoins(txidSpent));
+}
+
+BOOST_AUTO_TEST_CASE(writebehind_flush_failure)
+{
+    CCoinsViewGated base;
+    CCoinsViewWriteBehind view(&base);
+    uint256 txid = GetRandHash(), hashBlock = GetRandHash();
+
+    CCoinsMap mapCoins;
+    AddCoins(mapCoins, txid, MakeCoins(5));
+    BOOST_REQUIRE(view.BatchWrite(mapCoins, hashBlock));
+
+    // A failed write keeps the batch pending, and still served.
+    base.SetFail(true);
+    BOOST_CHECK(!view.Commit());
+    CCoins coins;
+    BOOST_CHECK(view.GetBestBlock() == hashBlock);
+    BOOST_CHECK(view.GetCoins(txid, coins) && coins.vout[0].nValue == 5);
+    BOOST_CHECK(!base.GetCoins(txid, coins));
+
+    // Nothing is lost when writing it again.
+    base.SetFail(false);
+    BOOST_CHECK(view.Commit());
+    BOOST_CHECK(base.GetBestBlock() == hashBlock);
+    BOOST_CHECK(base.GetCoins(txid, coins) && coins.vout[0].nValue == 5);
+    BOOST_CHECK(view.Commit());
+}
+
+BOOST_AUTO_TEST_CASE(writebehind_drain)
+{
+    CCoinsViewGated base;
+    CCoinsViewWriteBehind view(&base);
+    uint256 txid1 = GetRandHash(), txid2 = GetRandHash();
+    uint256 hashBlock1 = GetRandHash(), hashBlock2 = GetRandHash();
+
+    // Committing with nothing pending writes nothing.
+    BOOST_CHECK(view.Commit());
+    BOOST_CHECK(base.GetBestBlock() == 0);
+
+    CCoinsMap mapCoins1, mapCoins2;
+    AddCoins(mapCoins1, txid1, MakeCoins(1));
+    AddCoins(mapCoins2, txid2, MakeCoins(2));
+    BOOST_REQUIRE(view.BatchWrite(mapCoins1, hashBlock1));
+
+    // The next batch is only taken over once the pending one is written.
+    bool fOk = false;
+    boost::thread thread(boost::bind(&BatchWrite, &view, &mapCoins2, hashBlock2, &fOk));
+    MilliSleep(50);
+    BOOST_CHECK(!fOk);
+    BOOST_CHECK(view.GetBestBlock() == hashBlock1);
+    BOOST_CHECK(view.Commit());
+    thread.join();
+    BOOST_CHECK(fOk);
+    BOOST_CHECK(base.GetBestBlock() == hashBlock1);
+    BOOST_CHECK(view.GetBestBlock() == hashBlock2);
+
+    // Draining on shutdown leaves everything in the backing view.
+    BOOST_CHECK(view.Commit());
+    CCoins coins;
+    BOOST_CHECK(base.GetBestBlock() == hashBlock2);
+    BOOST_CHECK(base.GetCoins(txid1, coins) && coins.vout[0].nValue == 1);
+    BOOST_CHECK(base.GetCoins(txid2, coins) && coins.vout[0].nValue == 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -5,11 +5,17 @@
 
 #include "txdb.h"
 
+#include "crypto/common.h"
+#include "orderedqueue.h"
 #include "pow.h"
 #include "uint256.h"
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <set>
+
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -47,14 +53,13 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    // mapCoins is left as is: CCoinsViewWriteBehind keeps serving reads from it.
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             BatchWriteCoins(batch, it->first, it->second.coins);
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
     if (hashBlock != uint256(0))
         BatchWriteHashBestChain(batch, hashBlock);
@@ -63,6 +68,165 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return db.WriteBatch(batch);
 }
 
+CCoinsViewWriteBehind::CCoinsViewWriteBehind(CCoinsView *viewIn) : CCoinsViewBacked(viewIn), hashBlock(0), fPending(false) {
+}
+
+bool CCoinsViewWriteBehind::GetCoins(const uint256 &txid, CCoins &coins) const {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fPending) {
+            CCoinsMap::const_iterator it = cacheCoins.find(txid);
+            if (it != cacheCoins.end()) {
+                coins = it->second.coins;
+                return true;
+            }
+        }
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewWriteBehind::HaveCoins(const uint256 &txid) const {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fPending) {
+            CCoinsMap::const_iterator it = cacheCoins.find(txid);
+            if (it != cacheCoins.end())
+                return !it->second.coins.IsPruned();
+        }
+    }
+    return base->HaveCoins(txid);
+}
+
+uint256 CCoinsViewWriteBehind::GetBestBlock() const {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fPending)
+            return hashBlock;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewWriteBehind::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (fPending)
+        cond.wait(lock);
+    cacheCoins.swap(mapCoins);
+    hashBlock = hashBlockIn;
+    fPending = true;
+    return true;
+}
+
+bool CCoinsViewWriteBehind::Commit() {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!fPending)
+            return true;
+    }
+    // Only this thread changes the batch while it is pending, and readers
+    // only look up entries, so no lock is needed to write it out.
+    if (!base->BatchWrite(cacheCoins, hashBlock))
+        return false;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        cacheCoins.clear();
+        fPending = false;
+    }
+    cond.notify_all();
+    return true;
+}
+
+CCoinsViewPrefetch::CCoinsViewPrefetch(CCoinsView *viewIn, size_t nMaxUsageIn) : CCoinsViewBacked(viewIn), cachedCoinsUsage(0), nMaxUsage(nMaxUsageIn), nGeneration(0) {
+}
+
+void CCoinsViewPrefetch::Clear() {
+    cacheCoins.clear();
+    cachedCoinsUsage = 0;
+    nGeneration++;
+}
+
+bool CCoinsViewPrefetch::GetCoins(const uint256 &txid, CCoins &coins) const {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CCoinsMap::iterator it = cacheCoins.find(txid);
+        if (it != cacheCoins.end()) {
+            cachedCoinsUsage -= it->second.coins.DynamicMemoryUsage();
+            coins.swap(it->second.coins);
+            cacheCoins.erase(it);
+            return true;
+        }
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewPrefetch::HaveCoins(const uint256 &txid) const {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (cacheCoins.find(txid) != cacheCoins.end())
+            return true;
+    }
+    return base->HaveCoins(txid);
+}
+
+bool CCoinsViewPrefetch::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        Clear();
+    }
+    bool fOk = base->BatchWrite(mapCoins, hashBlock);
+    {
+        // Anything read while the write was in progress may be stale too.
+        boost::unique_lock<boost::mutex> lock(mutex);
+        Clear();
+    }
+    return fOk;
+}
+
+void CCoinsViewPrefetch::Prefetch(const std::vector<uint256> &vTxid) {
+    if (vTxid.empty())
+        return;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        queue.insert(queue.end(), vTxid.begin(), vTxid.end());
+    }
+    cond.notify_all();
+}
+
+void CCoinsViewPrefetch::Thread() {
+    while (true) {
+        uint256 txid;
+        uint64_t nGenerationRead;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (queue.empty())
+                cond.wait(lock);
+            txid = queue.front();
+            queue.pop_front();
+            if (cacheCoins.find(txid) != cacheCoins.end())
+                continue;
+            // Entries nobody asked for (because the cache above already had
+            // them) stay until the next write; start over if they pile up.
+            if (cachedCoinsUsage + cacheCoins.DynamicMemoryUsage() >= nMaxUsage) {
+                cacheCoins.clear();
+                cachedCoinsUsage = 0;
+            }
+            nGenerationRead = nGeneration;
+        }
+        CCoins coins;
+        if (!base->GetCoins(txid, coins))
+            continue;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (nGenerationRead != nGeneration)
+                continue;
+            std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+            if (ret.second) {
+                ret.first->second.coins.swap(coins);
+                cachedCoinsUsage += ret.first->second.coins.DynamicMemoryUsage();
+            }
+        }
+    }
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
 }
 
@@ -99,17 +263,49 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read('l', nFile);
 }
 
-bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
+void ApplyCoinsStats(CHashWriter &ss, CCoinsStats &stats, const uint256 &txid, const CCoins &coins) {
+    ss << txid;
+    ss << VARINT(coins.nVersion);
+    ss << (coins.fCoinBase ? 'c' : 'n');
+    ss << VARINT(coins.nHeight);
+    stats.nTransactions++;
+    for (unsigned int i=0; i<coins.vout.size(); i++) {
+        const CTxOut &out = coins.vout[i];
+        if (!out.IsNull()) {
+            stats.nTransactionOutputs++;
+            ss << VARINT(i+1);
+            ss << out;
+            stats.nTotalAmount += out.nValue;
+        }
+    }
+    ss << VARINT(0);
+}
+
+bool CCoinsViewDB::ScanCoins(CCoinsStats &stats, CAutoFile *pfileout, CUtxoStats *putxostats) const {
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
     boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
+
+    // Take the best block from the iterator too, as the coins may be written
+    // again while they are scanned.
+    CDataStream ssKeyBest(SER_DISK, CLIENT_VERSION);
+    ssKeyBest << 'B';
+    pcursor->Seek(leveldb::Slice(&ssKeyBest[0], ssKeyBest.size()));
+    stats.hashBlock = 0;
+    if (pcursor->Valid() && pcursor->key() == leveldb::Slice(&ssKeyBest[0], ssKeyBest.size())) {
+        try {
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> stats.hashBlock;
+        } catch (std::exception &e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
     pcursor->SeekToFirst();
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
@@ -124,43 +320,72 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
                 ssValue >> coins;
                 uint256 txhash;
                 ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
+                ApplyCoinsStats(ss, stats, txhash, coins);
                 stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
+                if (pfileout)
+                    *pfileout << txhash << coins;
+                if (putxostats)
+                    putxostats->AddCoins(txhash, coins);
             }
             pcursor->Next();
         } catch (std::exception &e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
     }
-    stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(stats.hashBlock);
+        stats.nHeight = mi != mapBlockIndex.end() ? mi->second->nHeight : 0;
+    }
     stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
-bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
-    return Read(make_pair('t', txid), pos);
+bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
+    return ScanCoins(stats, NULL, NULL);
 }
 
-bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
-    CLevelDBBatch batch;
-    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(make_pair('t', it->first), it->second);
-    return WriteBatch(batch);
+bool CCoinsViewDB::GetUtxoStats(CUtxoStats &utxostats, CCoinsStats *pstats) const {
+    CCoinsStats stats;
+    if (!ScanCoins(stats, NULL, &utxostats))
+        return false;
+    utxostats.hashBlock = stats.hashBlock;
+    if (pstats)
+        *pstats = stats;
+    return true;
+}
+
+bool CCoinsViewDB::DumpSnapshot(CAutoFile &fileout, CCoinsStats &stats) const {
+    if (!ScanCoins(stats, &fileout, NULL))
+        return false;
+    try {
+        fileout << uint256(0) << stats.nTransactions << stats.hashSerialized;
+    } catch (std::exception &e) {
+        return error("%s : I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool ReadCoinsSnapshotStats(CAutoFile &filein, const CCoinsSnapshotHeader &header, CCoinsStats &stats) {
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    stats.hashBlock = header.hashBlock;
+    stats.nHeight = header.nHeight;
+    ss << stats.hashBlock;
+    while (true) {
+        boost::this_thread::interruption_point();
+        uint256 txid;
+        filein >> txid;
+        if (txid == 0)
+            break;
+        CCoins coins;
+        filein >> coins;
+        ApplyCoinsStats(ss, stats, txid, coins);
+    }
+    stats.hashSerialized = ss.GetHash();
+    uint64_t nTransactions;
+    uint256 hashSerialized;
+    filein >> nTransactions >> hashSerialized;
+    return nTransactions == stats.nTransactions && hashSerialized == stats.hashSerialized;
 }
 
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
@@ -175,8 +400,139 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+bool CBlockTreeDB::EraseLegacyTxIndex(uint64_t &nErased) {
+    // Versions that kept the transaction index here set the "txindex" flag,
+    // which is erased last, so that an interrupted cleanup resumes.
+    bool fTxIndex;
+    nErased = 0;
+    if (!ReadFlag("txindex", fTxIndex))
+        return true;
+
+    static const unsigned int ERASE_BATCH_SIZE = 100000;
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('t', uint256(0));
+    pcursor->Seek(ssKeySet.str());
+    bool fEnd = false;
+    while (!fEnd) {
+        CLevelDBBatch batch;
+        unsigned int nBatch = 0;
+        while (nBatch < ERASE_BATCH_SIZE) {
+            fEnd = !pcursor->Valid();
+            if (fEnd)
+                break;
+            try {
+                leveldb::Slice slKey = pcursor->key();
+                CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+                char chType;
+                uint256 txid;
+                ssKey >> chType;
+                if (chType != 't') {
+                    fEnd = true;
+                    break;
+                }
+                ssKey >> txid;
+                batch.Erase(make_pair('t', txid));
+                nBatch++;
+                pcursor->Next();
+            } catch (std::exception &e) {
+                return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+            }
+        }
+        if (fEnd)
+            batch.Erase(make_pair('F', std::string("txindex")));
+        if (!WriteBatch(batch))
+            return false;
+        nErased += nBatch;
+    }
+    return true;
+}
+
+bool CBlockTreeDB::WriteSnapshotBase(const uint256 &hash, uint64_t nChainTx) {
+    return Write('S', std::make_pair(hash, nChainTx));
+}
+
+bool CBlockTreeDB::WriteUtxoStats(const CUtxoStats &stats) {
+    return Write(std::make_pair('U', stats.hashBlock), stats);
+}
+
+bool CBlockTreeDB::ReadUtxoStats(const uint256 &hashBlock, CUtxoStats &stats) {
+    return Read(std::make_pair('U', hashBlock), stats);
+}
+
+bool CBlockTreeDB::EraseUtxoStats(const uint256 &hashBlock) {
+    return Erase(std::make_pair('U', hashBlock));
+}
+
+bool CBlockTreeDB::ReadSnapshotBase(uint256 &hash, uint64_t &nChainTx) {
+    std::pair<uint256, uint64_t> base;
+    if (!Read('S', base))
+        return false;
+    hash = base.first;
+    nChainTx = base.second;
+    return true;
+}
+
+namespace {
+
+/** Consecutive block index entries, as read from the database and once deserialized */
+struct CBlockIndexBatch
+{
+    std::vector<std::string> vValue;
+    std::vector<std::pair<uint256, CDiskBlockIndex> > vIndex;
+    std::string strError;
+    bool fDone;
+
+    CBlockIndexBatch() : fDone(false) {}
+
+    void Decode() {
+        vIndex.resize(vValue.size());
+        try {
+            bool fSampled = false;
+            for (unsigned int i = 0; i < vValue.size(); i++) {
+                CDataStream ssValue(vValue[i].data(), vValue[i].data() + vValue[i].size(), SER_DISK, CLIENT_VERSION);
+                CDiskBlockIndex& diskindex = vIndex[i].second;
+                ssValue >> diskindex;
+                vIndex[i].first = diskindex.GetBlockHash();
+
+                // Florincoin: Recomputing every scrypt PoW hash here would take several minutes on
+                // every startup, so only entries carrying their stored PoW hash are checked against
+                // their target. Entries written by older versions get their hash filled in, and all
+                // stored hashes can be recomputed, by the background -verifypowindex thread.
+                if ((diskindex.nStatus & BLOCK_HAVE_POWHASH) && !CheckProofOfWork(diskindex.hashPoW, diskindex.nBits)) {
+                    strError = strprintf("CheckProofOfWork failed: %s", diskindex.ToString());
+                    break;
+                }
+                // A stored hash can still be wrong for its header while meeting the target,
+                // so the first one of each batch is recomputed, which catches a corrupted or
+                // misaligned database without hashing everything.
+                if ((diskindex.nStatus & BLOCK_HAVE_POWHASH) && !fSampled) {
+                    fSampled = true;
+                    if (diskindex.GetBlockHeader().GetPoWHash() != diskindex.hashPoW) {
+                        strError = strprintf("Stored PoW hash mismatch: %s", diskindex.ToString());
+                        break;
+                    }
+                }
+            }
+        } catch (std::exception &e) {
+            strError = strprintf("Deserialize or I/O error - %s", e.what());
+        }
+        std::vector<std::string>().swap(vValue);
+    }
+};
+
+} // anon namespace
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
+    // Entries are read off the database by this thread, deserialized (which
+    // includes hashing their header) in batches by worker threads, and put in
+    // mapBlockIndex by this thread again, in the order they were read.
+    static const unsigned int BATCH_SIZE = 1024;
+    const int nWorkers = std::max(nScriptCheckThreads, 0);
+    const size_t nMaxBatches = 2 * (nWorkers + 1);
+    COrderedWorkQueue<CBlockIndexBatch> decoder(nWorkers, boost::bind(&CBlockIndexBatch::Decode, _1));
+
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
 
     CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
@@ -184,21 +540,43 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
     pcursor->Seek(ssKeySet.str());
 
     // Load mapBlockIndex
-    while (pcursor->Valid()) {
+    CBlockIndexBatch batch;
+    bool fEnd = false;
+    while (!fEnd) {
         boost::this_thread::interruption_point();
-        try {
-            leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'b') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CDiskBlockIndex diskindex;
-                ssValue >> diskindex;
+        fEnd = !pcursor->Valid();
+        if (!fEnd) {
+            try {
+                leveldb::Slice slKey = pcursor->key();
+                CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+                char chType;
+                ssKey >> chType;
+                if (chType == 'b') {
+                    leveldb::Slice slValue = pcursor->value();
+                    batch.vValue.push_back(std::string(slValue.data(), slValue.size()));
+                    pcursor->Next();
+                } else {
+                    fEnd = true; // finished loading block index
+                }
+            } catch (std::exception &e) {
+                return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+            }
+        }
 
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
+        if (batch.vValue.size() == BATCH_SIZE || (fEnd && !batch.vValue.empty())) {
+            CBlockIndexBatch* pbatch = new CBlockIndexBatch();
+            pbatch->vValue.swap(batch.vValue);
+            decoder.Push(pbatch);
+        }
+
+        // Construct block index objects for the decoded batches, leaving some for the workers
+        while (decoder.size() > (fEnd ? 0 : nMaxBatches)) {
+            boost::scoped_ptr<CBlockIndexBatch> pdecoded(decoder.Pop());
+            if (!pdecoded->strError.empty())
+                return error("LoadBlockIndex() : %s", pdecoded->strError);
+            for (unsigned int i = 0; i < pdecoded->vIndex.size(); i++) {
+                const CDiskBlockIndex& diskindex = pdecoded->vIndex[i].second;
+                CBlockIndex* pindexNew = InsertBlockIndex(pdecoded->vIndex[i].first);
                 pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
                 pindexNew->nHeight        = diskindex.nHeight;
                 pindexNew->nFile          = diskindex.nFile;
@@ -211,24 +589,414 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 pindexNew->nNonce         = diskindex.nNonce;
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nTx            = diskindex.nTx;
+                pindexNew->hashPoW        = diskindex.hashPoW;
+            }
+        }
+    }
 
-                // Florincoin: Disable PoW Sanity check while loading block index from disk.
-                // We use the sha256 hash for the block index for performance reasons, which is recorded for later use.
-                // CheckProofOfWork() uses the scrypt hash which is discarded after a block is accepted.
-                // While it is technically feasible to verify the PoW, doing so takes several minutes as it
-                // requires recomputing every PoW hash during every Florincoin startup.
-                // We opt instead to simply trust the data that is on your local disk.
-                //if (!CheckProofOfWork(pindexNew->GetBlockPoWHash(), pindexNew->nBits))
-                //    return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
+    return true;
+}
 
-                pcursor->Next();
-            } else {
-                break; // if shutdown requested or finished loading block index
+CTxIndexDB::CTxIndexDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "txindex", nCacheSize, fMemory, fWipe) {
+}
+
+bool CTxIndexDB::ReadTxPos(const uint256 &txid, CDiskTxPos &pos) const {
+    return Read(make_pair('t', txid), pos);
+}
+
+bool CTxIndexDB::WriteTxPos(const std::vector<std::pair<uint256, CDiskTxPos> > &vPos, const CBlockLocator &locator) {
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<uint256, CDiskTxPos> >::const_iterator it = vPos.begin(); it != vPos.end(); it++)
+        batch.Write(make_pair('t', it->first), it->second);
+    batch.Write('B', locator);
+    return WriteBatch(batch);
+}
+
+bool CTxIndexDB::ReadBestBlock(CBlockLocator &locator) const {
+    return Read('B', locator);
+}
+
+std::vector<std::string> GetCommentKeywords(const std::string &strComment)
+{
+    std::set<std::string> setKeywords;
+    std::string strWord;
+    for (size_t i = 0; i <= strComment.size() && setKeywords.size() < MAX_COMMENT_KEYWORDS; i++) {
+        char c = i < strComment.size() ? strComment[i] : ' ';
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+            // Longer words are not indexed, so there is no need to keep them whole.
+            if (strWord.size() <= MAX_COMMENT_KEYWORD_SIZE)
+                strWord += c;
+        } else {
+            if (strWord.size() >= MIN_COMMENT_KEYWORD_SIZE && strWord.size() <= MAX_COMMENT_KEYWORD_SIZE)
+                setKeywords.insert(strWord);
+            strWord.clear();
+        }
+    }
+    return std::vector<std::string>(setKeywords.begin(), setKeywords.end());
+}
+
+namespace {
+
+/** A key written without a length, so that keys sort bytewise by their contents */
+class CRawKey
+{
+public:
+    std::string str;
+
+    explicit CRawKey(const std::string &strIn) : str(strIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return str.size();
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        s.write(str.data(), str.size());
+    }
+};
+
+//! Size of a (height, position, txid) key suffix
+const size_t COMMENT_KEY_SUFFIX_SIZE = 4 + 4 + 32;
+
+// Heights and positions are written big-endian, so that they sort numerically.
+std::string CommentKeySuffix(int nHeight, unsigned int nTx, const uint256 &txid)
+{
+    unsigned char buf[8];
+    WriteBE32(buf, nHeight);
+    WriteBE32(buf + 4, nTx);
+    return std::string((const char*)buf, sizeof(buf)) + std::string((const char*)txid.begin(), txid.size());
+}
+
+void ParseCommentKeySuffix(const char* p, CTxComment &comment)
+{
+    comment.nHeight = ReadBE32((const unsigned char*)p);
+    comment.nTx = ReadBE32((const unsigned char*)p + 4);
+    memcpy(comment.txid.begin(), p + 8, comment.txid.size());
+}
+
+CRawKey CommentHeightKey(const CTxComment &comment)
+{
+    return CRawKey("h" + CommentKeySuffix(comment.nHeight, comment.nTx, comment.txid));
+}
+
+CRawKey CommentPrefixKey(const CTxComment &comment)
+{
+    return CRawKey("p" + comment.strComment.substr(0, COMMENT_PREFIX_SIZE) + std::string((const char*)comment.txid.begin(), comment.txid.size()));
+}
+
+CRawKey CommentKeywordKey(const std::string &strKeyword, const CTxComment &comment)
+{
+    return CRawKey("w" + strKeyword + '\0' + CommentKeySuffix(comment.nHeight, comment.nTx, comment.txid));
+}
+
+} // anon namespace
+
+CCommentIndexDB::CCommentIndexDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "commentindex", nCacheSize, fMemory, fWipe) {
+}
+
+bool CCommentIndexDB::ReadComment(const uint256 &txid, CTxComment &comment) const {
+    std::pair<int, unsigned int> pos;
+    if (!Read(make_pair('c', txid), pos))
+        return false;
+    comment.txid = txid;
+    comment.nHeight = pos.first;
+    comment.nTx = pos.second;
+    return Read(CommentHeightKey(comment), comment.strComment);
+}
+
+bool CCommentIndexDB::WriteComments(const std::vector<CTxComment> &vErase, const std::vector<CTxComment> &vWrite, const CBlockLocator &locator) {
+    CLevelDBBatch batch;
+    for (std::vector<CTxComment>::const_iterator it = vErase.begin(); it != vErase.end(); it++) {
+        batch.Erase(make_pair('c', it->txid));
+        batch.Erase(CommentHeightKey(*it));
+        batch.Erase(CommentPrefixKey(*it));
+        std::vector<std::string> vKeyword = GetCommentKeywords(it->strComment);
+        for (unsigned int i = 0; i < vKeyword.size(); i++)
+            batch.Erase(CommentKeywordKey(vKeyword[i], *it));
+    }
+    for (std::vector<CTxComment>::const_iterator it = vWrite.begin(); it != vWrite.end(); it++) {
+        std::pair<int, unsigned int> pos(it->nHeight, it->nTx);
+        batch.Write(make_pair('c', it->txid), pos);
+        batch.Write(CommentHeightKey(*it), it->strComment);
+        batch.Write(CommentPrefixKey(*it), pos);
+        std::vector<std::string> vKeyword = GetCommentKeywords(it->strComment);
+        for (unsigned int i = 0; i < vKeyword.size(); i++)
+            batch.Write(CommentKeywordKey(vKeyword[i], *it), '\0');
+    }
+    batch.Write('B', locator);
+    return WriteBatch(batch);
+}
+
+bool CCommentIndexDB::ReadBestBlock(CBlockLocator &locator) const {
+    return Read('B', locator);
+}
+
+bool CCommentIndexDB::FindByHeight(int nStartHeight, int nEndHeight, unsigned int nMaxResults, std::vector<CTxComment> &vComment) const {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CCommentIndexDB*>(this)->NewIterator());
+    try {
+        unsigned int nFound = 0;
+        for (pcursor->Seek("h" + CommentKeySuffix(std::max(nStartHeight, 0), 0, uint256(0))); pcursor->Valid() && nFound < nMaxResults; pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            if (slKey.size() != 1 + COMMENT_KEY_SUFFIX_SIZE || slKey[0] != 'h')
+                break;
+            CTxComment comment;
+            ParseCommentKeySuffix(slKey.data() + 1, comment);
+            if (comment.nHeight > nEndHeight)
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> comment.strComment;
+            vComment.push_back(comment);
+            nFound++;
+        }
+    } catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool CCommentIndexDB::FindByPrefix(const std::string &strPrefix, int nStartHeight, unsigned int nMaxResults, std::vector<CTxComment> &vComment) const {
+    std::string strHead = strPrefix.substr(0, COMMENT_PREFIX_SIZE);
+    std::string strSeek = "p" + strHead;
+    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CCommentIndexDB*>(this)->NewIterator());
+    try {
+        unsigned int nFound = 0;
+        for (pcursor->Seek(strSeek); pcursor->Valid() && nFound < nMaxResults; pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            if (!slKey.starts_with(strSeek))
+                break;
+            // Shorter comments whose txid happens to continue the prefix sort in between.
+            if (slKey.size() < strSeek.size() + 32)
+                continue;
+            CTxComment comment;
+            memcpy(comment.txid.begin(), slKey.data() + slKey.size() - 32, 32);
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            std::pair<int, unsigned int> pos;
+            ssValue >> pos;
+            comment.nHeight = pos.first;
+            comment.nTx = pos.second;
+            if (comment.nHeight < nStartHeight)
+                continue;
+            if (!Read(CommentHeightKey(comment), comment.strComment))
+                return error("%s : comment of %s not found", __func__, comment.txid.ToString());
+            if (comment.strComment.compare(0, strPrefix.size(), strPrefix) != 0)
+                continue;
+            vComment.push_back(comment);
+            nFound++;
+        }
+    } catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool CCommentIndexDB::FindByKeyword(const std::string &strKeyword, int nStartHeight, unsigned int nMaxResults, std::vector<CTxComment> &vComment) const {
+    std::string strKey = "w" + strKeyword + '\0';
+    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CCommentIndexDB*>(this)->NewIterator());
+    try {
+        unsigned int nFound = 0;
+        for (pcursor->Seek(strKey + CommentKeySuffix(std::max(nStartHeight, 0), 0, uint256(0))); pcursor->Valid() && nFound < nMaxResults; pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            if (!slKey.starts_with(strKey) || slKey.size() != strKey.size() + COMMENT_KEY_SUFFIX_SIZE)
+                break;
+            CTxComment comment;
+            ParseCommentKeySuffix(slKey.data() + strKey.size(), comment);
+            if (!Read(CommentHeightKey(comment), comment.strComment))
+                return error("%s : comment of %s not found", __func__, comment.txid.ToString());
+            vComment.push_back(comment);
+            nFound++;
+        }
+    } catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+namespace {
+
+//! Size of a (height, position, txid, index, spending) history key suffix
+const size_t ADDRESS_KEY_SUFFIX_SIZE = 4 + 4 + 32 + 4 + 1;
+
+std::string AddressScriptKey(char chType, const uint160 &hashScript)
+{
+    return chType + std::string((const char*)hashScript.begin(), hashScript.size());
+}
+
+// As in the comment index, numbers are written big-endian to sort numerically.
+std::string AddressHistoryKeySuffix(int nHeight, unsigned int nTx)
+{
+    unsigned char buf[8];
+    WriteBE32(buf, nHeight);
+    WriteBE32(buf + 4, nTx);
+    return std::string((const char*)buf, sizeof(buf));
+}
+
+CRawKey AddressHistoryKey(const CAddressDelta &delta)
+{
+    unsigned char buf[5];
+    WriteBE32(buf, delta.nIndex);
+    buf[4] = delta.fSpending ? 1 : 0;
+    return CRawKey(AddressScriptKey('h', delta.hashScript) + AddressHistoryKeySuffix(delta.nHeight, delta.nTx) +
+                   std::string((const char*)delta.txid.begin(), delta.txid.size()) + std::string((const char*)buf, sizeof(buf)));
+}
+
+void ParseAddressHistoryKeySuffix(const char* p, CAddressDelta &delta)
+{
+    delta.nHeight = ReadBE32((const unsigned char*)p);
+    delta.nTx = ReadBE32((const unsigned char*)p + 4);
+    memcpy(delta.txid.begin(), p + 8, delta.txid.size());
+    delta.nIndex = ReadBE32((const unsigned char*)p + 40);
+    delta.fSpending = p[44] != 0;
+}
+
+} // anon namespace
+
+CAddressIndexDB::CAddressIndexDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "addressindex", nCacheSize, fMemory, fWipe) {
+}
+
+bool CAddressIndexDB::ReadDelta(CAddressDelta &delta) const {
+    std::pair<CAmount, std::pair<COutPoint, int> > value;
+    if (!Read(AddressHistoryKey(delta), value))
+        return false;
+    delta.nValue = value.first;
+    delta.prevout = value.second.first;
+    delta.nPrevHeight = value.second.second;
+    return true;
+}
+
+bool CAddressIndexDB::ReadUnspent(const CAddressUnspentKey &key, CAddressUnspentValue &value) const {
+    return Read(make_pair('u', key), value);
+}
+
+bool CAddressIndexDB::ReadBalance(const uint160 &hashScript, CAmount &nBalance, CAmount &nReceived) const {
+    std::pair<CAmount, CAmount> balance(0, 0);
+    if (Exists(make_pair('b', hashScript)) && !Read(make_pair('b', hashScript), balance))
+        return false;
+    nBalance = balance.first;
+    nReceived = balance.second;
+    return true;
+}
+
+bool CAddressIndexDB::WriteDeltas(const std::vector<CAddressDelta> &vErase, const std::vector<CAddressDelta> &vWrite, const std::map<CAddressUnspentKey, CAddressUnspentValue> &mapUnspent, const CBlockLocator &locator) {
+    CLevelDBBatch batch;
+    // Changes to the balance and the amount received of each script
+    std::map<uint160, std::pair<CAmount, CAmount> > mapBalance;
+    for (std::vector<CAddressDelta>::const_iterator it = vErase.begin(); it != vErase.end(); it++) {
+        batch.Erase(AddressHistoryKey(*it));
+        std::pair<CAmount, CAmount> &balance = mapBalance[it->hashScript];
+        balance.first -= it->nValue;
+        if (!it->fSpending)
+            balance.second -= it->nValue;
+    }
+    for (std::vector<CAddressDelta>::const_iterator it = vWrite.begin(); it != vWrite.end(); it++) {
+        batch.Write(AddressHistoryKey(*it), make_pair(it->nValue, make_pair(it->prevout, it->nPrevHeight)));
+        std::pair<CAmount, CAmount> &balance = mapBalance[it->hashScript];
+        balance.first += it->nValue;
+        if (!it->fSpending)
+            balance.second += it->nValue;
+    }
+    for (std::map<uint160, std::pair<CAmount, CAmount> >::const_iterator it = mapBalance.begin(); it != mapBalance.end(); it++) {
+        CAmount nBalance, nReceived;
+        if (!ReadBalance(it->first, nBalance, nReceived))
+            return false;
+        nBalance += it->second.first;
+        nReceived += it->second.second;
+        // Nothing is left of a script whose history was rewound entirely.
+        if (nBalance == 0 && nReceived == 0)
+            batch.Erase(make_pair('b', it->first));
+        else
+            batch.Write(make_pair('b', it->first), make_pair(nBalance, nReceived));
+    }
+    for (std::map<CAddressUnspentKey, CAddressUnspentValue>::const_iterator it = mapUnspent.begin(); it != mapUnspent.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(make_pair('u', it->first));
+        else
+            batch.Write(make_pair('u', it->first), it->second);
+    }
+    batch.Write('B', locator);
+    return WriteBatch(batch);
+}
+
+bool CAddressIndexDB::ReadBestBlock(CBlockLocator &locator) const {
+    return Read('B', locator);
+}
+
+bool CAddressIndexDB::FindDeltas(const uint160 &hashScript, int nStartHeight, int nEndHeight, unsigned int nSkipTxs, unsigned int nMaxTxs, std::vector<CAddressDelta> &vDelta) const {
+    std::string strKey = AddressScriptKey('h', hashScript);
+    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CAddressIndexDB*>(this)->NewIterator());
+    try {
+        unsigned int nTxs = 0;
+        int nLastHeight = -1;
+        unsigned int nLastTx = 0;
+        bool fSkip = false;
+        for (pcursor->Seek(strKey + AddressHistoryKeySuffix(std::max(nStartHeight, 0), 0)); pcursor->Valid(); pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            if (!slKey.starts_with(strKey) || slKey.size() != strKey.size() + ADDRESS_KEY_SUFFIX_SIZE)
+                break;
+            CAddressDelta delta;
+            delta.hashScript = hashScript;
+            ParseAddressHistoryKeySuffix(slKey.data() + strKey.size(), delta);
+            if (delta.nHeight > nEndHeight)
+                break;
+            // The deltas of a transaction are adjacent; stop before a transaction too many.
+            if (delta.nHeight != nLastHeight || delta.nTx != nLastTx) {
+                fSkip = nSkipTxs > 0;
+                if (fSkip) {
+                    nSkipTxs--;
+                } else {
+                    if (nTxs == nMaxTxs)
+                        break;
+                    nTxs++;
+                }
+                nLastHeight = delta.nHeight;
+                nLastTx = delta.nTx;
             }
-        } catch (std::exception &e) {
-            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+            if (fSkip)
+                continue;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            std::pair<CAmount, std::pair<COutPoint, int> > value;
+            ssValue >> value;
+            delta.nValue = value.first;
+            delta.prevout = value.second.first;
+            delta.nPrevHeight = value.second.second;
+            vDelta.push_back(delta);
         }
+    } catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
+    return true;
+}
 
+bool CAddressIndexDB::FindUnspent(const uint160 &hashScript, unsigned int nSkip, unsigned int nMaxResults, std::vector<std::pair<COutPoint, CAddressUnspentValue> > &vUnspent) const {
+    std::string strKey = AddressScriptKey('u', hashScript);
+    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CAddressIndexDB*>(this)->NewIterator());
+    try {
+        unsigned int nFound = 0;
+        for (pcursor->Seek(strKey); pcursor->Valid() && nFound < nMaxResults; pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            if (!slKey.starts_with(strKey))
+                break;
+            if (nSkip > 0) {
+                nSkip--;
+                continue;
+            }
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            CAddressUnspentKey key;
+            ssKey >> chType >> key;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAddressUnspentValue value;
+            ssValue >> value;
+            vUnspent.push_back(make_pair(key.second, value));
+            nFound++;
+        }
+    } catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
     return true;
 }
@@ -9,26 +9,75 @@
 #include "leveldbwrapper.h"
 #include "main.h"
 
+#include <deque>
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CAutoFile;
 class CCoins;
+class CHashWriter;
 class uint256;
 
 //! -dbcache default (MiB)
 static const int64_t nDefaultDbCache = 100;
 //! max. -dbcache in (MiB)
-static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
+static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
 
+/**
+ * Header of a UTXO set snapshot file. It is followed by (txid, CCoins) records
+ * in txid order, a null txid, the number of records and the UTXO set hash.
+ */
+class CCoinsSnapshotHeader
+{
+public:
+    static const int CURRENT_VERSION = 1;
+
+    unsigned char pchMessageStart[MESSAGE_START_SIZE];
+    int nVersion;
+    uint256 hashBlock;
+    int nHeight;
+    //! nChainTx of the block the snapshot was taken at
+    uint64_t nChainTx;
+
+    CCoinsSnapshotHeader() : nVersion(CURRENT_VERSION), hashBlock(0), nHeight(0), nChainTx(0) {
+        memset(pchMessageStart, 0, sizeof(pchMessageStart));
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(FLATDATA(pchMessageStart));
+        READWRITE(this->nVersion);
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(nChainTx);
+    }
+};
+
+/** Add a txid's unspent outputs to the UTXO set statistics and hash reported by gettxoutsetinfo */
+void ApplyCoinsStats(CHashWriter &ss, CCoinsStats &stats, const uint256 &txid, const CCoins &coins);
+/**
+ * Read the records of a UTXO set snapshot following the given header, filling
+ * in stats as gettxoutsetinfo would. Returns false if they do not match the
+ * snapshot's trailer; read errors are thrown.
+ */
+bool ReadCoinsSnapshotStats(CAutoFile &filein, const CCoinsSnapshotHeader &header, CCoinsStats &stats);
+
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CLevelDBWrapper db;
+
+    bool ScanCoins(CCoinsStats &stats, CAutoFile *pfileout, CUtxoStats *putxostats) const;
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -37,6 +86,73 @@ public:
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+    //! Write all coins as snapshot records (see CCoinsSnapshotHeader), filling in stats on the way
+    bool DumpSnapshot(CAutoFile &fileout, CCoinsStats &stats) const;
+    //! Compute the incrementally maintained statistics from scratch, and optionally the full ones of the same scan
+    bool GetUtxoStats(CUtxoStats &utxostats, CCoinsStats *pstats = NULL) const;
+};
+
+/**
+ * CCoinsView that accepts writes without waiting for them: BatchWrite only
+ * takes over the given entries, and Commit() writes them to the backing view
+ * later, typically from another thread. Until then, reads are answered from
+ * the pending entries first, as they are newer than the backing view. Commit
+ * reads the pending entries while they are still being served, so the backing
+ * view's BatchWrite must leave the map it is given unmodified.
+ */
+class CCoinsViewWriteBehind : public CCoinsViewBacked
+{
+private:
+    mutable boost::mutex mutex;
+    boost::condition_variable cond;
+    CCoinsMap cacheCoins;
+    uint256 hashBlock;
+    bool fPending;
+
+public:
+    CCoinsViewWriteBehind(CCoinsView *viewIn);
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    uint256 GetBestBlock() const;
+    //! Take over mapCoins, after waiting for the previous batch to be committed
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+
+    //! Write the pending batch (if any) to the backing view
+    bool Commit();
+};
+
+/**
+ * CCoinsView that lets worker threads read coins from its (thread-safe) backing
+ * view ahead of time. Each prefetched entry is handed out once, on the first
+ * GetCoins for it. Writes through this view drop all prefetched entries, as
+ * they may predate the write.
+ */
+class CCoinsViewPrefetch : public CCoinsViewBacked
+{
+private:
+    mutable boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<uint256> queue;
+    mutable CCoinsMap cacheCoins;
+    mutable size_t cachedCoinsUsage;
+    size_t nMaxUsage;
+    //! bumped around every write, so that reads racing with it are discarded
+    uint64_t nGeneration;
+
+    void Clear();
+
+public:
+    CCoinsViewPrefetch(CCoinsView *viewIn, size_t nMaxUsageIn);
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+
+    //! Queue txids for the worker threads to read
+    void Prefetch(const std::vector<uint256> &vTxid);
+    //! Worker thread loop; returns when interrupted
+    void Thread();
 };
 
 /** Access to the block database (blocks/index/) */
@@ -55,11 +171,166 @@ public:
     bool WriteLastBlockFile(int nFile);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
-    bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
-    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    //! Erase the transaction index older versions kept here (see CTxIndexDB), returning the number of entries erased
+    bool EraseLegacyTxIndex(uint64_t &nErased);
+    bool WriteSnapshotBase(const uint256 &hash, uint64_t nChainTx);
+    bool ReadSnapshotBase(uint256 &hash, uint64_t &nChainTx);
+    bool WriteUtxoStats(const CUtxoStats &stats);
+    bool ReadUtxoStats(const uint256 &hashBlock, CUtxoStats &stats);
+    bool EraseUtxoStats(const uint256 &hashBlock);
     bool LoadBlockIndexGuts();
 };
 
+/** Access to the transaction index database (txindex/) */
+class CTxIndexDB : public CLevelDBWrapper
+{
+public:
+    CTxIndexDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CTxIndexDB(const CTxIndexDB&);
+    void operator=(const CTxIndexDB&);
+public:
+    bool ReadTxPos(const uint256 &txid, CDiskTxPos &pos) const;
+    //! Write the positions of the transactions of some blocks, together with the locator of the last one
+    bool WriteTxPos(const std::vector<std::pair<uint256, CDiskTxPos> > &vPos, const CBlockLocator &locator);
+    bool ReadBestBlock(CBlockLocator &locator) const;
+};
+
+//! Comments can be searched by their first COMMENT_PREFIX_SIZE bytes
+static const unsigned int COMMENT_PREFIX_SIZE = 32;
+//! Keywords are words of letters and digits of this many characters
+static const unsigned int MIN_COMMENT_KEYWORD_SIZE = 3;
+static const unsigned int MAX_COMMENT_KEYWORD_SIZE = 32;
+//! At most this many keywords of a comment are indexed
+static const unsigned int MAX_COMMENT_KEYWORDS = 64;
+
+/** A transaction comment (strTxComment) of the active chain */
+class CTxComment
+{
+public:
+    uint256 txid;
+    int nHeight;
+    //! position of the transaction in its block
+    unsigned int nTx;
+    std::string strComment;
+
+    CTxComment() : nHeight(0), nTx(0) {}
+    CTxComment(const uint256 &txidIn, int nHeightIn, unsigned int nTxIn, const std::string &strCommentIn) :
+        txid(txidIn), nHeight(nHeightIn), nTx(nTxIn), strComment(strCommentIn) {}
+};
+
+/**
+ * The keywords a comment can be found by: its distinct words of
+ * MIN_COMMENT_KEYWORD_SIZE to MAX_COMMENT_KEYWORD_SIZE ASCII letters and
+ * digits, in lower case, at most MAX_COMMENT_KEYWORDS of them.
+ */
+std::vector<std::string> GetCommentKeywords(const std::string &strComment);
+
+/**
+ * Access to the comment index database (commentindex/). Besides the comment
+ * of each transaction, it keeps keys that sort by height, by comment prefix
+ * and by keyword, so that all three can be searched without a scan.
+ */
+class CCommentIndexDB : public CLevelDBWrapper
+{
+public:
+    CCommentIndexDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CCommentIndexDB(const CCommentIndexDB&);
+    void operator=(const CCommentIndexDB&);
+public:
+    bool ReadComment(const uint256 &txid, CTxComment &comment) const;
+    //! Erase and write comments, together with the locator of the last block they cover
+    bool WriteComments(const std::vector<CTxComment> &vErase, const std::vector<CTxComment> &vWrite, const CBlockLocator &locator);
+    bool ReadBestBlock(CBlockLocator &locator) const;
+
+    //! Append the comments from height nStartHeight to nEndHeight to vComment, in chain order
+    bool FindByHeight(int nStartHeight, int nEndHeight, unsigned int nMaxResults, std::vector<CTxComment> &vComment) const;
+    //! Append the comments starting with strPrefix from height nStartHeight on to vComment, ordered by comment
+    bool FindByPrefix(const std::string &strPrefix, int nStartHeight, unsigned int nMaxResults, std::vector<CTxComment> &vComment) const;
+    //! Append the comments with the given keyword from height nStartHeight on to vComment, in chain order
+    bool FindByKeyword(const std::string &strKeyword, int nStartHeight, unsigned int nMaxResults, std::vector<CTxComment> &vComment) const;
+};
+
+/**
+ * A change to the balance of a script in the address index: an output paying
+ * to it, or an input spending such an output.
+ */
+class CAddressDelta
+{
+public:
+    //! Hash160 of the scriptPubKey
+    uint160 hashScript;
+    int nHeight;
+    //! position of the transaction in its block
+    unsigned int nTx;
+    uint256 txid;
+    //! index of the output, or of the input when spending
+    unsigned int nIndex;
+    bool fSpending;
+    //! amount received, or spent (negative)
+    CAmount nValue;
+    //! when spending: the output spent, and its height (-1 if it is not in the index)
+    COutPoint prevout;
+    int nPrevHeight;
+
+    CAddressDelta() : nHeight(0), nTx(0), nIndex(0), fSpending(false), nValue(0), nPrevHeight(-1) {}
+    CAddressDelta(const uint160 &hashScriptIn, int nHeightIn, unsigned int nTxIn, const uint256 &txidIn, unsigned int nIndexIn, bool fSpendingIn, CAmount nValueIn) :
+        hashScript(hashScriptIn), nHeight(nHeightIn), nTx(nTxIn), txid(txidIn), nIndex(nIndexIn), fSpending(fSpendingIn), nValue(nValueIn), nPrevHeight(-1) {}
+};
+
+/** An unspent output of a script in the address index; null marks it spent */
+class CAddressUnspentValue
+{
+public:
+    CAmount nValue;
+    int nHeight;
+
+    CAddressUnspentValue() { SetNull(); }
+    CAddressUnspentValue(CAmount nValueIn, int nHeightIn) : nValue(nValueIn), nHeight(nHeightIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nValue);
+        READWRITE(nHeight);
+    }
+
+    void SetNull() { nValue = -1; nHeight = -1; }
+    bool IsNull() const { return nHeight == -1; }
+};
+
+typedef std::pair<uint160, COutPoint> CAddressUnspentKey;
+
+/**
+ * Access to the address index database (addressindex/): the history of each
+ * script, in chain order, and its unspent outputs, both keyed by the hash of
+ * the script first, and its running balance.
+ */
+class CAddressIndexDB : public CLevelDBWrapper
+{
+public:
+    CAddressIndexDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CAddressIndexDB(const CAddressIndexDB&);
+    void operator=(const CAddressIndexDB&);
+public:
+    //! Fill in the amount and spent output of a delta from its key fields
+    bool ReadDelta(CAddressDelta &delta) const;
+    bool ReadUnspent(const CAddressUnspentKey &key, CAddressUnspentValue &value) const;
+    //! The sum of the deltas of a script, and of those receiving (zero if it has none)
+    bool ReadBalance(const uint160 &hashScript, CAmount &nBalance, CAmount &nReceived) const;
+    //! Erase and write deltas, updating the balances, and update unspent outputs (erasing the null ones), together with the locator of the last block they cover
+    bool WriteDeltas(const std::vector<CAddressDelta> &vErase, const std::vector<CAddressDelta> &vWrite, const std::map<CAddressUnspentKey, CAddressUnspentValue> &mapUnspent, const CBlockLocator &locator);
+    bool ReadBestBlock(CBlockLocator &locator) const;
+
+    //! Append the deltas of a script from height nStartHeight to nEndHeight to vDelta, in chain order, skipping the first nSkipTxs transactions, for at most nMaxTxs transactions
+    bool FindDeltas(const uint160 &hashScript, int nStartHeight, int nEndHeight, unsigned int nSkipTxs, unsigned int nMaxTxs, std::vector<CAddressDelta> &vDelta) const;
+    //! Append the unspent outputs of a script to vUnspent, skipping the first nSkip
+    bool FindUnspent(const uint160 &hashScript, unsigned int nSkip, unsigned int nMaxResults, std::vector<std::pair<COutPoint, CAddressUnspentValue> > &vUnspent) const;
+};
+
 #endif // BITCOIN_TXDB_H
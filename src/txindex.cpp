@@ -0,0 +1,55 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txindex.h"
+
+#include "clientversion.h"
+#include "main.h"
+#include "streams.h"
+#include "util.h"
+
+CTxIndex *ptxindex = NULL;
+
+bool GetBlockTxPositions(const char* pbegin, const char* pend, const CDiskBlockPos &pos, std::vector<std::pair<uint256, CDiskTxPos> > &vPos)
+{
+    try {
+        CMemoryReader reader(pbegin, pend, SER_DISK, CLIENT_VERSION);
+        CBlockHeader header;
+        reader >> header;
+        // Transaction offsets are relative to the end of the header.
+        size_t nHeaderSize = reader.GetPos();
+        uint64_t nTx = ReadCompactSize(reader);
+        for (uint64_t i = 0; i < nTx; i++) {
+            CDiskTxPos postx(pos, reader.GetPos() - nHeaderSize);
+            CTransaction tx;
+            reader >> tx;
+            vPos.push_back(std::make_pair(tx.GetHash(), postx));
+        }
+    } catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+CTxIndex::CTxIndex(size_t nCacheSize, bool fMemory, bool fWipe) : CChainIndex("txindex"), db(nCacheSize, fMemory, fWipe)
+{
+}
+
+bool CTxIndex::AppendBlock(const CBlockIndex *pindex, const CDiskBlockPos &pos, const char* pbegin, const char* pend)
+{
+    return GetBlockTxPositions(pbegin, pend, pos, vPos);
+}
+
+bool CTxIndex::WriteBatch(const CBlockLocator &locator)
+{
+    if (!db.WriteTxPos(vPos, locator))
+        return false;
+    vPos.clear();
+    return true;
+}
+
+bool CTxIndex::FindTx(const uint256 &txid, CDiskTxPos &pos) const
+{
+    return db.ReadTxPos(txid, pos);
+}
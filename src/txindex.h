@@ -0,0 +1,47 @@
+// Copyright (c) 2015 The Florincoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXINDEX_H
+#define BITCOIN_TXINDEX_H
+
+#include "chainindex.h"
+#include "txdb.h"
+
+#include <utility>
+#include <vector>
+
+/**
+ * The transaction index (-txindex): where on disk each transaction of the
+ * active chain is stored. As it is built in the background, enabling it needs
+ * no reindex. Entries of disconnected blocks are kept until the transactions
+ * are confirmed again.
+ */
+class CTxIndex : public CChainIndex
+{
+private:
+    CTxIndexDB db;
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+
+protected:
+    bool AppendBlock(const CBlockIndex *pindex, const CDiskBlockPos &pos, const char* pbegin, const char* pend);
+    size_t GetBatchSize() const { return vPos.size(); }
+    bool WriteBatch(const CBlockLocator &locator);
+    bool ReadBestBlock(CBlockLocator &locator) const { return db.ReadBestBlock(locator); }
+
+public:
+    CTxIndex(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    bool FindTx(const uint256 &txid, CDiskTxPos &pos) const;
+};
+
+/**
+ * Append the positions of the transactions of the block serialized in
+ * [pbegin, pend), which is stored at pos, to vPos.
+ */
+bool GetBlockTxPositions(const char* pbegin, const char* pend, const CDiskBlockPos &pos, std::vector<std::pair<uint256, CDiskTxPos> > &vPos);
+
+/** The transaction index, or NULL without -txindex */
+extern CTxIndex *ptxindex;
+
+#endif // BITCOIN_TXINDEX_H
@@ -34,6 +34,7 @@
 #include <fcntl.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #else
 
@@ -579,6 +580,33 @@ int RaiseFileDescriptorLimit(int nMinFD) {
 #endif
 }
 
+int64_t GetProcessRSS() {
+#if defined(WIN32)
+    return 0;
+#else
+#ifdef __linux__
+    // Resident pages right now, the second field of statm
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (file) {
+        unsigned long nSize = 0, nResident = 0;
+        int nRead = fscanf(file, "%lu %lu", &nSize, &nResident);
+        fclose(file);
+        if (nRead == 2)
+            return (int64_t)nResident * sysconf(_SC_PAGESIZE);
+    }
+#endif
+    // Elsewhere only the peak is available, which for a load at startup is close enough
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return (int64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
 /**
  * this function tries to make a particular range of a file allocated (corresponding to disk space)
  * it is advisory, and the range specified in the arguments will never contain live data